@@ -25,6 +25,14 @@ TOOLINSTALLDIR	= /opt/toolchains/dc/bin
 # Define this if you want to use libbfd instead of libelf (which is default)
 WITH_BFD = 0
 
+# Define this to read files for the target with io_uring (Linux 5.6 and up,
+# needs liburing). Otherwise a few threads do the reads.
+WITH_IO_URING = 0
+
+# Define this to read CSO compressed disc images for -i (needs zlib). ZSO
+# images can be read either way.
+WITH_CSO = 1
+
 # For MinGW/MSYS, we need to use libbfd instead of libelf
 ifdef MINGW
   WITH_BFD = 1
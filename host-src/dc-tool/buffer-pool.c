@@ -0,0 +1,107 @@
+/*
+ * dc-tool, a tool for use with the dcload loader
+ *
+ * Copyright (C) 2023 Andrew Kieschnick <andrewk@austin.rr.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+/* Buffers for the syscall handlers.
+ *
+ * The handlers need a buffer the size the target asked for on nearly every
+ * call. Instead of a malloc and free each time, buffers are kept on free
+ * lists by power of two size, from 4 KB up to 16 MB, and handed out again.
+ * Anything bigger is malloc'd and freed as it comes.
+ */
+
+#include "buffer-pool.h"
+#include "syscalls.h"
+
+#include <stdlib.h>
+
+#define POOL_MIN_SHIFT  12
+#define POOL_MAX_SHIFT  24
+#define POOL_CLASSES    (POOL_MAX_SHIFT - POOL_MIN_SHIFT + 1)
+#define POOL_KEEP       4       /* free buffers kept per size */
+
+/* sits in front of every buffer; the union keeps the buffer aligned */
+typedef union pool_header {
+    struct {
+        union pool_header *next;
+        unsigned int shift;     /* 0 if not from a size class */
+    } h;
+    double align;
+    void *align_ptr;
+    long long align_ll;
+} pool_header_t;
+
+static pool_header_t *free_list[POOL_CLASSES];
+static unsigned int free_count[POOL_CLASSES];
+
+void *pool_alloc(size_t size)
+{
+    pool_header_t *buf;
+    unsigned int shift = POOL_MIN_SHIFT;
+
+    while (shift <= POOL_MAX_SHIFT && ((size_t)1 << shift) < size)
+        shift++;
+
+    if (shift > POOL_MAX_SHIFT) {
+        dc_syscall_alloc();
+        if (!(buf = malloc(sizeof(pool_header_t) + size)))
+            return NULL;
+        buf->h.shift = 0;
+        return buf + 1;
+    }
+
+    if ((buf = free_list[shift - POOL_MIN_SHIFT])) {
+        free_list[shift - POOL_MIN_SHIFT] = buf->h.next;
+        free_count[shift - POOL_MIN_SHIFT]--;
+        return buf + 1;
+    }
+
+    dc_syscall_alloc();
+    if (!(buf = malloc(sizeof(pool_header_t) + ((size_t)1 << shift))))
+        return NULL;
+    buf->h.shift = shift;
+
+    return buf + 1;
+}
+
+void pool_free(void *ptr)
+{
+    pool_header_t *buf;
+    unsigned int class;
+
+    if (!ptr)
+        return;
+
+    buf = (pool_header_t *)ptr - 1;
+    if (!buf->h.shift) {
+        free(buf);
+        return;
+    }
+
+    class = buf->h.shift - POOL_MIN_SHIFT;
+    if (free_count[class] >= POOL_KEEP) {
+        free(buf);
+        return;
+    }
+
+    buf->h.next = free_list[class];
+    free_list[class] = buf;
+    free_count[class]++;
+}
@@ -0,0 +1,36 @@
+/*
+ * dc-tool, a tool for use with the dcload loader
+ *
+ * Copyright (C) 2023 Andrew Kieschnick <andrewk@austin.rr.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#ifndef __BUFFER_POOL_H__
+#define __BUFFER_POOL_H__
+
+#include <stddef.h>
+
+/* pool_alloc returns a buffer of at least size bytes, reusing one that was
+ * given back with pool_free where it can. Returns NULL if there's no memory.
+ * The pool is only for the dispatch thread.
+ */
+void *pool_alloc(size_t size);
+
+/* pool_free gives buf back to the pool. buf may be NULL. */
+void pool_free(void *buf);
+
+#endif /* __BUFFER_POOL_H__ */
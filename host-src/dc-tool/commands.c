@@ -18,14 +18,21 @@
  */
 
 #include "commands.h"
+#include "crc32.h"
 #include "utils.h"
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 #include <fcntl.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/stat.h>
 #include <sys/time.h>
+#ifndef __MINGW32__
+#include <sys/mman.h>
+#endif
 
 #ifdef WITH_BFD
 #include <bfd.h>
@@ -37,6 +44,14 @@
 #define O_BINARY 0
 #endif
 
+/* say how much host CPU a transfer of wall seconds took since startcpu */
+static void report_cpu(clock_t startcpu, double wall)
+{
+    double cpu = (double)(clock() - startcpu) / CLOCKS_PER_SEC;
+
+    printf("%.2f seconds of CPU time (%.0f%% of one core)\n", cpu, wall > 0 ? cpu * 100 / wall : 0);
+}
+
 int download(const char *filename, unsigned int address, unsigned int size, xprt_recv_data_t recv)
 {
     int outputfd;
@@ -44,6 +59,7 @@ int download(const char *filename, unsigned int address, unsigned int size, xprt
     unsigned char *data;
     struct timeval starttime, endtime;
     double stime, etime;
+    clock_t startcpu = clock();
 
     outputfd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);
 
@@ -67,6 +83,7 @@ int download(const char *filename, unsigned int address, unsigned int size, xprt
     etime = endtime.tv_sec + endtime.tv_usec / 1000000.0;
 
     printf("transferred at %f bytes / sec\n", (double) size / (etime - stime));
+    report_cpu(startcpu, etime - stime);
     fflush(stdout);
 
     write(outputfd, data, size);
@@ -77,17 +94,425 @@ int download(const char *filename, unsigned int address, unsigned int size, xprt
     return 0;
 }
 
-unsigned int upload(const char *filename, unsigned int address, xprt_send_data_t send)
+/* runs of zeroes shorter than this aren't worth a separate fill command */
+#define FILL_MIN_RUN 4096
+
+/* delta uploads compare the CRC-32 of each DELTA_CHUNK bytes, DELTA_BATCH
+ * chunks at a time. Unchanged gaps of up to DELTA_GAP chunks between changed
+ * ones are sent anyway, as that's cheaper than starting another transfer.
+ */
+#define DELTA_CHUNK 1024
+#define DELTA_BATCH 256
+#define DELTA_GAP   8
+
+typedef struct {
+    const xprt_upload_t *xprt;
+    xprt_fill_data_t fill;  /* NULL once the target turns out not to fill */
+    xprt_hash_data_t hash;  /* NULL unless this is a delta upload */
+    unsigned int filled;    /* bytes zero filled rather than sent */
+    unsigned int skipped;   /* bytes the target already had */
+    xprt_segment_t *segs;   /* waiting for xprt->send_segments */
+    unsigned int nsegs;
+    void **buffers;         /* freed once the segments are sent */
+    unsigned int nbuffers;
+    int launched;           /* the target started the program itself */
+} upload_state_t;
+
+/* send len bytes at data to dcaddr, or hold on to them until upload_flush if
+ * the transport sends everything in one go */
+static int send_raw(unsigned char *data, unsigned int len, unsigned int dcaddr, upload_state_t *state)
+{
+    xprt_segment_t *segs;
+
+    if (!state->xprt->send_segments)
+        return state->xprt->send(data, len, dcaddr);
+
+    if (!(segs = realloc(state->segs, (state->nsegs + 1) * sizeof(xprt_segment_t))))
+        return -1;
+
+    state->segs = segs;
+    segs[state->nsegs].data = data;
+    segs[state->nsegs].len = len;
+    segs[state->nsegs].dcaddr = dcaddr;
+    state->nsegs++;
+
+    return 0;
+}
+
+#ifdef WITH_BFD
+/* free buf once everything held for send_segments is out */
+static void keep_buffer(void *buf, upload_state_t *state)
+{
+    void **buffers;
+
+    if (!state->xprt->send_segments) {
+        free(buf);
+        return;
+    }
+
+    if (!(buffers = realloc(state->buffers, (state->nbuffers + 1) * sizeof(void *)))) {
+        /* can't happen in practice, and leaking beats sending freed memory */
+        return;
+    }
+
+    state->buffers = buffers;
+    buffers[state->nbuffers++] = buf;
+}
+#endif
+
+/* send whatever send_raw held on to, starting the program at address if
+ * we're executing and the target can do that by itself */
+static int upload_flush(unsigned int address, upload_state_t *state)
+{
+    const xprt_upload_t *xprt = state->xprt;
+    unsigned int i;
+    int retval = 0;
+
+    if (!xprt->send_segments || (!state->nsegs && !xprt->execute))
+        return 0;
+
+    retval = xprt->send_segments(state->segs, state->nsegs, xprt->execute != NULL,
+                                 address, xprt->console, xprt->cdfsredir);
+    if (retval == 0)
+        state->launched = xprt->execute != NULL;
+
+    /* the target can't take them all at once, so one at a time it is */
+    for (i = 0; retval == 1 && i < state->nsegs; i++)
+        if (xprt->send(state->segs[i].data, state->segs[i].len, state->segs[i].dcaddr) == -1)
+            retval = -1;
+    if (retval == 1)
+        retval = 0;
+
+    for (i = 0; i < state->nbuffers; i++)
+        free(state->buffers[i]);
+    free(state->buffers);
+    free(state->segs);
+    state->buffers = NULL;
+    state->nbuffers = 0;
+    state->segs = NULL;
+    state->nsegs = 0;
+
+    return retval;
+}
+
+/* fill len bytes at dcaddr with zeroes. Returns 1 (and forgets about
+ * filling) if the target can't do it. */
+static int fill_zero(unsigned int dcaddr, unsigned int len, upload_state_t *state)
+{
+    int retval;
+
+    if (!state->fill)
+        return 1;
+
+    if ((retval = state->fill(dcaddr, len, 0)) == 1)
+        state->fill = NULL;
+    else if (retval == 0)
+        state->filled += len;
+
+    return retval;
+}
+
+/* send len bytes at data to dcaddr, leaving out whole chunks that the
+ * target already holds */
+static int send_delta(unsigned char *data, unsigned int len, unsigned int dcaddr, upload_state_t *state)
+{
+    unsigned int hashes[DELTA_BATCH];
+    unsigned int offset, batch, n, i, o, clen;
+    unsigned int run_start = 0, run_end = 0;
+    int have_run = 0;
+    int retval;
+
+    for (offset = 0; offset < len; offset += batch) {
+        batch = (len - offset > DELTA_BATCH * DELTA_CHUNK) ? DELTA_BATCH * DELTA_CHUNK : len - offset;
+        n = (batch + DELTA_CHUNK - 1) / DELTA_CHUNK;
+
+        if ((retval = state->hash(dcaddr + offset, batch, DELTA_CHUNK, hashes)) == -1)
+            return -1;
+
+        if (retval == 1) {
+            /* no hash support, so send everything from here on */
+            state->hash = NULL;
+            break;
+        }
+
+        for (i = 0; i < n; i++) {
+            o = offset + i * DELTA_CHUNK;
+            clen = (len - o > DELTA_CHUNK) ? DELTA_CHUNK : len - o;
+
+            if (crc32_block(data + o, clen) == hashes[i]) {
+                state->skipped += clen;
+                continue;
+            }
+
+            if (have_run && o - run_end <= DELTA_GAP * DELTA_CHUNK) {
+                state->skipped -= o - run_end;
+                run_end = o + clen;
+                continue;
+            }
+
+            if (have_run && send_raw(data + run_start, run_end - run_start, dcaddr + run_start, state) == -1)
+                return -1;
+
+            run_start = o;
+            run_end = o + clen;
+            have_run = 1;
+        }
+    }
+
+    if (have_run && send_raw(data + run_start, run_end - run_start, dcaddr + run_start, state) == -1)
+        return -1;
+
+    if (offset < len && send_raw(data + offset, len - offset, dcaddr + offset, state) == -1)
+        return -1;
+
+    return 0;
+}
+
+/* send len bytes at data to dcaddr, as a delta if we can */
+static int send_part(unsigned char *data, unsigned int len, unsigned int dcaddr, upload_state_t *state)
+{
+    if (state->hash)
+        return send_delta(data, len, dcaddr, state);
+
+    return send_raw(data, len, dcaddr, state);
+}
+
+/* find the first run of at least FILL_MIN_RUN zero bytes in len bytes at
+ * data, returning its offset (len if there is none) and length */
+static unsigned int find_zero_run(unsigned char *data, unsigned int len, unsigned int *run)
+{
+    unsigned int start = 0, i = 0;
+
+    while (i < len) {
+        if (data[i]) {
+            start = ++i;
+            continue;
+        }
+
+        /* skip whole words of zeroes where we can */
+        if (!(((size_t)(data + i)) & (sizeof(long) - 1)))
+            while (i + sizeof(long) <= len && !*(long *)(data + i))
+                i += sizeof(long);
+        if (i < len && !data[i])
+            i++;
+
+        if (i - start >= FILL_MIN_RUN && (i == len || data[i])) {
+            *run = i - start;
+            return start;
+        }
+    }
+
+    *run = 0;
+    return len;
+}
+
+/* send len bytes at data to dcaddr, filling long runs of zeroes instead */
+static int send_filled(unsigned char *data, unsigned int len, unsigned int dcaddr, upload_state_t *state)
+{
+    unsigned int start, run;
+    int retval;
+
+    while (state->fill && len) {
+        start = find_zero_run(data, len, &run);
+
+        if (start && send_part(data, start, dcaddr, state) == -1)
+            return -1;
+
+        if (!run)
+            return 0;
+
+        if ((retval = fill_zero(dcaddr + start, run, state)) == -1)
+            return -1;
+
+        if (retval == 1) {
+            /* no fill support after all, so send the zeroes too */
+            data += start;
+            dcaddr += start;
+            len -= start;
+            break;
+        }
+
+        data += start + run;
+        dcaddr += start + run;
+        len -= start + run;
+    }
+
+    if (len && send_part(data, len, dcaddr, state) == -1)
+        return -1;
+
+    return 0;
+}
+
+/* map the whole of filename into memory, or read it in where there's no mmap.
+ * Returns NULL on failure. */
+static unsigned char *map_file(const char *filename, size_t *size)
+{
+    unsigned char *image;
+    struct stat st;
+    int fd;
+
+    if ((fd = open(filename, O_RDONLY | O_BINARY)) < 0) {
+        log_error(filename);
+        return NULL;
+    }
+
+    if (fstat(fd, &st) < 0 || !st.st_size) {
+        log_error(filename);
+        close(fd);
+        return NULL;
+    }
+
+    *size = st.st_size;
+
+#ifndef __MINGW32__
+    image = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (image == MAP_FAILED)
+        image = NULL;
+#ifdef MADV_SEQUENTIAL
+    else
+        madvise(image, *size, MADV_SEQUENTIAL);
+#endif
+#else
+    if ((image = malloc(*size)) && read(fd, image, *size) != (ssize_t)*size) {
+        free(image);
+        image = NULL;
+    }
+#endif
+
+    if (!image)
+        log_error(filename);
+
+    close(fd);
+    return image;
+}
+
+static void unmap_file(unsigned char *image, size_t size)
+{
+#ifndef __MINGW32__
+    munmap(image, size);
+#else
+    free(image);
+#endif
+}
+
+/* ELF32 is read straight out of the mapping. These are the offsets of the
+ * few fields needed, so that no ELF headers are required to build. */
+#define ELF_EHDR_SIZE   52
+#define ELF_E_ENTRY     24
+#define ELF_E_PHOFF     28
+#define ELF_E_PHENTSIZE 42
+#define ELF_E_PHNUM     44
+#define ELF_PHDR_SIZE   32
+#define ELF_P_TYPE      0
+#define ELF_P_OFFSET    4
+#define ELF_P_PADDR     12
+#define ELF_P_FILESZ    16
+#define ELF_P_MEMSZ     20
+#define ELF_PT_LOAD     1
+
+static unsigned int elf_word(const unsigned char *p, int msb)
+{
+    if (msb)
+        return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+static unsigned int elf_half(const unsigned char *p, int msb)
+{
+    return msb ? (p[0] << 8) | p[1] : p[0] | (p[1] << 8);
+}
+
+/* Upload the PT_LOAD segments of the ELF32 file in image, sending straight
+ * out of the mapping. The memory past p_filesz is zero filled. Returns 1 if
+ * image isn't something this can load, so the caller can fall back on
+ * reading sections.
+ */
+static int upload_segments(unsigned char *image, size_t image_size, unsigned int *address,
+                           int *size, upload_state_t *state)
+{
+    const unsigned char *ph;
+    unsigned int phoff, phentsize, phnum, i, n = 0;
+    unsigned int offset, paddr, filesz, memsz;
+    int msb;
+
+    if (image_size < ELF_EHDR_SIZE || memcmp(image, "\177ELF", 4) || image[4] != 1)
+        return 1;
+    if (image[5] != 1 && image[5] != 2)
+        return 1;
+    msb = (image[5] == 2);
+
+    phoff = elf_word(image + ELF_E_PHOFF, msb);
+    phentsize = elf_half(image + ELF_E_PHENTSIZE, msb);
+    phnum = elf_half(image + ELF_E_PHNUM, msb);
+
+    if (!phoff || !phnum || phentsize < ELF_PHDR_SIZE || phoff > image_size ||
+        (image_size - phoff) / phentsize < phnum)
+        return 1;
+
+    /* check every segment first so that nothing is sent from a bad file */
+    for (i = 0; i < phnum; i++) {
+        ph = image + phoff + i * phentsize;
+        if (elf_word(ph + ELF_P_TYPE, msb) != ELF_PT_LOAD)
+            continue;
+
+        offset = elf_word(ph + ELF_P_OFFSET, msb);
+        filesz = elf_word(ph + ELF_P_FILESZ, msb);
+        memsz = elf_word(ph + ELF_P_MEMSZ, msb);
+        if (offset > image_size || filesz > image_size - offset || memsz < filesz)
+            return 1;
+        n++;
+    }
+
+    if (!n)
+        return 1;
+
+    *address = elf_word(image + ELF_E_ENTRY, msb);
+    printf("File format is ELF, start address is 0x%x\n", *address);
+
+    for (i = 0; i < phnum; i++) {
+        ph = image + phoff + i * phentsize;
+        if (elf_word(ph + ELF_P_TYPE, msb) != ELF_PT_LOAD)
+            continue;
+
+        offset = elf_word(ph + ELF_P_OFFSET, msb);
+        paddr = elf_word(ph + ELF_P_PADDR, msb);
+        filesz = elf_word(ph + ELF_P_FILESZ, msb);
+        memsz = elf_word(ph + ELF_P_MEMSZ, msb);
+
+        if (!memsz)
+            continue;
+
+        printf("Segment %u, lma 0x%08x, size %u, memsz %u\n", i, paddr, filesz, memsz);
+        *size += filesz;
+
+        if (filesz && send_filled(image + offset, filesz, paddr, state) == -1)
+            return -1;
+
+        /* .bss and friends have nothing to upload, but can be cleared */
+        if (memsz > filesz && fill_zero(paddr + filesz, memsz - filesz, state) == -1)
+            return -1;
+    }
+
+    return 0;
+}
+
+unsigned int upload(const char *filename, unsigned int address, const xprt_upload_t *xprt)
 {
-    int inputfd;
     int size = 0;
-    unsigned char *inbuf;
+    upload_state_t state = { xprt, xprt->fill, xprt->hash, 0, 0, NULL, 0, NULL, 0, 0 };
+    unsigned char *image;
+    size_t image_size;
+    int retval;
     struct timeval starttime, endtime;
+    clock_t startcpu = clock();
+    unsigned int packed_total = 0, packed_sent = 0, total, sent;
 
     double stime, etime;
 #ifdef WITH_BFD
     bfd *somebfd;
+    unsigned char *inbuf;
 #else
+    int inputfd;
     Elf *elf;
     Elf32_Ehdr *ehdr;
     Elf32_Shdr *shdr;
@@ -95,13 +520,30 @@ unsigned int upload(const char *filename, unsigned int address, xprt_send_data_t
     Elf_Data *data;
     char *section_name;
     size_t index;
+    int filled;
 #endif
 
+    if (!(image = map_file(filename, &image_size)))
+        return -1;
+
+    /* load ELF program headers straight from the mapping where we can */
+    if (xprt->packed)
+        xprt->packed(&packed_total, &packed_sent);
+
+    gettimeofday(&starttime, 0);
+    if ((retval = upload_segments(image, image_size, &address, &size, &state)) != 1) {
+        if (retval == -1 || upload_flush(address, &state) == -1) {
+            goto fail;
+        }
+        goto done_transfer;
+    }
+
 #ifdef WITH_BFD
     if ((somebfd = bfd_openr(filename, 0))) {
         if (bfd_check_format(somebfd, bfd_object)) {
             /* try bfd first */
             asection *section;
+            unsigned int sectsize;
 
             printf("File format is %s, ", somebfd->xvec->name);
             address = somebfd->start_address;
@@ -122,18 +564,28 @@ unsigned int upload(const char *filename, unsigned int address, xprt_send_data_t
                         inbuf = malloc(sectsize);
                         bfd_get_section_contents(somebfd, section, inbuf, 0, sectsize);
 
-                        if (send(inbuf, sectsize, section->lma, sectsize) == -1) {
+                        if (send_filled(inbuf, sectsize, section->lma, &state) == -1) {
                             free(inbuf);
                             bfd_close(somebfd);
-                            return -1;
+                            goto fail;
                         }
 
-                        free(inbuf);
+                        keep_buffer(inbuf, &state);
+                    }
+                } else if ((section->flags & SEC_ALLOC) && !(section->flags & SEC_HAS_CONTENTS)) {
+                    /* .bss and friends */
+                    sectsize = bfd_section_size(somebfd, section);
+                    if (sectsize && fill_zero(section->lma, sectsize, &state) == -1) {
+                        bfd_close(somebfd);
+                        goto fail;
                     }
                 }
             }
 
             bfd_close(somebfd);
+
+            if (upload_flush(address, &state) == -1)
+                goto fail;
             goto done_transfer;
         }
 
@@ -142,24 +594,24 @@ unsigned int upload(const char *filename, unsigned int address, xprt_send_data_t
 #else /* !WITH_BFD -- use libelf */
     if(elf_version(EV_CURRENT) == EV_NONE) {
         fprintf(stderr, "libelf initialization error: %s\n", elf_errmsg(-1));
-        return -1;
+        goto fail;
     }
 
     if((inputfd = open(filename, O_RDONLY | O_BINARY)) < 0) {
         log_error(filename);
-        return -1;
+        goto fail;
     }
 
     if(!(elf = elf_begin(inputfd, ELF_C_READ, NULL))) {
         fprintf(stderr, "Cannot read ELF file: %s\n", elf_errmsg(-1));
-        return -1;
+        goto fail_elf;
     }
 
     switch (elf_kind(elf)) {
     case ELF_K_ELF:
         if(!(ehdr = elf32_getehdr(elf))) {
             fprintf(stderr, "Unable to read ELF header: %s\n", elf_errmsg(-1));
-            return -1;
+            goto fail_elf;
         }
 
         address = ehdr->e_entry;
@@ -169,24 +621,38 @@ unsigned int upload(const char *filename, unsigned int address, xprt_send_data_t
            section names */
         if(elf_getshdrstrndx(elf, &index)) {
             fprintf(stderr, "Unable to read section index: %s\n", elf_errmsg(-1));
-            return -1;
+            goto fail_elf;
         }
 
         gettimeofday(&starttime, 0);
         while((section = elf_nextscn(elf, section))) {
             if(!(shdr = elf32_getshdr(section))) {
                 fprintf(stderr, "Unable to read section header: %s\n", elf_errmsg(-1));
-                return -1;
+                goto fail_elf;
             }
 
             if(!(section_name = elf_strptr(elf, index, shdr->sh_name))) {
                 fprintf(stderr, "Unable to read section name: %s\n", elf_errmsg(-1));
-                return -1;
+                goto fail_elf;
             }
 
             if(!shdr->sh_addr)
                 continue;
 
+            /* .bss and friends have nothing to upload, but can be cleared */
+            if(shdr->sh_type == SHT_NOBITS) {
+                if(!(shdr->sh_flags & SHF_ALLOC) || !shdr->sh_size)
+                    continue;
+
+                if((filled = fill_zero(shdr->sh_addr, shdr->sh_size, &state)) == -1)
+                    goto fail_elf;
+
+                if(filled == 0)
+                    printf("Section %s, lma 0x%08x, size %d, zero filled\n", section_name,
+                           shdr->sh_addr, shdr->sh_size);
+                continue;
+            }
+
             /* Check if there's some data to upload. */
             data = elf_getdata(section, NULL);
             if(!data->d_buf || !data->d_size)
@@ -197,12 +663,16 @@ unsigned int upload(const char *filename, unsigned int address, xprt_send_data_t
             size += shdr->sh_size;
 
             do {
-                if (send(data->d_buf, data->d_size, shdr->sh_addr + data->d_off) == -1) {
-                    return -1;
+                if (send_filled(data->d_buf, data->d_size, shdr->sh_addr + data->d_off, &state) == -1) {
+                    goto fail_elf;
                 }
             } while((data = elf_getdata(section, data)));
         }
 
+        /* the section data belongs to elf, so send it before letting go */
+        if (upload_flush(address, &state) == -1)
+            goto fail_elf;
+
         elf_end(elf);
         close(inputfd);
         goto done_transfer;
@@ -212,49 +682,67 @@ unsigned int upload(const char *filename, unsigned int address, xprt_send_data_t
     }
 #endif /* WITH_BFD */
     /* if all else fails, send raw bin */
-    inputfd = open(filename, O_RDONLY | O_BINARY);
-
-    if (inputfd < 0) {
-        log_error(filename);
-        return -1;
-    }
-
     printf("File format is raw binary, start address is 0x%x\n", address);
 
-    size = lseek(inputfd, 0, SEEK_END);
-    lseek(inputfd, 0, SEEK_SET);
-
-    inbuf = malloc(size);
-    read(inputfd, inbuf, size);
-    close(inputfd);
+    size = image_size;
 
     gettimeofday(&starttime, 0);
 
-    if (send(inbuf, size, address) == -1) {
-        return -1;
+    if (send_filled(image, size, address, &state) == -1) {
+        goto fail;
     }
 
+    if (upload_flush(address, &state) == -1)
+        goto fail;
+
 done_transfer:
     gettimeofday(&endtime, 0);
+    unmap_file(image, image_size);
 
     stime = starttime.tv_sec + starttime.tv_usec / 1000000.0;
     etime = endtime.tv_sec + endtime.tv_usec / 1000000.0;
 
     printf("transferred %d bytes at %f bytes / sec\n", size, (double) size / (etime - stime));
     printf("%.2f seconds to transfer %d bytes\n", (etime - stime), size);
+    report_cpu(startcpu, etime - stime);
+    if (state.filled)
+        printf("%u bytes zero filled rather than sent\n", state.filled);
+    if (state.skipped)
+        printf("%u bytes unchanged on the target and not sent\n", state.skipped);
+    if (xprt->packed) {
+        xprt->packed(&total, &sent);
+        if (total != packed_total)
+            printf("lzo: sent %u bytes as %u\n", total - packed_total, sent - packed_sent);
+    }
+
+    if (xprt->execute) {
+        printf("Executing at <0x%x>\n", address);
+        if (!state.launched && xprt->execute(address, xprt->console, xprt->cdfsredir) == -1)
+            return -1;
+    }
     fflush(stdout);
 
     return address;
+
+#ifndef WITH_BFD
+fail_elf:
+    if (elf)
+        elf_end(elf);
+    close(inputfd);
+#endif
+fail:
+    unmap_file(image, image_size);
+    return -1;
 }
 
 int do_console(const char *chroot_path, const char *iso_path, xprt_dispatch_t dispatch)
 {
     int ret = 0;
-    int isofd = -1;
+    disc_image_t *disc = NULL;
 
     if (iso_path) {
-        isofd = open(iso_path, O_RDONLY | O_BINARY);
-        if (isofd < 0)
+        disc = disc_open(iso_path);
+        if (!disc)
             log_error(iso_path);
     }
 
@@ -265,10 +753,10 @@ int do_console(const char *chroot_path, const char *iso_path, xprt_dispatch_t di
 
     while (ret == 0) {
         fflush(stdout);
-        ret = dispatch(isofd);
+        ret = dispatch(disc);
     }
 
-    close(isofd);
+    disc_close(disc);
 
     return (ret < 0) ? -1 : 0;
 }
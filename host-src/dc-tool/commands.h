@@ -22,6 +22,8 @@
 
 #include <sys/types.h>
 
+#include "disc-image.h"
+
 /* xprt_recv_data_t is a pointer to a transport function that copies data from
  * the target system to the host.
  *
@@ -45,7 +47,77 @@ int download(const char *filename, unsigned int address, unsigned int size, xprt
  */
 typedef int (*xprt_send_data_t)(void *data, size_t len, unsigned dcaddr);
 
-unsigned int upload(const char *filename, unsigned int address, xprt_send_data_t send);
+/* xprt_fill_data_t is a pointer to a transport function that sets len bytes
+ * at dcaddr on the target to value, without sending them.
+ *
+ * Returns -1 on failure, or 1 if the target doesn't support filling.
+ */
+typedef int (*xprt_fill_data_t)(unsigned dcaddr, size_t len, unsigned char value);
+
+/* xprt_hash_data_t is a pointer to a transport function that gets the CRC-32
+ * of each chunk bytes of the len bytes at dcaddr on the target (the last one
+ * may be shorter), storing them in hashes.
+ *
+ * Returns -1 on failure, or 1 if the target doesn't support hashing.
+ */
+typedef int (*xprt_hash_data_t)(unsigned dcaddr, size_t len, unsigned chunk, unsigned int *hashes);
+
+/* xprt_segment_t is one piece of a multi-segment upload: len bytes at data
+ * that go to dcaddr on the target.
+ */
+typedef struct {
+    void *data;
+    size_t len;
+    unsigned dcaddr;
+} xprt_segment_t;
+
+/* xprt_send_segments_t is a pointer to a transport function that sends count
+ * segments to the target in a single transfer. If execute is set the target
+ * starts the program at entry as soon as every segment has arrived, with
+ * console and cdfsredir as for xprt_execute_t.
+ *
+ * Returns -1 on failure, or 1 if the target can't take these segments in one
+ * transfer, in which case nothing has been sent.
+ */
+typedef int (*xprt_send_segments_t)(xprt_segment_t *segs, unsigned count, int execute, unsigned entry, unsigned console, unsigned cdfsredir);
+
+/* xprt_execute_t is a pointer to a transport function that starts the program
+ * at dcaddr on the target.
+ *
+ * Returns -1 on failure.
+ */
+typedef int (*xprt_execute_t)(unsigned dcaddr, unsigned console, unsigned cdfsredir);
+
+/* xprt_packed_t is a pointer to a transport function that gets how many bytes
+ * have been sent compressed so far, and how many went on the wire for them.
+ */
+typedef void (*xprt_packed_t)(unsigned int *total, unsigned int *packed);
+
+/* xprt_upload_t is the set of transport functions upload works with. Only send
+ * is required.
+ *
+ * fill is used to zero runs of zeroes and NOBITS sections rather than sending
+ * them, and hash to only send the chunks that differ from what the target
+ * already holds (a delta upload). If send_segments is there, everything is
+ * sent in one transfer once the file has been read. If execute is there, the
+ * program is started once it has been uploaded. If packed is there, upload
+ * reports how much compression saved.
+ */
+typedef struct {
+    xprt_send_data_t send;
+    xprt_fill_data_t fill;
+    xprt_hash_data_t hash;
+    xprt_send_segments_t send_segments;
+    xprt_execute_t execute;
+    xprt_packed_t packed;
+    unsigned console;
+    unsigned cdfsredir;
+} xprt_upload_t;
+
+/* upload sends filename to the target, and starts it if xprt->execute is set.
+ * Returns the start address, or -1 on failure.
+ */
+unsigned int upload(const char *filename, unsigned int address, const xprt_upload_t *xprt);
 
 struct dc_system_calls;
 typedef struct dc_system_calls dc_system_calls_t;
@@ -56,7 +128,7 @@ typedef struct dc_system_calls dc_system_calls_t;
  *  0 to continue dispatching
  *  1 to finish dispatching
  */
-typedef int (*xprt_dispatch_t)(int isofd);
+typedef int (*xprt_dispatch_t)(disc_image_t *disc);
 
 int do_console(const char *chroot_path, const char *iso_path, xprt_dispatch_t dispatch);
 
@@ -0,0 +1,651 @@
+/*
+ * dc-tool, a tool for use with the dcload loader
+ *
+ * Copyright (C) 2023 Andrew Kieschnick <andrewk@austin.rr.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+/* Block compressed disc images: CSO and ZSO.
+ *
+ * Both are an ISO cut into blocks (2048 bytes as a rule) that are each
+ * compressed on their own, deflate for CSO and LZ4 for ZSO, with an index
+ * of where every block starts. A block stored as it is has the top bit of
+ * its index entry set. CSO v2 images mark LZ4 blocks that way instead, and
+ * store plain blocks at full size.
+ *
+ * Decompressed blocks are kept in one LRU for all the images, as big as -z
+ * says. Once the target reads an image sequentially, the blocks after the
+ * read are decompressed ahead by a worker thread, so they're already there
+ * by the time the target asks for them. A block the target wants that's
+ * still waiting for the worker is taken back and decompressed right away.
+ *
+ * CHD images are compressed in hunks with a choice of codecs and would need
+ * libchdr, so they're turned away with a hint to convert them.
+ *
+ * On MinGW read_at moves the file position, so nothing is read on the
+ * worker there and blocks are only decompressed when they're asked for.
+ */
+
+#include "compressed-image.h"
+#include "utils.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef WITH_CSO
+#include <zlib.h>
+#endif
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+#define CSO_HEADER      24
+#define CSO_PLAIN       0x80000000
+#define CSO_AHEAD       (256 * 1024)    /* decompressed ahead of sequential reads */
+#define CSO_CACHE       16              /* megabytes, unless -z says otherwise */
+
+typedef enum {
+    CB_QUEUED,                  /* waiting for the worker */
+    CB_LOADING,                 /* being decompressed */
+    CB_READY
+} cblock_state_t;
+
+typedef struct cblock {
+    compressed_image_t *image;
+    unsigned int index;
+    cblock_state_t state;
+    int len;                    /* bytes of data, -1 if it couldn't be read */
+    unsigned char *data;
+    struct cblock *newer, *older;   /* in the LRU, once it's ready */
+    struct cblock *next;        /* in the worker's queue */
+} cblock_t;
+
+struct compressed_image {
+    int fd;
+    int lz4;                    /* ZSO: compressed blocks are LZ4 */
+    int v2;                     /* CSO v2: plain blocks are the full size */
+    unsigned int block_size;
+    unsigned int align;
+    unsigned int blocks;
+    unsigned long long size;
+    unsigned int *index;        /* blocks + 1 entries */
+    cblock_t **cached;          /* the block's cache entry, if it has one */
+    unsigned int busy;          /* blocks queued or being decompressed */
+    off_t next;                 /* where the last read ended */
+    unsigned int sequential;    /* reads in a row that started at next */
+};
+
+/* what a thread decompresses with */
+typedef struct {
+    unsigned char *in;
+    unsigned int in_size;
+#ifdef WITH_CSO
+    z_stream z;
+    int z_ready;
+#endif
+} decoder_t;
+
+/* everything below is shared with the worker, under lock */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t finished = PTHREAD_COND_INITIALIZER;
+static cblock_t *queue_head, *queue_tail;
+static cblock_t *newest, *oldest;
+static unsigned long long cache_used;
+static unsigned long long cache_limit = (unsigned long long)CSO_CACHE << 20;
+static int worker_state;        /* 0 not started, 1 running, -1 couldn't be */
+
+static unsigned int reads, hits, misses, waited, ahead;
+
+static decoder_t reader;        /* the dispatch thread's */
+
+static unsigned int le32(const unsigned char *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (unsigned int)p[3] << 24;
+}
+
+int compressed_probe(const char *path, off_t *size)
+{
+    unsigned char header[CSO_HEADER];
+    int fd, n;
+
+    if ((fd = open(path, O_RDONLY | O_BINARY)) < 0)
+        return 0;
+    n = read(fd, header, sizeof(header));
+    close(fd);
+
+    if (n >= 8 && !memcmp(header, "MComprHD", 8)) {
+        fprintf(stderr, "%s: CHD images aren't supported, convert it with chdman extractcd\n", path);
+        return -1;
+    }
+
+    if (n != CSO_HEADER || (memcmp(header, "CISO", 4) && memcmp(header, "ZISO", 4)))
+        return 0;
+
+#ifndef WITH_CSO
+    if (!memcmp(header, "CISO", 4)) {
+        fprintf(stderr, "%s: dc-tool was built without zlib, so CSO images can't be read\n", path);
+        return -1;
+    }
+#endif
+
+    *size = le32(header + 8) | (off_t)le32(header + 12) << 32;
+
+    return 1;
+}
+
+compressed_image_t *compressed_open(int fd)
+{
+    unsigned char header[CSO_HEADER];
+    compressed_image_t *image;
+    unsigned int i;
+    size_t n;
+
+    if (read_at(fd, header, sizeof(header), 0) != CSO_HEADER)
+        return NULL;
+    if (!(image = calloc(1, sizeof(compressed_image_t))))
+        return NULL;
+
+    image->fd = fd;
+    image->lz4 = !memcmp(header, "ZISO", 4);
+    image->size = le32(header + 8) | (unsigned long long)le32(header + 12) << 32;
+    image->block_size = le32(header + 16);
+    image->v2 = !image->lz4 && header[20] == 2;
+    image->align = header[21];
+
+    if ((memcmp(header, "CISO", 4) && !image->lz4) || image->block_size < 512 ||
+        image->block_size > 1024 * 1024 || image->align > 31)
+        goto fail;
+
+    image->blocks = (image->size + image->block_size - 1) / image->block_size;
+    n = (size_t)image->blocks + 1;
+
+    if (!(image->index = malloc(n * sizeof(unsigned int))) ||
+        !(image->cached = calloc(image->blocks, sizeof(cblock_t *))))
+        goto fail;
+    if (read_at(fd, image->index, n * sizeof(unsigned int), CSO_HEADER) != (int)(n * sizeof(unsigned int)))
+        goto fail;
+    for (i = 0; i < n; i++)
+        image->index[i] = le32((unsigned char *)&image->index[i]);
+
+    image->next = -1;
+
+    return image;
+
+fail:
+    free(image->index);
+    free(image->cached);
+    free(image);
+    return NULL;
+}
+
+/* LZ4 block format: sequences of a token, literals, and a match copied from
+ * earlier output. Stops at the end of the input or once out is full, so the
+ * padding after an aligned block doesn't matter. */
+static int lz4_decode(const unsigned char *in, unsigned int in_len, unsigned char *out, unsigned int out_len)
+{
+    const unsigned char *ip = in, *iend = in + in_len;
+    unsigned char *op = out, *oend = out + out_len;
+    unsigned int token, len, offset;
+
+    while (ip < iend && op < oend) {
+        token = *ip++;
+
+        len = token >> 4;
+        if (len == 15) {
+            while (ip < iend && *ip == 255)
+                len += *ip++;
+            if (ip < iend)
+                len += *ip++;
+        }
+        if (len > (unsigned int)(iend - ip) || len > (unsigned int)(oend - op))
+            return -1;
+        memcpy(op, ip, len);
+        op += len;
+        ip += len;
+
+        /* the last sequence is only literals */
+        if (iend - ip < 2 || op == oend)
+            break;
+
+        offset = ip[0] | ip[1] << 8;
+        ip += 2;
+        if (!offset)
+            break;
+        if (offset > (unsigned int)(op - out))
+            return -1;
+
+        len = token & 15;
+        if (len == 15) {
+            while (ip < iend && *ip == 255)
+                len += *ip++;
+            if (ip < iend)
+                len += *ip++;
+        }
+        len += 4;
+        if (len > (unsigned int)(oend - op))
+            return -1;
+
+        /* the match may overlap what it writes */
+        while (len--) {
+            *op = *(op - offset);
+            op++;
+        }
+    }
+
+    return op - out;
+}
+
+#ifdef WITH_CSO
+static int deflate_decode(decoder_t *d, unsigned char *in, unsigned int in_len,
+                          unsigned char *out, unsigned int out_len)
+{
+    int retval;
+
+    if (!d->z_ready) {
+        memset(&d->z, 0, sizeof(d->z));
+        if (inflateInit2(&d->z, -15) != Z_OK)
+            return -1;
+        d->z_ready = 1;
+    } else if (inflateReset(&d->z) != Z_OK) {
+        return -1;
+    }
+
+    d->z.next_in = in;
+    d->z.avail_in = in_len;
+    d->z.next_out = out;
+    d->z.avail_out = out_len;
+
+    retval = inflate(&d->z, Z_FINISH);
+    if (retval != Z_STREAM_END && retval != Z_BUF_ERROR && retval != Z_OK)
+        return -1;
+
+    return out_len - d->z.avail_out;
+}
+#endif
+
+/* read and decompress block index of image into out, which has room for a
+ * whole block. Returns the bytes of data, or -1. Safe on any thread. */
+static int block_decode(decoder_t *d, compressed_image_t *image, unsigned int index, unsigned char *out)
+{
+    unsigned int entry = image->index[index], end = image->index[index + 1];
+    unsigned long long start = (unsigned long long)(entry & ~CSO_PLAIN) << image->align;
+    unsigned long long stop = (unsigned long long)(end & ~CSO_PLAIN) << image->align;
+    unsigned int len, want = image->block_size;
+    unsigned char *grown;
+    int plain, lz4, retval;
+
+    if (stop < start || stop - start > 2 * (unsigned long long)image->block_size + (1ULL << image->align))
+        return -1;
+    len = stop - start;
+
+    if ((unsigned long long)index * image->block_size + want > image->size)
+        want = image->size - (unsigned long long)index * image->block_size;
+
+    if (image->v2) {
+        plain = len >= image->block_size;
+        lz4 = (entry & CSO_PLAIN) != 0;
+    } else {
+        plain = (entry & CSO_PLAIN) != 0;
+        lz4 = image->lz4;
+    }
+
+    if (plain) {
+        retval = read_at(image->fd, out, want, start);
+        return (retval < 0) ? -1 : retval;
+    }
+
+    if (len > d->in_size) {
+        if (!(grown = realloc(d->in, len)))
+            return -1;
+        d->in = grown;
+        d->in_size = len;
+    }
+
+    retval = read_at(image->fd, d->in, len, start);
+    if (retval <= 0)
+        return -1;
+
+    if (lz4)
+        return lz4_decode(d->in, retval, out, want);
+
+#ifdef WITH_CSO
+    return deflate_decode(d, d->in, retval, out, want);
+#else
+    return -1;
+#endif
+}
+
+/* the LRU only has ready blocks in it, so blocks that are queued or being
+ * decompressed are never thrown out */
+static void lru_remove(cblock_t *b)
+{
+    if (b->newer)
+        b->newer->older = b->older;
+    else
+        newest = b->older;
+    if (b->older)
+        b->older->newer = b->newer;
+    else
+        oldest = b->newer;
+    b->newer = b->older = NULL;
+}
+
+static void lru_insert(cblock_t *b)
+{
+    b->older = newest;
+    b->newer = NULL;
+    if (newest)
+        newest->newer = b;
+    else
+        oldest = b;
+    newest = b;
+}
+
+static void block_free(cblock_t *b)
+{
+    b->image->cached[b->index] = NULL;
+    cache_used -= b->image->block_size;
+    free(b->data);
+    free(b);
+}
+
+/* throw out the least recently used blocks until the cache fits, all but
+ * keep, the block about to be used */
+static void lru_trim(cblock_t *keep)
+{
+    cblock_t *b = oldest;
+
+    while (cache_used > cache_limit && b) {
+        cblock_t *newer = b->newer;
+
+        if (b != keep) {
+            lru_remove(b);
+            block_free(b);
+        }
+        b = newer;
+    }
+}
+
+/* a new entry for block index of image, counted against the cache */
+static cblock_t *block_new(compressed_image_t *image, unsigned int index, cblock_state_t state)
+{
+    cblock_t *b;
+
+    if (!(b = calloc(1, sizeof(cblock_t))))
+        return NULL;
+    if (!(b->data = malloc(image->block_size))) {
+        free(b);
+        return NULL;
+    }
+
+    b->image = image;
+    b->index = index;
+    b->state = state;
+    image->cached[index] = b;
+    cache_used += image->block_size;
+
+    return b;
+}
+
+static void block_ready(cblock_t *b, int len)
+{
+    b->len = len;
+    b->state = CB_READY;
+    lru_insert(b);
+}
+
+static void *compressed_worker(void *arg)
+{
+    static decoder_t decoder;
+    cblock_t *b;
+    int len;
+
+    pthread_mutex_lock(&lock);
+    for (;;) {
+        while (!queue_head)
+            pthread_cond_wait(&work, &lock);
+
+        b = queue_head;
+        queue_head = b->next;
+        if (!queue_head)
+            queue_tail = NULL;
+        b->state = CB_LOADING;
+        pthread_mutex_unlock(&lock);
+
+        len = block_decode(&decoder, b->image, b->index, b->data);
+
+        pthread_mutex_lock(&lock);
+        block_ready(b, len);
+        b->image->busy--;
+        ahead++;
+        lru_trim(NULL);
+        pthread_cond_broadcast(&finished);
+    }
+
+    return NULL;
+}
+
+/* take b off the worker's queue */
+static void queue_remove(cblock_t *b)
+{
+    cblock_t **p, *prev = NULL;
+
+    for (p = &queue_head; *p; prev = *p, p = &(*p)->next) {
+        if (*p == b) {
+            *p = b->next;
+            if (queue_tail == b)
+                queue_tail = prev;
+            b->next = NULL;
+            return;
+        }
+    }
+}
+
+/* hand the blocks after block index to the worker, as many as fit in
+ * CSO_AHEAD and half the cache. Called with lock held. */
+static void queue_ahead(compressed_image_t *image, unsigned int index)
+{
+#ifndef __MINGW32__
+    unsigned int count = CSO_AHEAD / image->block_size, i;
+    pthread_t thread;
+    cblock_t *b;
+
+    if ((unsigned long long)count * image->block_size > cache_limit / 2)
+        count = cache_limit / 2 / image->block_size;
+
+    if (!worker_state) {
+        worker_state = -1;
+        if (!pthread_create(&thread, NULL, compressed_worker, NULL)) {
+            pthread_detach(thread);
+            worker_state = 1;
+        }
+    }
+    if (worker_state != 1)
+        return;
+
+    for (i = index + 1; i <= index + count && i < image->blocks; i++) {
+        if (image->cached[i])
+            continue;
+        if (!(b = block_new(image, i, CB_QUEUED)))
+            break;
+
+        if (queue_tail)
+            queue_tail->next = b;
+        else
+            queue_head = b;
+        queue_tail = b;
+        image->busy++;
+    }
+
+    pthread_cond_signal(&work);
+#endif
+}
+
+/* the ready entry for block index of image, decompressing it here if the
+ * worker hasn't got to it. Called with lock held; returns NULL if there's
+ * no memory. */
+static cblock_t *block_get(compressed_image_t *image, unsigned int index)
+{
+    cblock_t *b = image->cached[index];
+    int len;
+
+    if (b && b->state == CB_LOADING) {
+        waited++;
+        while (b->state == CB_LOADING)
+            pthread_cond_wait(&finished, &lock);
+    }
+
+    if (b && b->state == CB_READY && b->len >= 0) {
+        hits++;
+        lru_remove(b);
+        lru_insert(b);
+        return b;
+    }
+
+    misses++;
+    if (b && b->state == CB_QUEUED) {
+        /* still waiting for the worker, so it's ours now */
+        queue_remove(b);
+        image->busy--;
+    } else if (b) {
+        /* it couldn't be read last time, so try again */
+        lru_remove(b);
+    } else if (!(b = block_new(image, index, CB_LOADING))) {
+        return NULL;
+    }
+    b->state = CB_LOADING;
+
+    pthread_mutex_unlock(&lock);
+    len = block_decode(&reader, image, index, b->data);
+    pthread_mutex_lock(&lock);
+
+    block_ready(b, len);
+    lru_trim(b);
+    pthread_cond_broadcast(&finished);
+
+    return b;
+}
+
+int compressed_read(compressed_image_t *image, void *buf, unsigned int count, off_t offset)
+{
+    unsigned char *out = buf;
+    unsigned int done = 0, index = 0, skip, n;
+    cblock_t *b;
+
+    if (offset < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    if ((unsigned long long)offset >= image->size)
+        return 0;
+    if ((unsigned long long)offset + count > image->size)
+        count = image->size - offset;
+
+    reads++;
+
+    pthread_mutex_lock(&lock);
+
+    while (done < count) {
+        index = (offset + done) / image->block_size;
+        skip = (offset + done) % image->block_size;
+
+        if (!(b = block_get(image, index)) || b->len < 0) {
+            pthread_mutex_unlock(&lock);
+            if (done)
+                return done;
+            errno = b ? EIO : ENOMEM;
+            return -1;
+        }
+
+        n = (b->len > (int)skip) ? b->len - skip : 0;
+        if (n > count - done)
+            n = count - done;
+        memcpy(out + done, b->data + skip, n);
+        done += n;
+
+        if (b->len < (int)image->block_size && done < count)
+            break;
+    }
+
+    image->sequential = (offset == image->next) ? image->sequential + 1 : 0;
+    image->next = offset + done;
+
+    if (image->sequential)
+        queue_ahead(image, index);
+
+    pthread_mutex_unlock(&lock);
+
+    return done;
+}
+
+void compressed_close(compressed_image_t *image)
+{
+    cblock_t *b, *older;
+    unsigned int i;
+
+    if (!image)
+        return;
+
+    pthread_mutex_lock(&lock);
+
+    /* nothing of it may be left for the worker */
+    for (i = 0; i < image->blocks; i++) {
+        if ((b = image->cached[i]) && b->state == CB_QUEUED) {
+            queue_remove(b);
+            image->busy--;
+            block_free(b);
+        }
+    }
+    while (image->busy)
+        pthread_cond_wait(&finished, &lock);
+
+    for (b = newest; b; b = older) {
+        older = b->older;
+        if (b->image == image) {
+            lru_remove(b);
+            block_free(b);
+        }
+    }
+
+    pthread_mutex_unlock(&lock);
+
+    free(image->index);
+    free(image->cached);
+    free(image);
+}
+
+void compressed_cache(unsigned int megabytes)
+{
+    pthread_mutex_lock(&lock);
+    cache_limit = (unsigned long long)megabytes << 20;
+    pthread_mutex_unlock(&lock);
+}
+
+void compressed_report(void)
+{
+    if (!reads)
+        return;
+
+    printf("compressed image: %u reads, %u block hits, %u misses, %u blocks decompressed ahead, %u waited for\n",
+           reads, hits, misses, ahead, waited);
+}
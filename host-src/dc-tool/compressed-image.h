@@ -0,0 +1,57 @@
+/*
+ * dc-tool, a tool for use with the dcload loader
+ *
+ * Copyright (C) 2023 Andrew Kieschnick <andrewk@austin.rr.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#ifndef __COMPRESSED_IMAGE_H__
+#define __COMPRESSED_IMAGE_H__
+
+#include <sys/types.h>
+
+typedef struct compressed_image compressed_image_t;
+
+/* compressed_probe looks at the start of the file at path. If it's a CSO or
+ * ZSO image it stores how big the image is uncompressed in *size and returns
+ * 1. Returns 0 for anything else, or -1 after saying why for a compressed
+ * image that can't be read (a CHD, or a CSO without zlib).
+ */
+int compressed_probe(const char *path, off_t *size);
+
+/* compressed_open reads the block index of the image open on fd. Returns
+ * NULL if it isn't one it can read. fd stays open until compressed_close.
+ */
+compressed_image_t *compressed_open(int fd);
+
+void compressed_close(compressed_image_t *image);
+
+/* compressed_read reads count bytes at offset in the uncompressed image into
+ * buf, and returns what read_at would. Decompressed blocks are kept for
+ * next time, and once the reads are sequential the blocks after them are
+ * decompressed ahead on a worker thread. Only for the dispatch thread.
+ */
+int compressed_read(compressed_image_t *image, void *buf, unsigned int count, off_t offset);
+
+/* compressed_cache sets how many megabytes of decompressed blocks are kept,
+ * for every image together */
+void compressed_cache(unsigned int megabytes);
+
+/* compressed_report prints the block cache counters, if a block was read */
+void compressed_report(void);
+
+#endif /* __COMPRESSED_IMAGE_H__ */
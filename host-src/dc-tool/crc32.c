@@ -0,0 +1,31 @@
+#include "crc32.h"
+
+static unsigned int crc_table[256];
+static int crc_table_ready = 0;
+
+static void crc32_init(void)
+{
+    unsigned int c, n, k;
+
+    for (n = 0; n < 256; n++) {
+        c = n;
+        for (k = 0; k < 8; k++)
+            c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+        crc_table[n] = c;
+    }
+
+    crc_table_ready = 1;
+}
+
+unsigned int crc32_block(const unsigned char *buf, unsigned int len)
+{
+    unsigned int crc = 0xffffffff;
+
+    if (!crc_table_ready)
+        crc32_init();
+
+    while (len--)
+        crc = crc_table[(crc ^ *buf++) & 0xff] ^ (crc >> 8);
+
+    return crc ^ 0xffffffff;
+}
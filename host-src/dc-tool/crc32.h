@@ -0,0 +1,9 @@
+#ifndef __CRC32_H__
+#define __CRC32_H__
+
+/* crc32_block returns the CRC-32 (as used by zlib and Ethernet) of len bytes
+ * at buf. dcload computes the same thing for delta uploads.
+ */
+unsigned int crc32_block(const unsigned char *buf, unsigned int len);
+
+#endif /* __CRC32_H__ */
@@ -23,6 +23,7 @@
 #include "commands.h"
 #include "utils.h"
 #include "gdb.h"
+#include "compressed-image.h"
 
 #include "ip-transport.h"
 #include "serial-transport.h"
@@ -30,12 +31,13 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <signal.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
 #include <minilzo.h>
 
-#define DCTOOL_COMMON_OPTS      "x:u:d:a:s:t:c:i:npqh"
+#define DCTOOL_COMMON_OPTS      "x:u:d:a:s:t:c:i:z:npqDh"
 #define DCTOOL_IP_OPTS          DCTOOL_COMMON_OPTS "rg"
 #define DCTOOL_SERIAL_OPTS	DCTOOL_COMMON_OPTS "b:eEg"
 
@@ -83,10 +85,13 @@ static void usage(void)
 #ifndef __MINGW32__
     printf("    -c <path>     Chroot to <path> (must be super-user)\n");
 #endif
-    printf("    -i <isofile>  Enable cdfs redirection using iso image <isofile>\n");
+    printf("    -i <isofile>  Enable cdfs redirection using disc image <isofile>\n");
+    printf("                  (iso, gdi, cue or cdi, or dir:<path> for a directory)\n");
+    printf("    -z <size>     Keep <size> MB of decompressed image blocks (default: 16)\n");
     printf("    -g            Start a GDB server\n");
     printf("    -n            Do not attach console and fileserver\n");
     printf("    -q            Do not clear screen before download\n");
+    printf("    -D            Only upload what differs from the target's memory\n");
     printf("    -h            Usage information (you\'re looking at it)\n\n");
 
     printf("\nIP options:\n");
@@ -100,6 +105,12 @@ static void usage(void)
     printf("    -E            Use an external clock for the DC's serial port\n");
     printf("    -p            Use dumb terminal rather than console/fileserver\n");
 
+#ifdef SIGUSR1
+    printf("\nSyscall statistics are printed when the program exits, and on SIGUSR1.\n");
+    printf("SIGUSR1 is acted on at the next syscall over serial, and within a second\n");
+    printf("over IP.\n");
+#endif
+
     exit(EXIT_SUCCESS);
 }
 
@@ -132,6 +143,8 @@ static int dctool_main_ip(int argc, const char *argv[])
     unsigned int size = 0;
     unsigned int console = 1;
     unsigned int quiet = 0;
+    unsigned int delta = 0;
+    xprt_upload_t xprt = { ip_xprt_send_data, ip_xprt_fill_data, NULL, ip_xprt_send_segments, NULL, ip_xprt_packed, 0, 0 };
     unsigned char command = 0;
     unsigned int cdfs_redir = 0;
     int someopt;
@@ -186,6 +199,9 @@ static int dctool_main_ip(int argc, const char *argv[])
             cdfs_redir = 1;
             isofile = strdup(optarg);
             break;
+        case 'z':
+            compressed_cache(strtoul(optarg, NULL, 0));
+            break;
         case 'a':
             address = strtoul(optarg, NULL, 0);
             break;
@@ -201,6 +217,9 @@ static int dctool_main_ip(int argc, const char *argv[])
         case 'q':
             quiet = 1;
             break;
+        case 'D':
+            delta = 1;
+            break;
         case 'h':
             usage();
             break;
@@ -250,15 +269,16 @@ static int dctool_main_ip(int argc, const char *argv[])
         return EXIT_FAILURE;
     }
 
+    if (delta)
+        xprt.hash = ip_xprt_hash_data;
+
     switch (command) {
     case 'x':
         printf("Upload <%s>\n", filename);
-        address = upload(filename, address, ip_xprt_send_data);
-        if (address == -1)
-            return EXIT_FAILURE;
-
-        printf("Executing at <0x%x>\n", address);
-        if (ip_xprt_execute(address, console, cdfs_redir))
+        xprt.execute = ip_xprt_execute;
+        xprt.console = console;
+        xprt.cdfsredir = cdfs_redir;
+        if (upload(filename, address, &xprt) == -1)
             return EXIT_FAILURE;
 
         if (console)
@@ -267,7 +287,7 @@ static int dctool_main_ip(int argc, const char *argv[])
         break;
     case 'u':
         printf("Upload <%s> at <0x%x>\n", filename, address);
-        if (upload(filename, address, ip_xprt_send_data))
+        if (upload(filename, address, &xprt) == -1)
             return EXIT_FAILURE;
         break;
     case 'd':
@@ -302,6 +322,8 @@ static int dctool_main_serial(int argc, const char *argv[])
     unsigned int console = 1;
     unsigned int dumbterm = 0;
     unsigned int quiet = 0;
+    unsigned int delta = 0;
+    xprt_upload_t xprt = { serial_xprt_send_data, serial_xprt_fill_data, NULL, NULL, NULL, NULL, 0, 0 };
     unsigned char command = 0;
     unsigned int speed = DEFAULT_SPEED;
     unsigned int device_flags = 0;
@@ -358,6 +380,9 @@ static int dctool_main_serial(int argc, const char *argv[])
                 cdfs_redir = 1;
                 isofile = strdup(optarg);
                 break;
+            case 'z':
+                compressed_cache(strtoul(optarg, NULL, 0));
+                break;
             case 'a':
                 address = strtoul(optarg, NULL, 0);
                 break;
@@ -380,6 +405,9 @@ static int dctool_main_serial(int argc, const char *argv[])
             case 'q':
                 quiet = 1;
                 break;
+            case 'D':
+                delta = 1;
+                break;
             case 'h':
                 usage();
                 break;
@@ -425,13 +453,17 @@ static int dctool_main_serial(int argc, const char *argv[])
         return EXIT_FAILURE;
     }
 
+    if (delta)
+        xprt.hash = serial_xprt_hash_data;
+
     switch (command) {
         case 'x':
             printf("Upload <%s>\n", filename);
-            address = upload(filename, address, serial_xprt_send_data);
-
-            printf("Executing at <0x%x>\n", address);
-            serial_xprt_execute(address, console, cdfs_redir);
+            xprt.execute = serial_xprt_execute;
+            xprt.console = console;
+            xprt.cdfsredir = cdfs_redir;
+            if (upload(filename, address, &xprt) == -1)
+                return EXIT_FAILURE;
 
             if (console)
                 do_console(path, isofile, serial_xprt_dispatch_commands);
@@ -441,7 +473,7 @@ static int dctool_main_serial(int argc, const char *argv[])
             break;
         case 'u':
             printf("Upload <%s> at <0x%x>\n", filename, address);
-            upload(filename, address, serial_xprt_send_data);
+            upload(filename, address, &xprt);
             break;
         case 'd':
             if (!size) {
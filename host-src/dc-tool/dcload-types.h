@@ -35,5 +35,18 @@ typedef struct {
   int32_t st_spare4[2];
 } dcload_stat_t;
 
+/* dcload readdirplus record: a dirent and the stat of that entry. The name
+   is only as long as it needs to be, and d_reclen is the length of the whole
+   record padded to 4 bytes, so the next one starts d_reclen bytes on. */
+
+typedef struct {
+  uint16_t d_reclen;  /* length of this record */
+  uint8_t d_type;     /* type of file */
+  uint8_t d_namlen;   /* length of d_name, without the nul */
+  uint32_t d_ino;     /* inode number */
+  dcload_stat_t st;   /* st_mode is 0 if the entry couldn't be stat'd */
+  char d_name[];      /* nul terminated filename */
+} dcload_direntplus_t;
+
 #endif
 
@@ -0,0 +1,238 @@
+/*
+ * dc-tool, a tool for use with the dcload loader
+ *
+ * Copyright (C) 2023 Andrew Kieschnick <andrewk@austin.rr.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+/* Directory handles shared by the IP and serial syscalls.
+ *
+ * The target only ever sees a 32 bit number for an open directory, so the
+ * DIRs live in a table here that doubles whenever it fills up.
+ */
+
+#include "dir-handles.h"
+#include "dcload-types.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Sigh... KOS treats anything under 100 as invalid for a dirent from dcload, so
+   we need to offset by a bit. This aught to do. */
+#define DIRENT_OFFSET   1337
+
+#define INITIAL_HANDLES 16
+
+typedef struct {
+    DIR *dir;
+    char *path;
+    struct dirent *pending; /* read, but didn't fit the last readdirplus */
+} dir_handle_t;
+
+static dir_handle_t *handles;
+static unsigned int handles_size;
+
+static dir_handle_t *dir_handle_get(unsigned int handle)
+{
+    if (handle < DIRENT_OFFSET || handle - DIRENT_OFFSET >= handles_size)
+        return NULL;
+
+    if (!handles[handle - DIRENT_OFFSET].dir)
+        return NULL;
+
+    return &handles[handle - DIRENT_OFFSET];
+}
+
+unsigned int dir_handle_open(const char *path)
+{
+    dir_handle_t *grown;
+    unsigned int i, size;
+    DIR *dir;
+
+    for (i = 0; i < handles_size; i++)
+        if (!handles[i].dir)
+            break;
+
+    if (i == handles_size) {
+        size = handles_size ? handles_size * 2 : INITIAL_HANDLES;
+        if (!(grown = realloc(handles, size * sizeof(dir_handle_t))))
+            return 0;
+        memset(grown + handles_size, 0, (size - handles_size) * sizeof(dir_handle_t));
+        handles = grown;
+        handles_size = size;
+    }
+
+    if (!(dir = opendir(path)))
+        return 0;
+
+    handles[i].dir = dir;
+    handles[i].path = strdup(path);
+    handles[i].pending = NULL;
+
+    return i + DIRENT_OFFSET;
+}
+
+int dir_handle_close(unsigned int handle)
+{
+    dir_handle_t *h = dir_handle_get(handle);
+    int retval;
+
+    if (!h)
+        return -1;
+
+    retval = closedir(h->dir);
+    free(h->path);
+    memset(h, 0, sizeof(dir_handle_t));
+
+    return retval;
+}
+
+struct dirent *dir_handle_read(unsigned int handle)
+{
+    dir_handle_t *h = dir_handle_get(handle);
+    struct dirent *entry;
+
+    if (!h)
+        return NULL;
+
+    if (h->pending) {
+        entry = h->pending;
+        h->pending = NULL;
+        return entry;
+    }
+
+    return readdir(h->dir);
+}
+
+int dir_handle_rewind(unsigned int handle)
+{
+    dir_handle_t *h = dir_handle_get(handle);
+
+    if (!h)
+        return -1;
+
+    rewinddir(h->dir);
+    h->pending = NULL;
+
+    return 0;
+}
+
+static int dir_handle_stat(dir_handle_t *h, const char *name, struct stat *st)
+{
+#ifdef AT_FDCWD
+    return fstatat(dirfd(h->dir), name, st, 0);
+#else
+    char *path;
+    int retval;
+
+    if (!h->path || !(path = malloc(strlen(h->path) + strlen(name) + 2)))
+        return -1;
+
+    sprintf(path, "%s/%s", h->path, name);
+    retval = stat(path, st);
+    free(path);
+
+    return retval;
+#endif
+}
+
+/* store the low n bytes of v at p, least significant first */
+static void put_le(unsigned char *p, unsigned int v, size_t n)
+{
+    while (n--) {
+        *p++ = v & 0xff;
+        v >>= 8;
+    }
+}
+
+#define PUT(rec, field, v) \
+    put_le((rec) + offsetof(dcload_direntplus_t, field), (v), sizeof(((dcload_direntplus_t *)0)->field))
+
+int dir_handle_readplus(unsigned int handle, unsigned char *buf, unsigned int size, unsigned int *used)
+{
+    dir_handle_t *h = dir_handle_get(handle);
+    struct dirent *entry;
+    struct stat sb;
+    unsigned int namlen, reclen;
+    unsigned char *rec;
+    int count = 0;
+
+    *used = 0;
+
+    if (!h)
+        return -1;
+
+    while ((entry = dir_handle_read(handle))) {
+        namlen = strlen(entry->d_name);
+        if (namlen > 255)
+            namlen = 255;
+        reclen = (offsetof(dcload_direntplus_t, d_name) + namlen + 1 + 3) & ~3;
+
+        if (*used + reclen > size) {
+            h->pending = entry;
+            break;
+        }
+
+        rec = buf + *used;
+        memset(rec, 0, reclen);
+
+        PUT(rec, d_reclen, reclen);
+        PUT(rec, d_namlen, namlen);
+#if defined (__APPLE__) || defined (__NetBSD__) || defined (__FreeBSD__) || defined (__OpenBSD__)
+        PUT(rec, d_ino, entry->d_fileno);
+        PUT(rec, d_type, entry->d_type);
+#else
+        PUT(rec, d_ino, entry->d_ino);
+# if !defined(_WIN32) && !defined(__CYGWIN__)
+        PUT(rec, d_type, entry->d_type);
+# endif
+#endif
+        memcpy(rec + offsetof(dcload_direntplus_t, d_name), entry->d_name, namlen);
+
+        if (!dir_handle_stat(h, entry->d_name, &sb)) {
+            PUT(rec, st.st_dev, sb.st_dev);
+            PUT(rec, st.st_ino, sb.st_ino);
+            PUT(rec, st.st_mode, sb.st_mode);
+            PUT(rec, st.st_nlink, sb.st_nlink);
+            PUT(rec, st.st_uid, sb.st_uid);
+            PUT(rec, st.st_gid, sb.st_gid);
+            PUT(rec, st.st_rdev, sb.st_rdev);
+            PUT(rec, st.st_size, sb.st_size);
+#ifndef __MINGW32__
+            PUT(rec, st.st_blksize, sb.st_blksize);
+            PUT(rec, st.st_blocks, sb.st_blocks);
+#endif
+            PUT(rec, st.st_atime_priv, sb.st_atime);
+            PUT(rec, st.st_mtime_priv, sb.st_mtime);
+            PUT(rec, st.st_ctime_priv, sb.st_ctime);
+        }
+
+        *used += reclen;
+        count++;
+    }
+
+    /* a buffer too small for even one record would never get anywhere */
+    if (!count && h->pending)
+        return -1;
+
+    return count;
+}
@@ -0,0 +1,53 @@
+/*
+ * dc-tool, a tool for use with the dcload loader
+ *
+ * Copyright (C) 2023 Andrew Kieschnick <andrewk@austin.rr.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#ifndef __DIR_HANDLES_H__
+#define __DIR_HANDLES_H__
+
+#include <dirent.h>
+
+/* dir_handle_open opens path and returns a handle for the target, or 0 if
+ * the directory couldn't be opened. The table grows as needed.
+ */
+unsigned int dir_handle_open(const char *path);
+
+/* dir_handle_close closes handle. Returns what closedir does, or -1 if
+ * handle isn't open.
+ */
+int dir_handle_close(unsigned int handle);
+
+/* dir_handle_read returns the next entry of handle, or NULL at the end or
+ * if handle isn't open.
+ */
+struct dirent *dir_handle_read(unsigned int handle);
+
+/* dir_handle_rewind starts handle over. Returns -1 if it isn't open. */
+int dir_handle_rewind(unsigned int handle);
+
+/* dir_handle_readplus packs as many readdirplus records (see
+ * dcload_direntplus_t) from handle as fit in size bytes of buf, in the
+ * target's byte order. It returns how many it packed and sets *used to
+ * their length, or returns -1 if handle isn't open or the next entry alone
+ * doesn't fit.
+ */
+int dir_handle_readplus(unsigned int handle, unsigned char *buf, unsigned int size, unsigned int *used);
+
+#endif /* __DIR_HANDLES_H__ */
@@ -0,0 +1,887 @@
+/*
+ * dc-tool, a tool for use with the dcload loader
+ *
+ * Copyright (C) 2023 Andrew Kieschnick <andrewk@austin.rr.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+/* The disc image behind CDFS redirection.
+ *
+ * An image is a list of tracks, each some run of sectors in a file: a plain
+ * ISO is one track of 2048 byte sectors, and a GDI, CUE sheet or DiscJuggler
+ * CDI describes several, in raw 2352 byte sectors as often as not. The
+ * tracks are read from the description when the image is opened. Their
+ * files are only mapped on the first read that touches them, and raw
+ * sectors have their 2048 bytes of data picked out as they're read.
+ *
+ * Files are mapped, shared, so sector reads go to the target straight out
+ * of the page cache where the sectors are 2048 bytes, and every dc-tool
+ * serving the same image uses the same copy of it. Once the target reads
+ * sectors in order, the kernel is asked with madvise to read a window ahead
+ * of it. Whether each read from a mapping found all its pages in memory is
+ * counted with mincore, for the hit and miss counters.
+ *
+ * Where a file can't be mapped (MinGW, or one too big for the address
+ * space) it's read into a buffer instead. CSO and ZSO images, plain or as
+ * the files of tracks, are read through compressed-image. A directory
+ * given as dir:<path> is laid out as an ISO by iso-dir, and read from its
+ * files as the target asks for their sectors.
+ */
+
+#include "disc-image.h"
+#include "compressed-image.h"
+#include "iso-dir.h"
+#include "syscalls.h"
+#include "utils.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifndef __MINGW32__
+#include <sys/mman.h>
+#endif
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+#define DISC_WINDOW     (1024 * 1024)   /* read ahead of sequential reads */
+#define DISC_PAGES      256             /* pages mincore looks at in one go */
+#define DISC_TRACKS     99
+
+/* a GD-ROM's high density area starts here, as the target counts sectors */
+#define DISC_HD_LBA     (45000 + DISC_ISO_LBA)
+
+#define CDI_V2          0x80000004
+#define CDI_V3          0x80000005
+#define CDI_V35         0x80000006
+
+typedef struct {
+    char *path;
+    int fd;                     /* -1 if it couldn't be opened */
+    int failed;                 /* couldn't be read, reads as zeros */
+    int opened;                 /* mapped or set up for the first read */
+    off_t size;                 /* uncompressed, for a compressed image */
+    unsigned char *map;         /* all of the file, or NULL to read it */
+    off_t advised;              /* where the last madvise ended */
+    int compressed;             /* a CSO or ZSO, read through packed */
+    compressed_image_t *packed;
+    iso_dir_t *synth;           /* a directory, made into an ISO as it's read */
+} disc_file_t;
+
+typedef struct {
+    unsigned int number;
+    unsigned int lba;           /* the first sector */
+    unsigned int sectors;
+    unsigned int ctrl;          /* 4 for data, 0 for audio */
+    disc_file_t *file;
+    off_t offset;               /* where the first sector is in file */
+    unsigned int sector_size;   /* 2048, 2336, 2352 or 2448 */
+    int data;                   /* where the 2048 bytes of data are in a
+                                 * sector, -1 until the first is looked at */
+} disc_track_t;
+
+struct disc_image {
+    disc_file_t *files[DISC_TRACKS];
+    unsigned int nfiles;
+    disc_track_t tracks[DISC_TRACKS];
+    unsigned int ntracks;
+    disc_track_t *last;         /* the track of the last read */
+    unsigned int next;          /* the sector after the last read */
+    unsigned int sequential;    /* reads in a row that started at next */
+};
+
+/* what disc_read hands out when it can't point into a mapping */
+static unsigned char *scratch;
+static unsigned int scratch_size;
+
+static unsigned int reads, hits, misses;
+static unsigned long long bytes_read, bytes_prefetched;
+
+/* the file name, which is relative to the directory of the description */
+static disc_file_t *disc_file(disc_image_t *disc, const char *dir, const char *name)
+{
+    disc_file_t *file;
+    struct stat st;
+    unsigned int i;
+    char *path;
+
+    if (!(path = malloc(strlen(dir) + strlen(name) + 2)))
+        return NULL;
+    if (*dir && name[0] != '/' && name[0] != '\\' && !(name[0] && name[1] == ':'))
+        sprintf(path, "%s/%s", dir, name);
+    else
+        strcpy(path, name);
+
+    for (i = 0; i < disc->nfiles; i++) {
+        if (!strcmp(disc->files[i]->path, path)) {
+            free(path);
+            return disc->files[i];
+        }
+    }
+
+    if (disc->nfiles == DISC_TRACKS || !(file = calloc(1, sizeof(disc_file_t)))) {
+        free(path);
+        return NULL;
+    }
+
+    /* opened now, as -c may chroot out of reach of path by the first read */
+    file->path = path;
+    if ((file->fd = open(path, O_RDONLY | O_BINARY)) < 0 || fstat(file->fd, &st)) {
+        log_error(path);
+        file->failed = 1;
+    } else {
+        file->size = st.st_size;
+    }
+    disc->files[disc->nfiles++] = file;
+
+    if ((file->compressed = compressed_probe(path, &file->size)) < 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    return file;
+}
+
+/* a directory as the file of the track of a plain ISO */
+static disc_file_t *disc_dir(disc_image_t *disc, const char *path)
+{
+    disc_file_t *file;
+
+    if (!(file = calloc(1, sizeof(disc_file_t))))
+        return NULL;
+    if (!(file->path = strdup(path)) || !(file->synth = iso_dir_open(path))) {
+        free(file->path);
+        free(file);
+        return NULL;
+    }
+
+    file->fd = -1;
+    file->opened = 1;
+    file->size = iso_dir_size(file->synth);
+    disc->files[disc->nfiles++] = file;
+
+    return file;
+}
+
+static disc_track_t *disc_add_track(disc_image_t *disc)
+{
+    disc_track_t *track;
+
+    if (disc->ntracks == DISC_TRACKS)
+        return NULL;
+
+    track = &disc->tracks[disc->ntracks++];
+    memset(track, 0, sizeof(disc_track_t));
+    track->number = disc->ntracks;
+    track->ctrl = 4;
+    track->sector_size = DISC_SECTOR;
+
+    return track;
+}
+
+/* the next word of a line in *p, which may be in quotes */
+static int disc_token(char **p, char *out, size_t size)
+{
+    char *s = *p;
+    size_t n = 0;
+    char end = 0;
+
+    while (isspace((unsigned char)*s))
+        s++;
+    if (!*s)
+        return 0;
+
+    if (*s == '"')
+        end = *s++;
+
+    while (*s && (end ? *s != end : !isspace((unsigned char)*s))) {
+        if (n + 1 < size)
+            out[n++] = *s;
+        s++;
+    }
+    if (end && *s)
+        s++;
+
+    out[n] = 0;
+    *p = s;
+
+    return 1;
+}
+
+/* mm:ss:ff to sectors */
+static unsigned int disc_msf(const char *msf)
+{
+    unsigned int m = 0, s = 0, f = 0;
+
+    sscanf(msf, "%u:%u:%u", &m, &s, &f);
+
+    return (m * 60 + s) * 75 + f;
+}
+
+/* GDI: a count of tracks, then a line for each of them:
+ * number, lba, 4 for data or 0 for audio, sector size, file, offset */
+static int disc_parse_gdi(disc_image_t *disc, FILE *f, const char *dir)
+{
+    char line[1024], word[1024], *p;
+    unsigned int count, lba, type, size;
+    disc_track_t *track;
+
+    if (!fgets(line, sizeof(line), f) || sscanf(line, "%u", &count) != 1)
+        return -1;
+
+    while (disc->ntracks < count && fgets(line, sizeof(line), f)) {
+        p = line;
+        if (!disc_token(&p, word, sizeof(word)))
+            continue;
+        if (!(track = disc_add_track(disc)))
+            return -1;
+        track->number = atoi(word);
+
+        if (!disc_token(&p, word, sizeof(word)) || sscanf(word, "%u", &lba) != 1 ||
+            !disc_token(&p, word, sizeof(word)) || sscanf(word, "%u", &type) != 1 ||
+            !disc_token(&p, word, sizeof(word)) || sscanf(word, "%u", &size) != 1 ||
+            !disc_token(&p, word, sizeof(word)) || !(track->file = disc_file(disc, dir, word)))
+            return -1;
+
+        track->lba = lba + DISC_ISO_LBA;
+        track->ctrl = type;
+        track->sector_size = size;
+        /* raw data sectors are mode 1 or 2, which the first one says */
+        if (size == 2336)
+            track->data = 8;
+        else if (size != DISC_SECTOR && type)
+            track->data = -1;
+        if (disc_token(&p, word, sizeof(word)))
+            track->offset = strtoul(word, NULL, 10);
+    }
+
+    return disc->ntracks ? 0 : -1;
+}
+
+/* CUE sheet: FILE, TRACK and INDEX 01 lines, with PREGAP for silence that
+ * isn't in the file. Redump's GD-ROM sheets start the high density area
+ * with a REM, and its files start at 45000. */
+static int disc_parse_cue(disc_image_t *disc, FILE *f, const char *dir)
+{
+    char line[1024], word[1024], *p;
+    disc_file_t *file = NULL;
+    disc_track_t *track = NULL;
+    unsigned int base = 0, pregap = 0, high = 0, sectors;
+
+    while (fgets(line, sizeof(line), f)) {
+        p = line;
+        if (!disc_token(&p, word, sizeof(word)))
+            continue;
+
+        if (!strcmp(word, "REM")) {
+            if (disc_token(&p, word, sizeof(word)) && !strcmp(word, "HIGH-DENSITY"))
+                high = 1;
+        } else if (!strcmp(word, "FILE")) {
+            /* the next file follows the last */
+            if (file && track && track->sector_size) {
+                sectors = file->size / track->sector_size;
+                base += sectors;
+            }
+            if (high) {
+                base = DISC_HD_LBA - DISC_ISO_LBA;
+                pregap = 0;
+                high = 0;
+            }
+            if (!disc_token(&p, word, sizeof(word)) || !(file = disc_file(disc, dir, word)))
+                return -1;
+        } else if (!strcmp(word, "TRACK")) {
+            if (!file || !(track = disc_add_track(disc)))
+                return -1;
+            track->file = file;
+            if (disc_token(&p, word, sizeof(word)))
+                track->number = atoi(word);
+            if (!disc_token(&p, word, sizeof(word)))
+                return -1;
+
+            if (!strcmp(word, "AUDIO")) {
+                track->ctrl = 0;
+                track->sector_size = 2352;
+            } else if (!strcmp(word, "MODE1/2352")) {
+                track->sector_size = 2352;
+                track->data = 16;
+            } else if (!strcmp(word, "MODE2/2352") || !strcmp(word, "CDI/2352")) {
+                track->sector_size = 2352;
+                track->data = 24;
+            } else if (!strcmp(word, "MODE2/2336")) {
+                track->sector_size = 2336;
+                track->data = 8;
+            } else if (strcmp(word, "MODE1/2048")) {
+                fprintf(stderr, "cue: track type %s isn't supported\n", word);
+                return -1;
+            }
+        } else if (!strcmp(word, "PREGAP")) {
+            if (disc_token(&p, word, sizeof(word)))
+                pregap += disc_msf(word);
+        } else if (!strcmp(word, "INDEX")) {
+            if (!track || !disc_token(&p, word, sizeof(word)) || atoi(word) != 1 ||
+                !disc_token(&p, word, sizeof(word)))
+                continue;
+            sectors = disc_msf(word);
+            track->offset = (off_t)sectors * track->sector_size;
+            track->lba = DISC_ISO_LBA + base + pregap + sectors;
+        }
+    }
+
+    return disc->ntracks ? 0 : -1;
+}
+
+static int cdi_skip(FILE *f, long n)
+{
+    return fseek(f, n, SEEK_CUR);
+}
+
+static int cdi_u32(FILE *f, unsigned int *v)
+{
+    unsigned char b[4];
+
+    if (fread(b, 4, 1, f) != 1)
+        return -1;
+    *v = b[0] | b[1] << 8 | b[2] << 16 | (unsigned int)b[3] << 24;
+
+    return 0;
+}
+
+static int cdi_u16(FILE *f, unsigned int *v)
+{
+    unsigned char b[2];
+
+    if (fread(b, 2, 1, f) != 1)
+        return -1;
+    *v = b[0] | b[1] << 8;
+
+    return 0;
+}
+
+/* DiscJuggler CDI: the track data, then a description of the sessions and
+ * their tracks, found from the last 8 bytes of the file */
+static int disc_parse_cdi(disc_image_t *disc, FILE *f, const char *path)
+{
+    static const unsigned char mark[10] = { 0, 0, 1, 0, 0, 0, 0xff, 0xff, 0xff, 0xff };
+    static const unsigned int sizes[] = { 2048, 2336, 2352, 0, 2448 };
+    unsigned char buf[10];
+    unsigned int version, header, sessions, tracks, v, i, j;
+    unsigned int pregap, length, mode, start, size;
+    disc_track_t *track;
+    disc_file_t *file;
+    off_t position = 0;
+    long end;
+
+    if (!(file = disc_file(disc, "", path)))
+        return -1;
+
+    if (fseek(f, -8, SEEK_END) || (end = ftell(f) + 8) < 8 ||
+        cdi_u32(f, &version) || cdi_u32(f, &header))
+        return -1;
+    if (version != CDI_V2 && version != CDI_V3 && version != CDI_V35)
+        return -1;
+    if (fseek(f, (version == CDI_V35) ? end - (long)header : (long)header, SEEK_SET) ||
+        cdi_u16(f, &sessions))
+        return -1;
+
+    for (i = 0; i < sessions; i++) {
+        if (cdi_u16(f, &tracks))
+            return -1;
+
+        for (j = 0; j < tracks; j++) {
+            if (cdi_u32(f, &v) || (v && cdi_skip(f, 8)))
+                return -1;
+            if (fread(buf, 10, 1, f) != 1 || memcmp(buf, mark, 10) ||
+                fread(buf, 10, 1, f) != 1 || memcmp(buf, mark, 10))
+                return -1;
+            /* the name of the image when it was made */
+            if (cdi_skip(f, 4) || fread(buf, 1, 1, f) != 1 || cdi_skip(f, buf[0] + 19))
+                return -1;
+            if (cdi_u32(f, &v) || (v == 0x80000000 && cdi_skip(f, 8)))
+                return -1;
+            if (cdi_skip(f, 2) || cdi_u32(f, &pregap) || cdi_u32(f, &length) ||
+                cdi_skip(f, 6) || cdi_u32(f, &mode) || cdi_skip(f, 12) ||
+                cdi_u32(f, &start) || cdi_skip(f, 4) || cdi_skip(f, 16) ||
+                cdi_u32(f, &v) || cdi_skip(f, 29))
+                return -1;
+            if (version != CDI_V2) {
+                if (cdi_skip(f, 5) || cdi_u32(f, &size) || (size == 0xffffffff && cdi_skip(f, 78)))
+                    return -1;
+            }
+
+            if (mode > 2 || v >= sizeof(sizes) / sizeof(sizes[0]) || !(size = sizes[v]))
+                return -1;
+
+            if (!(track = disc_add_track(disc)))
+                return -1;
+
+            /* the pregap is in the file, before the track */
+            position += (off_t)pregap * size;
+            track->file = file;
+            track->lba = DISC_ISO_LBA + start + pregap;
+            track->sectors = length;
+            track->offset = position;
+            track->sector_size = size;
+            track->ctrl = mode ? 4 : 0;
+            if (mode && size != DISC_SECTOR)
+                track->data = (size == 2336) ? 8 : (mode == 1) ? 16 : 24;
+            position += (off_t)length * size;
+        }
+
+        if (cdi_skip(f, 12) || (version != CDI_V2 && cdi_skip(f, 1)))
+            return -1;
+    }
+
+    return disc->ntracks ? 0 : -1;
+}
+
+/* does path end in ext, whatever the case */
+static int disc_is(const char *path, const char *ext)
+{
+    size_t n = strlen(path), m = strlen(ext);
+    size_t i;
+
+    if (n < m)
+        return 0;
+
+    for (i = 0; i < m; i++)
+        if (tolower((unsigned char)path[n - m + i]) != ext[i])
+            return 0;
+
+    return 1;
+}
+
+disc_image_t *disc_open(const char *path)
+{
+    disc_image_t *disc;
+    disc_track_t *track, *next;
+    char *dir, *slash;
+    FILE *f = NULL;
+    unsigned int i;
+    int retval = 0;
+
+    if (!(disc = calloc(1, sizeof(disc_image_t))))
+        return NULL;
+
+    if (!(dir = strdup(path))) {
+        free(disc);
+        return NULL;
+    }
+    slash = strrchr(dir, '/');
+    if (!slash)
+        slash = strrchr(dir, '\\');
+    if (slash)
+        *slash = 0;
+    else
+        *dir = 0;
+
+    if (disc_is(path, ".gdi") || disc_is(path, ".cue") || disc_is(path, ".cdi")) {
+        if (!(f = fopen(path, disc_is(path, ".cdi") ? "rb" : "r"))) {
+            free(dir);
+            free(disc);
+            return NULL;
+        }
+
+        if (disc_is(path, ".gdi"))
+            retval = disc_parse_gdi(disc, f, dir);
+        else if (disc_is(path, ".cue"))
+            retval = disc_parse_cue(disc, f, dir);
+        else
+            retval = disc_parse_cdi(disc, f, path);
+        fclose(f);
+    } else if (!strncmp(path, DISC_DIR_PREFIX, strlen(DISC_DIR_PREFIX))) {
+        if (!(track = disc_add_track(disc)) ||
+            !(track->file = disc_dir(disc, path + strlen(DISC_DIR_PREFIX)))) {
+            free(dir);
+            disc_close(disc);
+            return NULL;
+        }
+        track->lba = DISC_ISO_LBA;
+    } else {
+        /* a plain ISO */
+        if (access(path, R_OK) || !(track = disc_add_track(disc)) ||
+            !(track->file = disc_file(disc, "", path))) {
+            free(dir);
+            disc_close(disc);
+            return NULL;
+        }
+        track->lba = DISC_ISO_LBA;
+    }
+
+    free(dir);
+
+    if (retval) {
+        fprintf(stderr, "%s: can't make sense of the image\n", path);
+        disc_close(disc);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    /* tracks without a length run up to the next in the file, or its end,
+     * counting a last sector that's cut short */
+    for (i = 0; i < disc->ntracks; i++) {
+        track = &disc->tracks[i];
+        if (track->sectors)
+            continue;
+        next = (i + 1 < disc->ntracks) ? &disc->tracks[i + 1] : NULL;
+        if (next && next->file == track->file && next->offset > track->offset)
+            track->sectors = (next->offset - track->offset) / track->sector_size;
+        else if (track->file->size > track->offset)
+            track->sectors = (track->file->size - track->offset + track->sector_size - 1) /
+                             track->sector_size;
+    }
+
+    return disc;
+}
+
+void disc_close(disc_image_t *disc)
+{
+    disc_file_t *file;
+    unsigned int i;
+
+    if (!disc)
+        return;
+
+    for (i = 0; i < disc->nfiles; i++) {
+        file = disc->files[i];
+#ifndef __MINGW32__
+        if (file->map)
+            munmap(file->map, file->size);
+#endif
+        compressed_close(file->packed);
+        iso_dir_close(file->synth);
+        if (file->fd >= 0)
+            close(file->fd);
+        free(file->path);
+        free(file);
+    }
+
+    free(disc);
+}
+
+/* map file, the first time it's read. Returns -1 if it can't be read. */
+static int disc_file_open(disc_file_t *file)
+{
+    struct stat st;
+
+    if (file->failed)
+        return -1;
+    if (file->opened)
+        return 0;
+
+    file->opened = 1;
+    if (fstat(file->fd, &st)) {
+        log_error(file->path);
+        file->failed = 1;
+        return -1;
+    }
+
+    if (file->compressed) {
+        if (!(file->packed = compressed_open(file->fd))) {
+            fprintf(stderr, "%s: can't read the block index\n", file->path);
+            file->failed = 1;
+            return -1;
+        }
+        return 0;
+    }
+
+    file->size = st.st_size;
+
+#ifndef __MINGW32__
+    if (S_ISREG(st.st_mode) && st.st_size && (off_t)(size_t)st.st_size == st.st_size) {
+        void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, file->fd, 0);
+
+        if (map != MAP_FAILED)
+            file->map = map;
+    }
+#endif
+
+    return 0;
+}
+
+/* the track sector lba is on */
+static disc_track_t *disc_track(disc_image_t *disc, unsigned int lba)
+{
+    disc_track_t *track = disc->last;
+    unsigned int i;
+
+    if (track && lba >= track->lba && lba < track->lba + track->sectors)
+        return track;
+
+    for (i = 0; i < disc->ntracks; i++) {
+        track = &disc->tracks[i];
+        if (lba >= track->lba && lba < track->lba + track->sectors)
+            return disc->last = track;
+    }
+
+    return NULL;
+}
+
+/* read n bytes at offset in file, which has been opened */
+static int disc_file_read(disc_file_t *file, void *buf, unsigned int n, off_t offset)
+{
+    if (offset >= file->size)
+        return 0;
+    if (offset + (off_t)n > file->size)
+        n = file->size - offset;
+
+    if (file->packed)
+        return compressed_read(file->packed, buf, n, offset);
+    if (file->synth)
+        return iso_dir_read(file->synth, buf, n, offset);
+
+#ifndef __MINGW32__
+    if (file->map) {
+        memcpy(buf, file->map + offset, n);
+        return n;
+    }
+#endif
+
+    return read_at(file->fd, buf, n, offset);
+}
+
+#ifndef __MINGW32__
+/* count a read of size bytes at offset in the mapping as a hit if every page
+ * of it was already in memory */
+static void disc_count(disc_file_t *file, off_t offset, off_t size)
+{
+    unsigned char vec[DISC_PAGES];
+    size_t page = getpagesize();
+    off_t start = offset - offset % page;
+    size_t len, i, n;
+
+    if (offset + size > file->size)
+        size = file->size - offset;
+
+    while (start < offset + size) {
+        len = offset + size - start;
+        if (len > DISC_PAGES * page)
+            len = DISC_PAGES * page;
+
+        if (mincore(file->map + start, len, (void *)vec))
+            return;
+
+        n = (len + page - 1) / page;
+        for (i = 0; i < n; i++) {
+            if (!(vec[i] & 1)) {
+                misses++;
+                return;
+            }
+        }
+
+        start += len;
+    }
+
+    hits++;
+}
+
+/* keep the kernel reading a window ahead of sequential reads, asking again
+ * once half of it has been used */
+static void disc_advise(disc_file_t *file, off_t end)
+{
+    size_t page = getpagesize();
+    off_t start;
+    size_t len;
+
+    if (end >= file->size || end + DISC_WINDOW / 2 <= file->advised)
+        return;
+
+    start = (end > file->advised) ? end : file->advised;
+    start -= start % page;
+    len = DISC_WINDOW;
+    if (start + (off_t)len > file->size)
+        len = file->size - start;
+
+    madvise(file->map + start, len, MADV_WILLNEED);
+    bytes_prefetched += len;
+    file->advised = start + len;
+}
+#endif
+
+/* copy the data of count sectors of track from lba on to out, which has
+ * room for size bytes */
+static void disc_copy(disc_image_t *disc, disc_track_t *track, unsigned int lba,
+                      unsigned int count, unsigned char *out, unsigned int size)
+{
+    disc_file_t *file = track->file;
+    off_t offset = track->offset + (off_t)(lba - track->lba) * track->sector_size;
+    unsigned char header[16];
+    unsigned int i, n;
+    int retval;
+
+    /* a raw sector has a sync pattern and header before the data, and byte
+     * 15 of it says mode 1 or mode 2 */
+    if (track->data < 0) {
+        track->data = 16;
+        if (disc_file_read(file, header, sizeof(header), track->offset) == sizeof(header) &&
+            header[0] == 0 && header[1] == 0xff && header[15] == 2)
+            track->data = 24;
+    }
+
+#ifndef __MINGW32__
+    if (file->map) {
+        disc_count(file, offset, (off_t)count * track->sector_size);
+        if (disc->sequential)
+            disc_advise(file, offset + (off_t)count * track->sector_size);
+    }
+#endif
+
+    if (track->sector_size == DISC_SECTOR) {
+        n = (count * DISC_SECTOR < size) ? count * DISC_SECTOR : size;
+        retval = disc_file_read(file, out, n, offset);
+        dc_syscall_copied(retval > 0 ? retval : 0);
+        return;
+    }
+
+    for (i = 0; i < count && i * DISC_SECTOR < size; i++) {
+        n = (size - i * DISC_SECTOR < DISC_SECTOR) ? size - i * DISC_SECTOR : DISC_SECTOR;
+        retval = disc_file_read(file, out + i * DISC_SECTOR, n,
+                                offset + (off_t)i * track->sector_size + track->data);
+        dc_syscall_copied(retval > 0 ? retval : 0);
+    }
+}
+
+int disc_read(disc_image_t *disc, unsigned int lba, unsigned int size, unsigned char **data)
+{
+    unsigned int count = (size + DISC_SECTOR - 1) / DISC_SECTOR;
+    unsigned int done, n;
+    disc_track_t *track = NULL;
+    unsigned char *grown;
+
+    reads++;
+    bytes_read += size;
+
+    if (disc) {
+        disc->sequential = (lba == disc->next) ? disc->sequential + 1 : 0;
+        disc->next = lba + count;
+        track = disc_track(disc, lba);
+    }
+
+#ifndef __MINGW32__
+    /* 2048 byte sectors all in one track can be handed out as they are */
+    if (track && track->sector_size == DISC_SECTOR && lba + count <= track->lba + track->sectors &&
+        !disc_file_open(track->file) && track->file->map) {
+        disc_file_t *file = track->file;
+        off_t offset = track->offset + (off_t)(lba - track->lba) * DISC_SECTOR;
+
+        if (offset + (off_t)size <= file->size) {
+            disc_count(file, offset, size);
+            if (disc->sequential)
+                disc_advise(file, offset + size);
+            *data = file->map + offset;
+            return size;
+        }
+    }
+#endif
+
+    if (size > scratch_size) {
+        if (!(grown = realloc(scratch, size)))
+            return -1;
+        scratch = grown;
+        scratch_size = size;
+    }
+    memset(scratch, 0, size);
+    *data = scratch;
+
+    if (!disc)
+        return size;
+
+    /* the sectors that are on a track are read, and the rest stay zeros */
+    for (done = 0; done < count; done += n) {
+        if (!(track = disc_track(disc, lba + done))) {
+            n = 1;
+            continue;
+        }
+
+        n = track->lba + track->sectors - (lba + done);
+        if (n > count - done)
+            n = count - done;
+
+        if (!disc_file_open(track->file))
+            disc_copy(disc, track, lba + done, n, scratch + done * DISC_SECTOR,
+                      size - done * DISC_SECTOR);
+    }
+
+    return size;
+}
+
+/* store v at p, least significant byte first */
+static void put_le(unsigned char *p, unsigned int v)
+{
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        *p++ = v & 0xff;
+        v >>= 8;
+    }
+}
+
+/* a TOC entry: control, then ADR 1 for a position, then the rest */
+#define DISC_TOC_ENTRY(ctrl, v)     ((unsigned int)(ctrl) << 28 | 1 << 24 | (v))
+
+int disc_toc(disc_image_t *disc, unsigned int area, unsigned char *toc)
+{
+    disc_track_t *track, *first = NULL, *last = NULL;
+    unsigned int i;
+
+    memset(toc, 0xff, DISC_TOC_SIZE);
+
+    /* a plain ISO is track 1 of whichever area is asked for */
+    if (!disc || (disc->ntracks == 1 && disc->tracks[0].lba == DISC_ISO_LBA)) {
+        put_le(toc, DISC_TOC_ENTRY(4, DISC_ISO_LBA));
+        put_le(toc + 99 * 4, DISC_TOC_ENTRY(4, 1 << 16));
+        put_le(toc + 100 * 4, DISC_TOC_ENTRY(4, 1 << 16));
+        put_le(toc + 101 * 4, DISC_TOC_ENTRY(4, DISC_ISO_LBA + (disc ? disc->tracks[0].sectors : 0)));
+        return 0;
+    }
+
+    for (i = 0; i < disc->ntracks; i++) {
+        track = &disc->tracks[i];
+        if ((track->lba >= DISC_HD_LBA) != (area != 0) || !track->number || track->number > 99)
+            continue;
+
+        put_le(toc + (track->number - 1) * 4, DISC_TOC_ENTRY(track->ctrl, track->lba));
+        if (!first)
+            first = track;
+        last = track;
+    }
+
+    if (!first)
+        return -1;
+
+    put_le(toc + 99 * 4, DISC_TOC_ENTRY(first->ctrl, first->number << 16));
+    put_le(toc + 100 * 4, DISC_TOC_ENTRY(last->ctrl, last->number << 16));
+    put_le(toc + 101 * 4, DISC_TOC_ENTRY(last->ctrl, last->lba + last->sectors));
+
+    return 0;
+}
+
+void disc_report(void)
+{
+    if (!reads)
+        return;
+
+    printf("cdfs: %u reads of %llu bytes, %u hits, %u misses, %llu bytes prefetched\n",
+           reads, bytes_read, hits, misses, bytes_prefetched);
+    compressed_report();
+}
@@ -0,0 +1,68 @@
+/*
+ * dc-tool, a tool for use with the dcload loader
+ *
+ * Copyright (C) 2023 Andrew Kieschnick <andrewk@austin.rr.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#ifndef __DISC_IMAGE_H__
+#define __DISC_IMAGE_H__
+
+/* the LBA the data on a plain ISO starts at */
+#define DISC_ISO_LBA    150
+
+#define DISC_SECTOR     2048
+
+/* disc_open takes a directory to serve as an ISO as dir:<path> */
+#define DISC_DIR_PREFIX "dir:"
+
+/* the size of a TOC as the target has it: 99 tracks, the first and last
+ * track, and where the lead-out starts */
+#define DISC_TOC_SIZE   (102 * 4)
+
+typedef struct disc_image disc_image_t;
+
+/* disc_open opens the image at path for CDFS redirection: a plain ISO, or a
+ * GDI, CUE sheet or DiscJuggler CDI, told apart by the extension. The ISO,
+ * or the files of the tracks, may be CSO or ZSO compressed. path may also be
+ * a directory as dir:<path>, which is made into an ISO. Returns NULL with
+ * errno set if it can't be read.
+ */
+disc_image_t *disc_open(const char *path);
+
+void disc_close(disc_image_t *disc);
+
+/* disc_read points *data at size bytes of the disc starting at sector lba,
+ * and returns size, or -1 if there's no memory. Sectors are 2048 bytes here
+ * whatever they are in the image. Whatever lies outside the tracks of the
+ * image reads as zeros. The data
+ * stays good until the next disc_read. disc may be NULL, which is a disc of
+ * nothing but zeros.
+ */
+int disc_read(disc_image_t *disc, unsigned int lba, unsigned int size, unsigned char **data);
+
+/* disc_toc stores the TOC of area 0, the single density area, or area 1, the
+ * high density area, at toc in the target's byte order. Returns -1 if the
+ * image has no tracks in that area. A plain ISO, or a NULL disc, is track 1
+ * in either area.
+ */
+int disc_toc(disc_image_t *disc, unsigned int area, unsigned char *toc);
+
+/* disc_report prints the sector cache counters, if anything was read */
+void disc_report(void);
+
+#endif /* __DISC_IMAGE_H__ */
@@ -0,0 +1,274 @@
+/*
+ * dc-tool, a tool for use with the dcload loader
+ *
+ * Copyright (C) 2023 Andrew Kieschnick <andrewk@austin.rr.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+/* Syscall dispatch shared by the IP and serial transports.
+ *
+ * Each transport decodes its request into a syscall number, which indexes
+ * syscall_table to find the handler in its dc_system_calls_t. Calls, bytes
+ * and service time are counted per syscall and dumped when the program
+ * exits, or whenever dc-tool gets SIGUSR1.
+ */
+
+#include "syscalls.h"
+#include "readahead.h"
+#include "file-io.h"
+#include "disc-image.h"
+
+#include <signal.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <time.h>
+#include <sys/time.h>
+
+typedef int (*syscall_handler_t)(unsigned char *buffer);
+typedef int (*syscall_iso_handler_t)(disc_image_t *disc, unsigned char *buffer);
+
+enum {
+    SYSCALL_PLAIN,  /* handler(buffer) */
+    SYSCALL_ISO,    /* handler(disc, buffer) */
+    SYSCALL_EXIT,
+    SYSCALL_NONE
+};
+
+typedef struct {
+    const char *name;
+    int kind;
+    size_t offset;  /* of the handler in dc_system_calls_t */
+} syscall_entry_t;
+
+#define ENTRY(name, kind, member) { name, kind, offsetof(dc_system_calls_t, member) }
+
+static const syscall_entry_t syscall_table[DC_SYSCALL_MAX] = {
+    [DC_SYSCALL_EXIT]      = { "exit", SYSCALL_EXIT, 0 },
+    [DC_SYSCALL_FSTAT]     = ENTRY("fstat", SYSCALL_PLAIN, fstat),
+    [DC_SYSCALL_WRITE]     = ENTRY("write", SYSCALL_PLAIN, write),
+    [DC_SYSCALL_READ]      = ENTRY("read", SYSCALL_PLAIN, read),
+    [DC_SYSCALL_OPEN]      = ENTRY("open", SYSCALL_PLAIN, open),
+    [DC_SYSCALL_CLOSE]     = ENTRY("close", SYSCALL_PLAIN, close),
+    [DC_SYSCALL_CREAT]     = ENTRY("creat", SYSCALL_PLAIN, create),
+    [DC_SYSCALL_LINK]      = ENTRY("link", SYSCALL_PLAIN, link),
+    [DC_SYSCALL_UNLINK]    = ENTRY("unlink", SYSCALL_PLAIN, unlink),
+    [DC_SYSCALL_CHDIR]     = ENTRY("chdir", SYSCALL_PLAIN, chdir),
+    [DC_SYSCALL_CHMOD]     = ENTRY("chmod", SYSCALL_PLAIN, chmod),
+    [DC_SYSCALL_LSEEK]     = ENTRY("lseek", SYSCALL_PLAIN, lseek),
+    [DC_SYSCALL_TIME]      = ENTRY("time", SYSCALL_PLAIN, time),
+    [DC_SYSCALL_STAT]      = ENTRY("stat", SYSCALL_PLAIN, stat),
+    [DC_SYSCALL_UTIME]     = ENTRY("utime", SYSCALL_PLAIN, utime),
+    [DC_SYSCALL_BAD]       = { "bad", SYSCALL_NONE, 0 },
+    [DC_SYSCALL_OPENDIR]   = ENTRY("opendir", SYSCALL_PLAIN, opendir),
+    [DC_SYSCALL_CLOSEDIR]  = ENTRY("closedir", SYSCALL_PLAIN, closedir),
+    [DC_SYSCALL_READDIR]   = ENTRY("readdir", SYSCALL_PLAIN, readdir),
+    [DC_SYSCALL_CDFSREAD]  = ENTRY("cdfsread", SYSCALL_ISO, cdfs_redir_read_sectors),
+    [DC_SYSCALL_GDBPACKET] = ENTRY("gdbpacket", SYSCALL_PLAIN, gdbpacket),
+    [DC_SYSCALL_REWINDDIR] = ENTRY("rewinddir", SYSCALL_PLAIN, rewinddir),
+    [DC_SYSCALL_PREAD]     = ENTRY("pread", SYSCALL_PLAIN, pread),
+    [DC_SYSCALL_PREADV]    = ENTRY("preadv", SYSCALL_PLAIN, preadv),
+    [DC_SYSCALL_READDIRPLUS] = ENTRY("readdirplus", SYSCALL_PLAIN, readdirplus),
+    [DC_SYSCALL_STAGEMEM]  = ENTRY("stagemem", SYSCALL_PLAIN, stagemem),
+    [DC_SYSCALL_CDFSTOC]   = ENTRY("cdfstoc", SYSCALL_ISO, cdfs_toc),
+};
+
+typedef struct {
+    unsigned int calls;
+    unsigned long long bytes_in;
+    unsigned long long bytes_out;
+    unsigned long long usec;
+    unsigned int allocs;
+    unsigned long long copied;
+} syscall_stats_t;
+
+static syscall_stats_t stats[DC_SYSCALL_MAX];
+static syscall_stats_t *current = NULL;
+
+/* latencies, from the request arriving to it being answered, are also
+ * counted in these buckets, in usec */
+static const unsigned int latency_limits[] = { 50, 100, 250, 500, 1000, 2500, 10000, 100000 };
+#define LATENCY_BUCKETS (sizeof(latency_limits) / sizeof(latency_limits[0]) + 1)
+static unsigned int latency_counts[LATENCY_BUCKETS];
+
+static volatile sig_atomic_t dump_requested = 0;
+
+unsigned long long dc_syscall_now(void)
+{
+#ifdef CLOCK_MONOTONIC
+    struct timespec thetime;
+
+    clock_gettime(CLOCK_MONOTONIC, &thetime);
+
+    return (unsigned long long)thetime.tv_sec * 1000000 + thetime.tv_nsec / 1000;
+#else
+    struct timeval thetime;
+
+    gettimeofday(&thetime, NULL);
+
+    return (unsigned long long)thetime.tv_sec * 1000000 + thetime.tv_usec;
+#endif
+}
+
+static void latency_record(unsigned long long usec)
+{
+    unsigned int i;
+
+    for (i = 0; i < LATENCY_BUCKETS - 1 && usec >= latency_limits[i]; i++)
+        ;
+    latency_counts[i]++;
+}
+
+static void stats_dump(void)
+{
+    syscall_stats_t *st;
+    unsigned int i, total = 0, timed = 0;
+
+    for (i = 0; i < DC_SYSCALL_MAX; i++)
+        total += stats[i].calls;
+    if (!total)
+        return;
+
+    printf("%-12s %6s %12s %12s %10s %8s %6s %12s\n", "syscall", "calls", "bytes in", "bytes out", "total ms", "avg us",
+           "allocs", "copied");
+    for (i = 0; i < DC_SYSCALL_MAX; i++) {
+        st = &stats[i];
+        if (!st->calls)
+            continue;
+        printf("%-12s %6u %12llu %12llu %10.1f %8llu %6u %12llu\n", syscall_table[i].name, st->calls,
+               st->bytes_in, st->bytes_out, st->usec / 1000.0, st->usec / st->calls, st->allocs, st->copied);
+    }
+
+    for (i = 0; i < LATENCY_BUCKETS; i++)
+        timed += latency_counts[i];
+
+    if (timed) {
+        printf("syscall latency (%u requests):\n", timed);
+        for (i = 0; i < LATENCY_BUCKETS; i++) {
+            if (!latency_counts[i])
+                continue;
+            if (i < LATENCY_BUCKETS - 1)
+                printf("  < %6u us: %u\n", latency_limits[i], latency_counts[i]);
+            else
+                printf("  >= %5u us: %u\n", latency_limits[i - 1], latency_counts[i]);
+        }
+    }
+
+    readahead_report();
+    file_io_report();
+    disc_report();
+    fflush(stdout);
+}
+
+#ifdef SIGUSR1
+static void dump_signal(int sig)
+{
+    (void)sig;
+    dump_requested = 1;
+}
+#endif
+
+void dc_syscall_poll(void)
+{
+#ifdef SIGUSR1
+    static int installed = 0;
+
+    if (!installed) {
+        signal(SIGUSR1, dump_signal);
+        installed = 1;
+    }
+#endif
+
+    if (dump_requested) {
+        dump_requested = 0;
+        stats_dump();
+    }
+}
+
+void dc_syscall_count(unsigned int in, unsigned int out)
+{
+    if (current) {
+        current->bytes_in += in;
+        current->bytes_out += out;
+    }
+}
+
+void dc_syscall_alloc(void)
+{
+    if (current)
+        current->allocs++;
+}
+
+void dc_syscall_copied(unsigned int bytes)
+{
+    if (current)
+        current->copied += bytes;
+}
+
+int dc_syscall_dispatch(const dc_system_calls_t *calls, unsigned int opcode, disc_image_t *disc,
+                        unsigned char *buffer, unsigned int len, unsigned long long arrived)
+{
+    const syscall_entry_t *entry;
+    const char *handler;
+    unsigned long long start, usec;
+    int retval = 0;
+
+    dc_syscall_poll();
+
+    if (opcode >= DC_SYSCALL_MAX)
+        return 0;
+
+    entry = &syscall_table[opcode];
+    handler = (const char *)calls + entry->offset;
+
+    /* not every transport has every syscall */
+    if (entry->kind != SYSCALL_NONE && entry->kind != SYSCALL_EXIT &&
+        !*(const syscall_handler_t *)handler) {
+        fprintf(stderr, "%s isn't supported over this transport\n", entry->name);
+        return 0;
+    }
+
+    start = dc_syscall_now();
+    current = &stats[opcode];
+    current->calls++;
+    current->bytes_in += len;
+
+    switch (entry->kind) {
+    case SYSCALL_PLAIN:
+        retval = (*(const syscall_handler_t *)handler)(buffer);
+        break;
+    case SYSCALL_ISO:
+        retval = (*(const syscall_iso_handler_t *)handler)(disc, buffer);
+        break;
+    case SYSCALL_EXIT:
+        retval = 1;
+        break;
+    default:
+        fprintf(stderr, "command %u should not happen... (but it did)\n", opcode);
+        break;
+    }
+
+    usec = dc_syscall_now();
+    current->usec += usec - start;
+    current = NULL;
+    if (entry->kind != SYSCALL_EXIT)
+        latency_record(usec - (arrived < start ? arrived : start));
+
+    if (retval == 1)
+        stats_dump();
+
+    return (retval < 0) ? -1 : retval;
+}
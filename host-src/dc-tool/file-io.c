@@ -0,0 +1,290 @@
+/*
+ * dc-tool, a tool for use with the dcload loader
+ *
+ * Copyright (C) 2023 Andrew Kieschnick <andrewk@austin.rr.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+/* Reads that happen behind the dispatch thread's back.
+ *
+ * The syscall handlers start a read here as soon as they know they'll need
+ * it, get on with talking to the target, and only wait for it when the data
+ * has to go out. With WITH_IO_URING on Linux the reads go to the kernel
+ * through io_uring. Otherwise, or if the kernel won't give us a ring, a few
+ * threads do them with read_at.
+ *
+ * read_at is lseek and read on MinGW, which would move the file position
+ * under the dispatch thread, so there no read is ever started and the
+ * callers read for themselves.
+ */
+
+#include "file-io.h"
+#include "utils.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#ifndef __MINGW32__
+#include <pthread.h>
+#ifdef WITH_IO_URING
+#include <liburing.h>
+#endif
+#endif
+
+#ifndef __MINGW32__
+
+#define FILE_IO_THREADS 4
+#define FILE_IO_DEPTH   64      /* io_uring entries, and reads in flight */
+
+struct file_io {
+    file_io_t *next;            /* in the queue, or on the free list */
+    int fd;
+    void *buf;
+    unsigned int count;
+    off_t offset;
+    int result;
+    int error;
+    int done;
+};
+
+static file_io_t *free_ios;
+
+static unsigned int started, waited;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t finished = PTHREAD_COND_INITIALIZER;
+static file_io_t *queue_head, *queue_tail;
+static int threads;
+
+#ifdef WITH_IO_URING
+static struct io_uring ring;
+static int ring_state;          /* 0 not tried yet, 1 up, -1 not to be had */
+static unsigned int in_flight;
+#endif
+
+static file_io_t *io_get(void)
+{
+    file_io_t *io;
+
+    if ((io = free_ios))
+        free_ios = io->next;
+    else if (!(io = malloc(sizeof(file_io_t))))
+        return NULL;
+
+    io->next = NULL;
+    io->result = 0;
+    io->error = 0;
+    io->done = 0;
+
+    return io;
+}
+
+static void io_put(file_io_t *io)
+{
+    io->next = free_ios;
+    free_ios = io;
+}
+
+static void *file_io_worker(void *arg)
+{
+    file_io_t *io;
+    int retval, error;
+
+    pthread_mutex_lock(&lock);
+    for (;;) {
+        while (!queue_head)
+            pthread_cond_wait(&work, &lock);
+
+        io = queue_head;
+        queue_head = io->next;
+        if (!queue_head)
+            queue_tail = NULL;
+        pthread_mutex_unlock(&lock);
+
+        retval = read_at(io->fd, io->buf, io->count, io->offset);
+        error = errno;
+
+        pthread_mutex_lock(&lock);
+        io->result = retval;
+        io->error = error;
+        io->done = 1;
+        pthread_cond_broadcast(&finished);
+    }
+
+    return NULL;
+}
+
+/* start the threads the first time they're needed. Returns nonzero if
+ * there's at least one. */
+static int threads_start(void)
+{
+    pthread_t thread;
+
+    while (threads < FILE_IO_THREADS) {
+        if (pthread_create(&thread, NULL, file_io_worker, NULL))
+            break;
+        pthread_detach(thread);
+        threads++;
+    }
+
+    return threads;
+}
+
+#ifdef WITH_IO_URING
+static int ring_start(void)
+{
+    if (!ring_state)
+        ring_state = io_uring_queue_init(FILE_IO_DEPTH, &ring, 0) ? -1 : 1;
+
+    return ring_state == 1;
+}
+
+/* wait for the next read on the ring to finish and mark it done */
+static void ring_reap(void)
+{
+    struct io_uring_cqe *cqe;
+    file_io_t *io;
+
+    /* a signal (SIGUSR1 for the stats) just means going round again */
+    if (io_uring_wait_cqe(&ring, &cqe) < 0)
+        return;
+
+    io = io_uring_cqe_get_data(cqe);
+    io->result = (cqe->res < 0) ? -1 : cqe->res;
+    io->error = (cqe->res < 0) ? -cqe->res : 0;
+    io->done = 1;
+    io_uring_cqe_seen(&ring, cqe);
+}
+#endif
+
+file_io_t *file_io_read(int fd, void *buf, unsigned int count, off_t offset)
+{
+    file_io_t *io;
+
+    if (!(io = io_get()))
+        return NULL;
+
+    io->fd = fd;
+    io->buf = buf;
+    io->count = count;
+    io->offset = offset;
+
+#ifdef WITH_IO_URING
+    if (ring_start()) {
+        struct io_uring_sqe *sqe;
+
+        /* the ring never has more in it than it has room for, so there's
+         * always an entry and the completions can't overflow */
+        if (in_flight == FILE_IO_DEPTH || !(sqe = io_uring_get_sqe(&ring))) {
+            io_put(io);
+            return NULL;
+        }
+
+        io_uring_prep_read(sqe, fd, buf, count, offset);
+        io_uring_sqe_set_data(sqe, io);
+        io_uring_submit(&ring);
+
+        in_flight++;
+        started++;
+        return io;
+    }
+#endif
+
+    if (!threads_start()) {
+        io_put(io);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&lock);
+    if (queue_tail)
+        queue_tail->next = io;
+    else
+        queue_head = io;
+    queue_tail = io;
+    pthread_cond_signal(&work);
+    pthread_mutex_unlock(&lock);
+
+    started++;
+    return io;
+}
+
+int file_io_wait(file_io_t *io)
+{
+    int retval;
+
+#ifdef WITH_IO_URING
+    if (ring_state == 1) {
+        if (!io->done)
+            waited++;
+        while (!io->done)
+            ring_reap();
+        in_flight--;
+    } else
+#endif
+    {
+        pthread_mutex_lock(&lock);
+        if (!io->done)
+            waited++;
+        while (!io->done)
+            pthread_cond_wait(&finished, &lock);
+        pthread_mutex_unlock(&lock);
+    }
+
+    retval = io->result;
+    if (retval < 0)
+        errno = io->error;
+
+    io_put(io);
+
+    return retval;
+}
+
+void file_io_report(void)
+{
+    const char *backend = "threads";
+
+    if (!started)
+        return;
+
+#ifdef WITH_IO_URING
+    if (ring_state == 1)
+        backend = "io_uring";
+#endif
+
+    printf("file i/o (%s): %u reads started, %u still going when needed\n",
+           backend, started, waited);
+}
+
+#else
+
+file_io_t *file_io_read(int fd, void *buf, unsigned int count, off_t offset)
+{
+    return NULL;
+}
+
+int file_io_wait(file_io_t *io)
+{
+    errno = EINVAL;
+    return -1;
+}
+
+void file_io_report(void)
+{
+}
+
+#endif /* __MINGW32__ */
@@ -0,0 +1,45 @@
+/*
+ * dc-tool, a tool for use with the dcload loader
+ *
+ * Copyright (C) 2023 Andrew Kieschnick <andrewk@austin.rr.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#ifndef __FILE_IO_H__
+#define __FILE_IO_H__
+
+#include <sys/types.h>
+
+typedef struct file_io file_io_t;
+
+/* file_io_read starts reading count bytes at offset in fd into buf and
+ * returns without waiting for it. buf has to stay around until the read is
+ * waited for. Returns NULL if the read couldn't be started; use read_at.
+ * Reads are only for the dispatch thread.
+ */
+file_io_t *file_io_read(int fd, void *buf, unsigned int count, off_t offset);
+
+/* file_io_wait waits for io to finish and returns what read_at would have.
+ * io is gone after this.
+ */
+int file_io_wait(file_io_t *io);
+
+/* file_io_report prints how many reads were started and how many of them
+ * were still going when they were waited for */
+void file_io_report(void);
+
+#endif /* __FILE_IO_H__ */
@@ -0,0 +1,203 @@
+/*
+ * dc-tool, a tool for use with the dcload loader
+ *
+ * Copyright (C) 2023 Andrew Kieschnick <andrewk@austin.rr.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+/* Chunk compression for PARTBINZ.
+ *
+ * Worker threads compress the image chunk by chunk, in order, ahead of the
+ * sender, so the wire never waits on lzo1x_1_compress. Each chunk is kept
+ * only if it came out smaller than the original.
+ *
+ * The compressed chunks go in a ring of slots, chunk n in slot n % ring, so
+ * memory doesn't grow with the image. The workers stop when they are a ring
+ * ahead of the oldest chunk the sender still wants, and go on as it releases
+ * chunks with ip_compress_release.
+ */
+
+#include "ip-compress.h"
+#include "minilzo.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAX_WORKERS 8
+
+/* worst case lzo1x output for len bytes of input */
+#define LZO_BOUND(len) ((len) + (len) / 16 + 64 + 3)
+
+#define NO_CHUNK ((unsigned int)-1)
+
+static unsigned char *src;
+static unsigned int src_size;
+static unsigned int chunk_size;
+static unsigned int chunks;
+
+static unsigned int ring;
+static unsigned char *packed;   /* chunk_size bytes per slot */
+static unsigned int *packed_len; /* 0 if the chunk is sent raw */
+static unsigned int *slot_chunk; /* the chunk each slot holds, once it's done */
+
+static unsigned int next_chunk;
+static unsigned int oldest;     /* chunks before this have been released */
+static int stopping;
+static int nworkers;
+static pthread_t workers[MAX_WORKERS];
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t chunk_done = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t slot_free = PTHREAD_COND_INITIALIZER;
+
+static void *compress_worker(void *arg)
+{
+    lzo_voidp wrkmem = malloc(LZO1X_1_MEM_COMPRESS);
+    unsigned char *out = malloc(LZO_BOUND(chunk_size));
+    unsigned int index, slot, len;
+    lzo_uint clen;
+
+    for (;;) {
+        pthread_mutex_lock(&lock);
+        while (!stopping && next_chunk < chunks && next_chunk - oldest >= ring)
+            pthread_cond_wait(&slot_free, &lock);
+        if (stopping || next_chunk == chunks) {
+            pthread_mutex_unlock(&lock);
+            break;
+        }
+        index = next_chunk++;
+        pthread_mutex_unlock(&lock);
+
+        slot = index % ring;
+        len = (src_size - index * chunk_size > chunk_size) ? chunk_size : src_size - index * chunk_size;
+        clen = 0;
+        if (wrkmem && out && lzo1x_1_compress(src + index * chunk_size, len, out, &clen, wrkmem) == LZO_E_OK && clen < len)
+            memcpy(packed + (size_t)slot * chunk_size, out, clen);
+        else
+            clen = 0;
+
+        pthread_mutex_lock(&lock);
+        packed_len[slot] = clen;
+        slot_chunk[slot] = index;
+        pthread_cond_broadcast(&chunk_done);
+        pthread_mutex_unlock(&lock);
+    }
+
+    free(out);
+    free(wrkmem);
+
+    return NULL;
+}
+
+int ip_compress_start(unsigned char *data, unsigned int size, unsigned int chunk, unsigned int ahead)
+{
+    long ncpu = 2;
+    unsigned int i;
+
+#ifdef _SC_NPROCESSORS_ONLN
+    ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    if (ncpu < 1)
+        ncpu = 1;
+    if (ncpu > MAX_WORKERS)
+        ncpu = MAX_WORKERS;
+
+    src = data;
+    src_size = size;
+    chunk_size = chunk;
+    chunks = (size + chunk - 1) / chunk;
+    ring = (ahead && ahead < chunks) ? ahead : chunks;
+    next_chunk = 0;
+    oldest = 0;
+    stopping = 0;
+
+    packed = malloc((size_t)ring * chunk);
+    packed_len = calloc(ring, sizeof(unsigned int));
+    slot_chunk = malloc(ring * sizeof(unsigned int));
+    if (!packed || !packed_len || !slot_chunk) {
+        ip_compress_stop();
+        return -1;
+    }
+    for (i = 0; i < ring; i++)
+        slot_chunk[i] = NO_CHUNK;
+
+    for (nworkers = 0; nworkers < ncpu; nworkers++)
+        if (pthread_create(&workers[nworkers], NULL, compress_worker, NULL))
+            break;
+
+    if (!nworkers) {
+        ip_compress_stop();
+        return -1;
+    }
+
+    return 0;
+}
+
+unsigned int ip_compress_chunk(unsigned int index, unsigned char **out)
+{
+    unsigned int slot, len;
+
+    pthread_mutex_lock(&lock);
+
+    /* released, or too far ahead to ever be compressed without a release */
+    if (index >= chunks || index < oldest || index - oldest >= ring) {
+        pthread_mutex_unlock(&lock);
+        return 0;
+    }
+
+    slot = index % ring;
+    while (slot_chunk[slot] != index)
+        pthread_cond_wait(&chunk_done, &lock);
+    len = packed_len[slot];
+    pthread_mutex_unlock(&lock);
+
+    *out = packed + (size_t)slot * chunk_size;
+    return len;
+}
+
+void ip_compress_release(unsigned int index)
+{
+    pthread_mutex_lock(&lock);
+    if (index > oldest) {
+        oldest = index;
+        pthread_cond_broadcast(&slot_free);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+void ip_compress_stop(void)
+{
+    int i;
+
+    pthread_mutex_lock(&lock);
+    stopping = 1;
+    pthread_cond_broadcast(&slot_free);
+    pthread_mutex_unlock(&lock);
+
+    for (i = 0; i < nworkers; i++)
+        pthread_join(workers[i], NULL);
+    nworkers = 0;
+
+    free(packed);
+    free(packed_len);
+    free(slot_chunk);
+    packed = NULL;
+    packed_len = NULL;
+    slot_chunk = NULL;
+    chunks = 0;
+}
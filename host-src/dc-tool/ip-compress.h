@@ -0,0 +1,47 @@
+/*
+ * dc-tool, a tool for use with the dcload loader
+ *
+ * Copyright (C) 2023 Andrew Kieschnick <andrewk@austin.rr.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#ifndef __IP_COMPRESS_H__
+#define __IP_COMPRESS_H__
+
+/* ip_compress_start begins compressing size bytes at data, in pieces of
+ * chunk bytes, on a pool of worker threads that stay at most ahead chunks
+ * past the oldest one not released (0 for no limit). Returns -1 if the pool
+ * couldn't be started, in which case everything should be sent uncompressed.
+ */
+int ip_compress_start(unsigned char *data, unsigned int size, unsigned int chunk, unsigned int ahead);
+
+/* ip_compress_chunk waits for chunk index to be compressed. It returns the
+ * compressed length and points out at the compressed data, or returns 0 if
+ * the chunk didn't shrink and should be sent as it is. Chunks already
+ * released, or ahead chunks or more past the oldest one that isn't, are
+ * always sent as they are. The data stays good until index is released.
+ */
+unsigned int ip_compress_chunk(unsigned int index, unsigned char **out);
+
+/* ip_compress_release says the chunks before index won't be asked for
+ * again, and their compressed data is no longer being sent from */
+void ip_compress_release(unsigned int index);
+
+/* ip_compress_stop stops the workers and frees everything */
+void ip_compress_stop(void);
+
+#endif /* __IP_COMPRESS_H__ */
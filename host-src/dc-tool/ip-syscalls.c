@@ -23,6 +23,10 @@
 #include "syscalls.h"
 #include "dcload-types.h"
 #include "ip-transport.h"
+#include "dir-handles.h"
+#include "readahead.h"
+#include "file-io.h"
+#include "buffer-pool.h"
 #include "utils.h"
 #include "gdb.h"
 
@@ -45,29 +49,26 @@
 
 #define send_data ip_xprt_send_data
 #define send_cmd(v, w, x, y, z) if (ip_xprt_send_command(v, w, x, y, z) == -1) return -1
+#define send_retval(v, w, x, y) if (ip_xprt_send_retval(v, w, x, y) == -1) return -1
 
 #ifndef O_BINARY
 #define O_BINARY 0
 #endif
 
-#ifndef MAX_OPEN_DIRS
-#define MAX_OPEN_DIRS   16
-#endif
-
-/* Sigh... KOS treats anything under 100 as invalid for a dirent from dcload, so
-   we need to offset by a bit. This aught to do. */
-#define DIRENT_OFFSET   1337
-
-static DIR *opendirs[MAX_OPEN_DIRS];
-
 /* syscalls for dcload-ip
  *
  * 1. receive all parameters from dc
  * 2. get any data from dc using recv_data (dc passes address/size of buffer)
  * 3. send any data to dc using send_data (dc passess address/size of buffer)
  * 4. send return value to dc
+ *
+ * Steps 3 and 4 are one packet when the data is small, see send_retval.
  */
 
+/* the target's staging buffer for read-ahead, see dc_stagemem */
+static unsigned int stage_addr;
+static unsigned int stage_size;
+
 static unsigned int dc_order(unsigned int x)
 {
     if (x == htonl(x))
@@ -102,9 +103,7 @@ static int dc_fstat(unsigned char * buffer)
     dcstat.st_mtime_priv = dc_order(filestat.st_mtime);
     dcstat.st_ctime_priv = dc_order(filestat.st_ctime);
 
-    send_data((unsigned char *)&dcstat, ntohl(command->value1), ntohl(command->value2));
-
-    send_cmd(CMD_RETVAL, retval, retval, NULL, 0);
+    send_retval(retval, &dcstat, ntohl(command->value2), ntohl(command->value1));
 
     return 0;
 }
@@ -114,42 +113,141 @@ static int dc_write(unsigned char * buffer)
     unsigned char *data;
     int retval;
     command_3int_t *command = (command_3int_t *)buffer;
-    /* value0 = fd, value1 = addr, value2 = size */
+    unsigned int size = ntohl(command->value2);
+    /* value0 = fd, value1 = addr, value2 = size, then the data itself if
+     * it fit in the request */
+
+    readahead_forget(ntohl(command->value0));
 
-    data = malloc(ntohl(command->value2));
+    if (ip_xprt_request_len() >= sizeof(command_3int_t) + size) {
+        retval = write(ntohl(command->value0), buffer + sizeof(command_3int_t), size);
+        send_cmd(CMD_RETVAL, retval, retval, NULL, 0);
+        return 0;
+    }
+
+    /* the data stays on the target until we ask for it */
+    if (!(data = pool_alloc(size))) {
+        send_cmd(CMD_RETVAL, -1, -1, NULL, 0);
+        return 0;
+    }
 
-    ip_xprt_recv_data_quiet(ntohl(command->value1), ntohl(command->value2), data);
+    ip_xprt_recv_data_quiet(ntohl(command->value1), size, data);
+    dc_syscall_copied(size);
 
-    retval = write(ntohl(command->value0), data, ntohl(command->value2));
+    retval = write(ntohl(command->value0), data, size);
 
     if (ip_xprt_send_command(CMD_RETVAL, retval, retval, NULL, 0) == -1) {
-        free(data);
+        pool_free(data);
         return -1;
     }
 
-    free(data);
+    pool_free(data);
 
     return 0;
 }
 
-static int dc_read(unsigned char * buffer)
+/* send count pieces of data in one transfer where the target can take
+ * that, or one at a time where it can't */
+static int send_segments(xprt_segment_t *segs, unsigned int count)
 {
-    unsigned char *data;
+    unsigned int i;
     int retval;
+
+    if (!count)
+        return 0;
+
+    retval = ip_xprt_send_segments(segs, count, 0, 0, 0, 0);
+    for (i = 0; retval == 1 && i < count; i++)
+        if (send_data(segs[i].data, segs[i].len, segs[i].dcaddr) == -1)
+            return -1;
+
+    return (retval == -1) ? -1 : 0;
+}
+
+static int dc_read(unsigned char * buffer)
+{
+    xprt_segment_t segs[2];
+    unsigned char *data = NULL, *view;
+    unsigned int n = 0, want;
+    int retval, staged = 0;
     command_3int_t *command = (command_3int_t *)buffer;
+    int fd = ntohl(command->value0);
+    unsigned int size = ntohl(command->value2);
     /* value0 = fd, value1 = addr, value2 = size */
 
-    data = malloc(ntohl(command->value2));
-    retval = read(ntohl(command->value0), data, ntohl(command->value2));
+    /* the target reads on from its staging buffer, and the size of RETV
+     * says how much went there */
+    want = size;
+    if (stage_size && readahead_sequential(fd))
+        want += stage_size;
+
+    /* regular files go out straight from the page cache */
+    retval = readahead_view(fd, want, &view);
+    if (retval != -1) {
+        if (retval > (int)size) {
+            staged = retval - size;
+            retval = size;
+        }
+    } else {
+        if (!(view = data = pool_alloc(want))) {
+            send_cmd(CMD_RETVAL, -1, -1, NULL, 0);
+            return 0;
+        }
+        retval = readahead_read(fd, data, size);
+        if (want > size && retval == (int)size) {
+            staged = readahead_read(fd, data + size, want - size);
+            if (staged < 0)
+                staged = 0;
+        }
+    }
+
+    if (!stage_size) {
+        /* only what was read needs to go back */
+        retval = ip_xprt_send_retval(retval, view, retval > 0 ? retval : 0, ntohl(command->value1));
+        pool_free(data);
+        return (retval == -1) ? -1 : 0;
+    }
 
-    send_data(data, ntohl(command->value1), ntohl(command->value2));
+    if (retval > 0) {
+        segs[n].data = view;
+        segs[n].len = retval;
+        segs[n].dcaddr = ntohl(command->value1);
+        n++;
+    }
+    if (staged) {
+        segs[n].data = view + size;
+        segs[n].len = staged;
+        segs[n].dcaddr = stage_addr;
+        n++;
+    }
 
-    if (ip_xprt_send_command(CMD_RETVAL, retval, retval, NULL, 0)) {
-        free(data);
+    if (send_segments(segs, n) == -1 ||
+        ip_xprt_send_command(CMD_RETVAL, retval, staged, NULL, 0) == -1) {
+        pool_free(data);
         return -1;
     }
 
-    free(data);
+    pool_free(data);
+    return 0;
+}
+
+/* most the target may have pushed into its staging buffer per read */
+#define STAGE_MAX (64 * 1024)
+
+static int dc_stagemem(unsigned char * buffer)
+{
+    command_3int_t *command = (command_3int_t *)buffer;
+    /* value0 = addr, value1 = size */
+
+    stage_addr = ntohl(command->value0);
+    stage_size = ntohl(command->value1);
+    if (!stage_addr)
+        stage_size = 0;
+    if (stage_size > STAGE_MAX)
+        stage_size = STAGE_MAX;
+
+    send_cmd(CMD_RETVAL, 0, 0, NULL, 0);
+
     return 0;
 }
 
@@ -187,6 +285,7 @@ static int dc_close(unsigned char * buffer)
     int retval;
     command_int_t *command = (command_int_t *)buffer;
 
+    readahead_forget(ntohl(command->value0));
     retval = close(ntohl(command->value0));
 
     send_cmd(CMD_RETVAL, retval, retval, NULL, 0);
@@ -311,9 +410,7 @@ static int dc_stat(unsigned char * buffer)
     dcstat.st_mtime_priv = dc_order(filestat.st_mtime);
     dcstat.st_ctime_priv = dc_order(filestat.st_ctime);
 
-    send_data((unsigned char *)&dcstat, ntohl(command->value0), ntohl(command->value1));
-
-    send_cmd(CMD_RETVAL, retval, retval, NULL, 0);
+    send_retval(retval, &dcstat, ntohl(command->value1), ntohl(command->value0));
 
     return 0;
 }
@@ -339,27 +436,12 @@ static int dc_utime(unsigned char * buffer)
 
 static int dc_opendir(unsigned char * buffer)
 {
-    DIR *somedir;
     command_string_t *command = (command_string_t *)buffer;
-    int i;
-
-    /* Find an open entry */
-    for(i = 0; i < MAX_OPEN_DIRS; ++i) {
-        if(!opendirs[i])
-            break;
-    }
+    unsigned int handle;
 
-    if(i < MAX_OPEN_DIRS) {
-        if(!(opendirs[i] = opendir(command->string)))
-            i = 0;
-        else
-            i += DIRENT_OFFSET;
-    }
-    else {
-        i = 0;
-    }
+    handle = dir_handle_open(command->string);
 
-    send_cmd(CMD_RETVAL, (unsigned int)i, (unsigned int)i, NULL, 0);
+    send_cmd(CMD_RETVAL, handle, handle, NULL, 0);
 
     return 0;
 }
@@ -368,15 +450,8 @@ static int dc_closedir(unsigned char * buffer)
 {
     int retval;
     command_int_t *command = (command_int_t *)buffer;
-    uint32_t i = ntohl(command->value0);
 
-    if(i >= DIRENT_OFFSET && i < MAX_OPEN_DIRS + DIRENT_OFFSET) {
-        retval = closedir(opendirs[i - DIRENT_OFFSET]);
-        opendirs[i - DIRENT_OFFSET] = NULL;
-    }
-    else {
-        retval = -1;
-    }
+    retval = dir_handle_close(ntohl(command->value0));
 
     send_cmd(CMD_RETVAL, retval, retval, NULL, 0);
 
@@ -388,12 +463,8 @@ static int dc_readdir(unsigned char * buffer)
     struct dirent *somedirent;
     dcload_dirent_t dcdirent;
     command_3int_t *command = (command_3int_t *)buffer;
-    uint32_t i = ntohl(command->value0);
 
-    if(i >= DIRENT_OFFSET && i < MAX_OPEN_DIRS + DIRENT_OFFSET)
-        somedirent = readdir(opendirs[i - DIRENT_OFFSET]);
-    else
-        somedirent = NULL;
+    somedirent = dir_handle_read(ntohl(command->value0));
 
     if (somedirent) {
 #if defined (__APPLE__) || defined (__NetBSD__) || defined (__FreeBSD__) || defined (__OpenBSD__)
@@ -415,8 +486,7 @@ static int dc_readdir(unsigned char * buffer)
 #endif
         strcpy(dcdirent.d_name, somedirent->d_name);
 
-        send_data((unsigned char *)&dcdirent, ntohl(command->value1), ntohl(command->value2));
-        send_cmd(CMD_RETVAL, 1, 1, NULL, 0);
+        send_retval(1, &dcdirent, ntohl(command->value2), ntohl(command->value1));
 
         return 0;
     }
@@ -430,45 +500,209 @@ static int dc_rewinddir(unsigned char * buffer)
 {
     int retval;
     command_int_t *command = (command_int_t *)buffer;
-    uint32_t i = ntohl(command->value0);
 
-    if(i >= DIRENT_OFFSET && i < MAX_OPEN_DIRS + DIRENT_OFFSET) {
-        rewinddir(opendirs[i - DIRENT_OFFSET]);
-        opendirs[i - DIRENT_OFFSET] = NULL;
-        retval = 0;
-    }
-    else {
-        retval = -1;
-    }
+    retval = dir_handle_rewind(ntohl(command->value0));
 
     send_cmd(CMD_RETVAL, retval, retval, NULL, 0);
 
     return 0;
 }
 
-static int dc_cdfs_redir_read_sectors(int isofd, unsigned char * buffer)
+/* most of the target's buffer filled by one readdirplus */
+#define READDIRPLUS_MAX 65536
+
+static int dc_readdirplus(unsigned char * buffer)
 {
-    int start;
-    unsigned char * buf;
+    unsigned char *data;
+    unsigned int size, used;
+    int retval;
     command_3int_t *command = (command_3int_t *)buffer;
+    /* value0 = dir, value1 = addr, value2 = size */
 
-    start = ntohl(command->value0) - 150;
+    size = ntohl(command->value2);
+    if (size > READDIRPLUS_MAX)
+        size = READDIRPLUS_MAX;
 
-    lseek(isofd, start * 2048, SEEK_SET);
+    if (!(data = pool_alloc(size))) {
+        send_cmd(CMD_RETVAL, -1, -1, NULL, 0);
+        return 0;
+    }
+    retval = dir_handle_readplus(ntohl(command->value0), data, size, &used);
 
-    buf = malloc(ntohl(command->value2));
+    if (ip_xprt_send_retval(retval, data, used, ntohl(command->value1)) == -1) {
+        pool_free(data);
+        return -1;
+    }
 
-    read(isofd, buf, ntohl(command->value2));
+    pool_free(data);
+    return 0;
+}
 
-    send_data(buf, ntohl(command->value1), ntohl(command->value2));
+static int dc_cdfs_redir_read_sectors(disc_image_t *disc, unsigned char * buffer)
+{
+    unsigned char *data;
+    command_3int_t *command = (command_3int_t *)buffer;
+    /* value0 = sector, value1 = addr, value2 = size */
 
-    send_cmd(CMD_RETVAL, 0, 0, NULL, 0);
+    if (disc_read(disc, ntohl(command->value0), ntohl(command->value2), &data) == -1) {
+        send_cmd(CMD_RETVAL, -1, -1, NULL, 0);
+        return 0;
+    }
 
-    free(buf);
+    if (ip_xprt_send_retval(0, data, ntohl(command->value2), ntohl(command->value1)) == -1)
+        return -1;
 
     return 0;
 }
 
+static int dc_cdfs_toc(disc_image_t *disc, unsigned char * buffer)
+{
+    unsigned char toc[DISC_TOC_SIZE];
+    command_3int_t *command = (command_3int_t *)buffer;
+    int retval;
+    /* value0 = area, value1 = addr, value2 = size */
+
+    retval = disc_toc(disc, ntohl(command->value0), toc);
+
+    /* an area that isn't there leaves the target's buffer alone */
+    if (ip_xprt_send_retval(retval, toc, retval ? 0 : sizeof(toc), ntohl(command->value1)) == -1)
+        return -1;
+
+    return 0;
+}
+
+static int dc_pread(unsigned char * buffer)
+{
+    unsigned char *data = NULL, *view;
+    int retval;
+    command_4int_t *command = (command_4int_t *)buffer;
+    int fd = ntohl(command->value0);
+    unsigned int size = ntohl(command->value2);
+    unsigned int offset = ntohl(command->value3);
+    /* value0 = fd, value1 = addr, value2 = size, value3 = offset */
+
+    retval = readahead_view_at(fd, offset, size, &view);
+    if (retval == -1) {
+        if (!(view = data = pool_alloc(size))) {
+            send_cmd(CMD_RETVAL, -1, -1, NULL, 0);
+            return 0;
+        }
+        retval = read_at(fd, data, size, offset);
+        dc_syscall_copied(retval > 0 ? retval : 0);
+    }
+
+    retval = ip_xprt_send_retval(retval, view, retval > 0 ? retval : 0, ntohl(command->value1));
+
+    pool_free(data);
+    return (retval == -1) ? -1 : 0;
+}
+
+/* most ranges in one preadv, so that they all fit one CMD_LOADBINM */
+#define PREADV_MAX IP_XPRT_MAX_SEGMENTS
+
+/* most bytes in one preadv, all of the target's RAM */
+#define PREADV_SIZE_MAX (16 * 1024 * 1024)
+
+static int dc_preadv(unsigned char * buffer)
+{
+    command_3int_string_t *command = (command_3int_string_t *)buffer;
+    xprt_segment_t segs[PREADV_MAX];
+    file_io_t *io[PREADV_MAX];
+    unsigned int at[PREADV_MAX];
+    unsigned int range[3];
+    unsigned int count = ntohl(command->value1);
+    unsigned int i, j, n = 0, size = 0, pos = 0;
+    unsigned char *data = NULL, *view;
+    int fd = ntohl(command->value0);
+    int retval = -1, total = 0;
+    /* value0 = fd, value1 = count, then count of offset, addr, size */
+
+    if (count > PREADV_MAX ||
+        ip_xprt_request_len() < (int)(sizeof(command_3int_string_t) - 1 + count * sizeof(range))) {
+        send_cmd(CMD_RETVAL, -1, -1, NULL, 0);
+        return 0;
+    }
+
+    for (i = 0; i < count; i++) {
+        memcpy(range, command->string + i * sizeof(range), sizeof(range));
+        if (ntohl(range[2]) > PREADV_SIZE_MAX - size) {
+            send_cmd(CMD_RETVAL, -1, -1, NULL, 0);
+            return 0;
+        }
+        size += ntohl(range[2]);
+    }
+
+    memset(io, 0, sizeof(io));
+
+    /* like readv, stop at the first short read */
+    for (i = 0; i < count; i++) {
+        memcpy(range, command->string + i * sizeof(range), sizeof(range));
+
+        if (!data)
+            retval = readahead_view_at(fd, ntohl(range[0]), ntohl(range[2]), &view);
+        if (data || retval == -1) {
+            /* a file that can't be mapped has all of its ranges started
+             * at once, and they're waited for in turn */
+            if (!data) {
+                if (!(data = pool_alloc(size))) {
+                    if (!total)
+                        total = -1;
+                    break;
+                }
+                for (j = i; j < count; j++) {
+                    memcpy(range, command->string + j * sizeof(range), sizeof(range));
+                    at[j] = pos;
+                    io[j] = file_io_read(fd, data + pos, ntohl(range[2]), ntohl(range[0]));
+                    pos += ntohl(range[2]);
+                }
+                memcpy(range, command->string + i * sizeof(range), sizeof(range));
+            }
+            view = data + at[i];
+            if (io[i]) {
+                retval = file_io_wait(io[i]);
+                io[i] = NULL;
+            } else {
+                retval = read_at(fd, view, ntohl(range[2]), ntohl(range[0]));
+            }
+            if (retval > 0)
+                dc_syscall_copied(retval);
+        }
+        if (retval < 0) {
+            if (!total)
+                total = -1;
+            break;
+        }
+
+        if (retval) {
+            segs[n].data = view;
+            segs[n].len = retval;
+            segs[n].dcaddr = ntohl(range[1]);
+            n++;
+        }
+
+        total += retval;
+        if (retval < ntohl(range[2]))
+            break;
+    }
+
+    /* everything goes to the target in one transfer where it can */
+    if (n == 1) {
+        retval = ip_xprt_send_retval(total, segs[0].data, segs[0].len, segs[0].dcaddr);
+    } else {
+        retval = send_segments(segs, n);
+        if (retval != -1)
+            retval = ip_xprt_send_command(CMD_RETVAL, total, total, NULL, 0);
+    }
+
+    /* reads past a short one still have to land before data goes */
+    for (i = 0; i < count; i++)
+        if (io[i])
+            file_io_wait(io[i]);
+
+    pool_free(data);
+    return (retval == -1) ? -1 : 0;
+}
+
 static int dc_gdbpacket(unsigned char * buffer)
 {
     size_t in_size, out_size;
@@ -534,6 +768,11 @@ const dc_system_calls_t ip_xprt_system_calls = {
     .readdir = dc_readdir,
     .closedir = dc_closedir,
     .rewinddir = dc_rewinddir,
+    .readdirplus = dc_readdirplus,
+    .stagemem = dc_stagemem,
     .cdfs_redir_read_sectors = dc_cdfs_redir_read_sectors,
+    .cdfs_toc = dc_cdfs_toc,
     .gdbpacket = dc_gdbpacket,
+    .pread = dc_pread,
+    .preadv = dc_preadv,
 };
@@ -19,8 +19,13 @@
  *
  */
 
+#ifdef __linux__
+#define _GNU_SOURCE /* for sendmmsg */
+#endif
+
 #include "config.h" // needed for newer BFD library
 #include "ip-transport.h"
+#include "ip-compress.h"
 #include "syscalls.h"
 #include "utils.h"
 
@@ -41,8 +46,10 @@
 #include <errno.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <netdb.h>
+#include <poll.h>
 #endif
 
 /* Convenience macro. */
@@ -58,13 +65,187 @@ static SOCKET dcsocket = INVALID_SOCKET;
 
 static int recv_response(unsigned char *buffer, int timeout);
 
+/* microseconds on a clock that never jumps, for timeouts and pacing. Only
+ * differences are meaningful, and they stay right across the wrap. */
 static unsigned int time_in_usec()
 {
+#ifdef CLOCK_MONOTONIC
+    struct timespec thetime;
+
+    clock_gettime(CLOCK_MONOTONIC, &thetime);
+
+    return (unsigned int)(thetime.tv_sec * 1000000) + (unsigned int)(thetime.tv_nsec / 1000);
+#else
     struct timeval thetime;
 
     gettimeofday(&thetime, NULL);
 
     return (unsigned int)(thetime.tv_sec * 1000000) + (unsigned int)thetime.tv_usec;
+#endif
+}
+
+/* sleep until delay usec after start, if that hasn't already passed */
+static void sleep_until(unsigned int start, unsigned int delay)
+{
+    unsigned int elapsed = time_in_usec() - start;
+    struct timespec time;
+
+    if (elapsed >= delay)
+        return;
+
+    time.tv_sec = (delay - elapsed) / 1000000;
+    time.tv_nsec = (delay - elapsed) % 1000000 * 1000;
+    nanosleep(&time, NULL);
+}
+
+/* wait up to timeout usec for a packet to arrive, without spinning */
+static void wait_readable(unsigned int timeout)
+{
+#ifndef __MINGW32__
+    struct pollfd pfd;
+
+    pfd.fd = dcsocket;
+    pfd.events = POLLIN;
+    poll(&pfd, 1, (timeout + 999) / 1000);
+#else
+    struct timeval time;
+    fd_set fds;
+
+    FD_ZERO(&fds);
+    FD_SET(dcsocket, &fds);
+    time.tv_sec = timeout / 1000000;
+    time.tv_usec = timeout % 1000000;
+    select(0, &fds, NULL, NULL, &time);
+#endif
+}
+
+/* receive a packet into buffer, giving up timeout usec after start */
+static int recv_until(unsigned char *buffer, unsigned int start, unsigned int timeout)
+{
+    unsigned int elapsed;
+    int rv;
+
+    for (;;) {
+        if ((rv = recv(dcsocket, (void *)buffer, 2048, 0)) != -1) {
+            dc_syscall_count(rv, 0);
+            return rv;
+        }
+
+        if ((elapsed = time_in_usec() - start) >= timeout)
+            return -1;
+
+        wait_readable(timeout - elapsed);
+    }
+}
+
+/* Syscall requests that arrive in the middle of a transfer.
+ *
+ * A program can go on running while a transfer is under way: the final
+ * DONEBIN of an upload that starts it may be answered late, and the answer to
+ * a non-blocking read or write is itself a transfer. If it makes a syscall
+ * meanwhile, the request turns up where a LOADBIN, DONEBIN or SENDBIN reply
+ * was expected. Those requests are held here, in the order they came, and the
+ * dispatcher answers them once the transfer is over. The target sends each
+ * request once, so losing one would leave it waiting for good.
+ */
+#define HELD_MAX 16
+
+static unsigned char held[HELD_MAX][2048];
+static int held_len[HELD_MAX];
+static unsigned long long held_at[HELD_MAX]; /* dc_syscall_now when it came */
+static int held_first = 0, held_count = 0;
+
+/* hold the len byte packet in buffer if it's a syscall request, returning
+ * nonzero if it was one */
+static int hold_request(unsigned char *buffer, int len)
+{
+    int slot;
+
+    if (buffer[0] != 'D' || (buffer[1] != 'C' && buffer[1] != 'D') ||
+        buffer[2] < '0' || buffer[2] > '9' || buffer[3] < '0' || buffer[3] > '9')
+        return 0;
+
+    if (held_count == HELD_MAX) {
+        printf("too many syscalls during a transfer, dropping %c%c%c%c\n", buffer[0], buffer[1], buffer[2], buffer[3]);
+        return 1;
+    }
+
+    slot = (held_first + held_count++) % HELD_MAX;
+    memcpy(held[slot], buffer, len);
+    held_len[slot] = len;
+    held_at[slot] = dc_syscall_now();
+
+    return 1;
+}
+
+/* recv_until for the replies of a transfer, holding any requests */
+static int recv_reply_until(unsigned char *buffer, unsigned int start, unsigned int timeout)
+{
+    int len;
+
+    while ((len = recv_until(buffer, start, timeout)) != -1 && hold_request(buffer, len))
+        ;
+
+    return len;
+}
+
+static int recv_reply(unsigned char *buffer, int timeout)
+{
+    return recv_reply_until(buffer, time_in_usec(), timeout);
+}
+
+/* Chunk size negotiation.
+ *
+ * dc-tool offers the largest chunk that fits an Ethernet frame in a VERS
+ * command. A dcload-ip that understands this answers with DCLOAD_CAP_PRESENT
+ * set in the address, and the chunk size it accepts in the size. Older
+ * versions just echo the command back, so we fall back to 1024 byte chunks.
+ * The chunk size is then sent as a 4 byte payload of every LOADBIN, SENDBIN
+ * and SENDBINQ command.
+ */
+static unsigned int chunk_size = IP_XPRT_LEGACY_CHUNK;
+static unsigned int target_caps = 0;
+static int negotiated = 0;
+
+#define NEGOTIATE_TRIES 4
+
+static void negotiate(void)
+{
+    unsigned char buffer[2048];
+    command_t *reply = (command_t *)buffer;
+    int tries;
+
+    negotiated = 1;
+
+    for (tries = 0; tries < NEGOTIATE_TRIES; tries++) {
+        if (ip_xprt_send_command(CMD_VERSION, 0, IP_XPRT_MAX_CHUNK, NULL, 0) == -1)
+            return;
+
+        while (recv_reply(buffer, PACKET_TIMEOUT) != -1) {
+            if (memcmp(reply->id, CMD_VERSION, 4))
+                continue;
+
+            if (ntohl(reply->address) & DCLOAD_CAP_PRESENT) {
+                target_caps = ntohl(reply->address);
+                chunk_size = ntohl(reply->size);
+                if (chunk_size < IP_XPRT_LEGACY_CHUNK || chunk_size > IP_XPRT_MAX_CHUNK)
+                    chunk_size = IP_XPRT_LEGACY_CHUNK;
+            }
+
+            return;
+        }
+    }
+}
+
+/* send a LOADBIN, SENDBIN or SENDBINQ command carrying our chunk size */
+static int send_bin_command(const char *command, unsigned int dcaddr, unsigned int size)
+{
+    unsigned int chunk = htonl(chunk_size);
+
+    if (!(target_caps & DCLOAD_CAP_PRESENT))
+        return ip_xprt_send_command(command, dcaddr, size, NULL, 0);
+
+    return ip_xprt_send_command(command, dcaddr, size, (unsigned char *)&chunk, sizeof(chunk));
 }
 
 /* receive total bytes from dc and store in data */
@@ -73,36 +254,42 @@ static int recv_data(void *data, unsigned int dcaddr, unsigned int total, unsign
     unsigned char buffer[2048];
     unsigned char *i;
     int c;
-    unsigned char *map = (unsigned char *)malloc((total+1023)/1024);
+    unsigned char *map;
+    unsigned int chunks;
+    unsigned int index;
     int packets = 0;
     unsigned int start;
     int retval;
 
-    memset(map, 0, (total+1023)/1024);
+    if (!negotiated)
+        negotiate();
 
-    if (!quiet) {
-	    send_cmd(CMD_SENDBIN, dcaddr, total, NULL, 0);
-    }
-    else {
-	    send_cmd(CMD_SENDBINQ, dcaddr, total, NULL, 0);
+    chunks = (total + chunk_size - 1) / chunk_size;
+    if (!(map = calloc(chunks ? chunks : 1, 1)))
+        return -1;
+
+    if (send_bin_command(quiet ? CMD_SENDBINQ : CMD_SENDBIN, dcaddr, total) == -1) {
+        free(map);
+        return -1;
     }
 
     start = time_in_usec();
 
-    while (((time_in_usec() - start) < PACKET_TIMEOUT)&&(packets < ((total+1023)/1024 + 1))) {
+    while (((time_in_usec() - start) < PACKET_TIMEOUT)&&(packets < (chunks + 1))) {
         memset(buffer, 0, 2048);
 
-        while(((retval = recv(dcsocket, (void *)buffer, 2048, 0)) == -1)&&((time_in_usec() - start) < PACKET_TIMEOUT));
+        retval = recv_reply_until(buffer, start, PACKET_TIMEOUT);
 
         if (retval > 0) {
             start = time_in_usec();
             if (memcmp(((command_t *)buffer)->id, CMD_DONEBIN, 4)) {
-                if (((ntohl(((command_t *)buffer)->address) - dcaddr)/1024) >= ((total + 1024)/1024)) {
+                index = (ntohl(((command_t *)buffer)->address) - dcaddr) / chunk_size;
+                if (index >= chunks) {
                     printf("Obviously bad packet, avoiding segfault\n");
                     fflush(stdout);
                 }
                 else {
-                    map[ (ntohl(((command_t *)buffer)->address) - dcaddr)/1024 ] = 1;
+                    map[index] = 1;
                     i = data + (ntohl(((command_t *)buffer)->address) - dcaddr);
 
                     memcpy(i, buffer + 12, ntohl(((command_t *)buffer)->size));
@@ -112,32 +299,40 @@ static int recv_data(void *data, unsigned int dcaddr, unsigned int total, unsign
         }
     }
 
-    for(c = 0; c < (total+1023)/1024; c++) {
+    for(c = 0; c < chunks; c++) {
         if (!map[c]) {
-            if ( (total - c*1024) >= 1024) {
-                send_cmd(CMD_SENDBINQ, dcaddr + c*1024, 1024, NULL, 0);
+            if ( (total - c*chunk_size) >= chunk_size) {
+                retval = send_bin_command(CMD_SENDBINQ, dcaddr + c*chunk_size, chunk_size);
             }
             else {
-                send_cmd(CMD_SENDBINQ, dcaddr + c*1024, total - c*1024, NULL, 0);
+                retval = send_bin_command(CMD_SENDBINQ, dcaddr + c*chunk_size, total - c*chunk_size);
+            }
+
+            if (retval == -1) {
+                free(map);
+                return -1;
             }
 
             start = time_in_usec();
-            while(((retval = recv(dcsocket, (void *)buffer, 2048, 0)) == -1)&&((time_in_usec() - start) < PACKET_TIMEOUT));
+            retval = recv_reply_until(buffer, start, PACKET_TIMEOUT);
 
             if (retval > 0) {
                 start = time_in_usec();
 
                 if (memcmp(((command_t *)buffer)->id, CMD_DONEBIN, 4)) {
-                    map[ (ntohl(((command_t *)buffer)->address) - dcaddr)/1024 ] = 1;
-                    /* printf("recv_data: got chunk for %p, %d bytes\n",
-                    (void *)ntohl(((command_t *)buffer)->address), ntohl(((command_t *)buffer)->size)); */
-                    i = data + (ntohl(((command_t *)buffer)->address) - dcaddr);
-
-                    memcpy(i, buffer + 12, ntohl(((command_t *)buffer)->size));
+                    index = (ntohl(((command_t *)buffer)->address) - dcaddr) / chunk_size;
+                    if (index < chunks) {
+                        map[index] = 1;
+                        /* printf("recv_data: got chunk for %p, %d bytes\n",
+                        (void *)ntohl(((command_t *)buffer)->address), ntohl(((command_t *)buffer)->size)); */
+                        i = data + (ntohl(((command_t *)buffer)->address) - dcaddr);
+
+                        memcpy(i, buffer + 12, ntohl(((command_t *)buffer)->size));
+                    }
                 }
 
                 // Get the DONEBIN
-                while(((retval = recv(dcsocket, (void *)buffer, 2048, 0)) == -1)&&((time_in_usec() - start) < PACKET_TIMEOUT));
+                retval = recv_reply_until(buffer, start, PACKET_TIMEOUT);
             }
 
             // Force us to go back and recheck
@@ -151,6 +346,52 @@ static int recv_data(void *data, unsigned int dcaddr, unsigned int total, unsign
     return 0;
 }
 
+int ip_xprt_hash_data(unsigned dcaddr, size_t len, unsigned chunk, unsigned int *hashes)
+{
+    unsigned char buffer[2048];
+    command_t *reply = (command_t *)buffer;
+    unsigned int request = IP_XPRT_HASH_MAX * chunk;
+    unsigned int size, n, i;
+    unsigned int chunk_be = htonl(chunk);
+    unsigned int tmp;
+    int reply_len;
+
+    if (!negotiated)
+        negotiate();
+
+    if (!(target_caps & DCLOAD_CAP_HASH))
+        return 1;
+
+    while (len) {
+        size = (len > request) ? request : len;
+        n = (size + chunk - 1) / chunk;
+
+        /* skip replies to earlier attempts, which are for other addresses */
+        for (;;) {
+            send_cmd(CMD_HASH, dcaddr, size, (unsigned char *)&chunk_be, 4);
+
+            while ((reply_len = recv_reply(buffer, PACKET_TIMEOUT)) != -1)
+                if (!memcmp(reply->id, CMD_HASH, 4) && ntohl(reply->address) == dcaddr &&
+                    reply_len == COMMAND_LEN + n * 4)
+                    break;
+
+            if (reply_len != -1)
+                break;
+        }
+
+        for (i = 0; i < n; i++) {
+            memcpy(&tmp, reply->data + i * 4, 4);
+            hashes[i] = ntohl(tmp);
+        }
+
+        hashes += n;
+        dcaddr += size;
+        len -= size;
+    }
+
+    return 0;
+}
+
 int ip_xprt_recv_data(unsigned dcaddr, size_t len, void * dst)
 {
     return recv_data(dst, dcaddr, len, 0);
@@ -161,104 +402,684 @@ int ip_xprt_recv_data_quiet(unsigned dcaddr, size_t len, void * dst)
     return recv_data(dst, dcaddr, len, 1 /* quiet */);
 }
 
+/* Adaptive send rate control.
+ *
+ * PARTBIN packets are paced to send_rate bytes per second. After each window
+ * of data the target is asked (with DONEBIN) which chunks are still missing.
+ * A window that needed repairs, or whose DONEBIN round trip took much longer
+ * than the fastest one seen so far, cuts the rate by a quarter; a clean window
+ * raises it by RATE_STEP (AIMD). The rate is remembered per target IP in
+ * RATE_CACHE_FILE so that the next run starts where this one left off.
+ */
+#define RATE_DEFAULT    (2048 * 1024)
+#define RATE_MIN        (64 * 1024)
+#define RATE_MAX        (12 * 1024 * 1024)
+#define RATE_STEP       (128 * 1024)
+#define RATE_RTT_SLACK  1000 /* usec */
+#define RATE_MIN_CHUNKS 16 /* windows smaller than this don't adjust the rate */
+
+#define PACING_BURST    15 /* packets sent back to back between pacing waits */
+#define WINDOW_SIZE     (256 * 1024)
+
+/* windows must end on a chunk boundary, as the target maps whole chunks */
+#define WINDOW_BYTES    (WINDOW_SIZE / chunk_size * chunk_size)
+
+#define RATE_CACHE_FILE ".dc-tool-rates"
+
+static unsigned int send_rate = RATE_DEFAULT;
+static unsigned int min_rtt = 0;
+static int rate_changed = 0;
+static char target_addr[16];
+
+static void rate_update(unsigned int chunks, unsigned int lost, unsigned int rtt)
+{
+    if (chunks < RATE_MIN_CHUNKS)
+        return;
+
+    if (!min_rtt || rtt < min_rtt)
+        min_rtt = rtt;
+
+    if (lost || rtt > 2 * min_rtt + RATE_RTT_SLACK)
+        send_rate -= send_rate / 4;
+    else
+        send_rate += RATE_STEP;
+
+    if (send_rate < RATE_MIN)
+        send_rate = RATE_MIN;
+    if (send_rate > RATE_MAX)
+        send_rate = RATE_MAX;
+
+    rate_changed = 1;
+}
+
+/* wait until sending bytes since start no longer exceeds send_rate */
+static void rate_pace(unsigned int start, unsigned int bytes)
+{
+    unsigned int due = (unsigned long long)bytes * 1000000 / send_rate;
+
+    sleep_until(start, due);
+}
+
+static char *rate_cache_path(void)
+{
+    const char *home = getenv("HOME");
+    char *path;
+
+    if (!home)
+        return NULL;
+
+    path = malloc(strlen(home) + strlen(RATE_CACHE_FILE) + 2);
+    sprintf(path, "%s/%s", home, RATE_CACHE_FILE);
+    return path;
+}
+
+static void rate_cache_load(void)
+{
+    char *path = rate_cache_path();
+    char addr[16];
+    unsigned int rate;
+    FILE *f;
+
+    if (!path)
+        return;
+
+    if ((f = fopen(path, "r"))) {
+        while (fscanf(f, "%15s %u", addr, &rate) == 2) {
+            if (!strcmp(addr, target_addr) && rate >= RATE_MIN && rate <= RATE_MAX)
+                send_rate = rate;
+        }
+        fclose(f);
+    }
+
+    free(path);
+}
+
+static void rate_cache_save(void)
+{
+    char *path = rate_cache_path();
+    char addr[16];
+    unsigned int rate;
+    char *lines = NULL, *more;
+    size_t len = 0;
+    FILE *f;
+
+    if (!path)
+        return;
+
+    /* keep the entries for every other target */
+    if ((f = fopen(path, "r"))) {
+        while (fscanf(f, "%15s %u", addr, &rate) == 2) {
+            if (!strcmp(addr, target_addr))
+                continue;
+            /* rather than lose the other targets' rates, save nothing */
+            if (!(more = realloc(lines, len + 32))) {
+                fclose(f);
+                free(lines);
+                free(path);
+                return;
+            }
+            lines = more;
+            len += sprintf(lines + len, "%s %u\n", addr, rate);
+        }
+        fclose(f);
+    }
+
+    if ((f = fopen(path, "w"))) {
+        if (lines)
+            fputs(lines, f);
+        fprintf(f, "%s %u\n", target_addr, send_rate);
+        fclose(f);
+    }
+
+    free(lines);
+    free(path);
+}
+
+/* send DONEBIN until the target answers it, returning the reply length, or
+ * -1 if it can't be sent */
+static int send_donebin(unsigned char *buffer)
+{
+    int len;
+
+    for (;;) {
+        do {
+            if (ip_xprt_send_command(CMD_DONEBIN, 0, 0, NULL, 0) == -1)
+                return -1;
+        } while ((len = recv_reply(buffer, PACKET_TIMEOUT)) == -1);
+
+        if (!memcmp(((command_t *)buffer)->id, CMD_DONEBIN, 4))
+            return len;
+
+        printf("send_data: error in response to CMD_DONEBIN, retrying...\n");
+    }
+}
+
+/* PARTBIN burst queue.
+ *
+ * Upload and repair bursts queue their PARTBINs here rather than going
+ * through ip_xprt_send_command(). Each queued packet is a command header plus
+ * an iovec pointing straight into the caller's image, so the data is never
+ * copied, and a full queue goes out in a single sendmmsg() on Linux (or a
+ * sendmsg() per packet elsewhere). The same descriptors are reused for every
+ * burst, retransmits included. MinGW has no sendmsg, so there each packet is
+ * still assembled by ip_xprt_send_command().
+ *
+ * When the target accepts PARTBINZ, chunks that lzo shrinks are sent
+ * compressed, with the uncompressed length in the size field.
+ */
+#define BURST_MAX PACING_BURST
+
+static unsigned char burst_header[BURST_MAX][COMMAND_LEN];
+static unsigned char *burst_data[BURST_MAX];
+static unsigned int burst_len[BURST_MAX];
+static int burst_count = 0;
+
+#ifndef __MINGW32__
+static struct iovec burst_iov[BURST_MAX][2];
+#ifdef __linux__
+static struct mmsghdr burst_msg[BURST_MAX];
+#else
+static struct msghdr burst_msg[BURST_MAX];
+#endif
+#endif
+
+static int partbin_flush(void)
+{
+    int i, j, sent;
+
+    if (!burst_count)
+        return 0;
+
+#ifdef __MINGW32__
+    for (i = 0; i < burst_count; i++) {
+        unsigned int addr, size;
+
+        memcpy(&addr, burst_header[i] + 4, 4);
+        memcpy(&size, burst_header[i] + 8, 4);
+        if (ip_xprt_send_command((char *)burst_header[i], ntohl(addr), ntohl(size), burst_data[i], burst_len[i]) == -1)
+            return -1;
+    }
+    sent = burst_count;
+#else
+    for (i = 0; i < burst_count; i++) {
+        burst_iov[i][0].iov_base = burst_header[i];
+        burst_iov[i][0].iov_len = COMMAND_LEN;
+        burst_iov[i][1].iov_base = burst_data[i];
+        burst_iov[i][1].iov_len = burst_len[i];
+    }
+
+    for (i = 0; i < burst_count; i += sent) {
+#ifdef __linux__
+        sent = sendmmsg(dcsocket, burst_msg + i, burst_count - i, 0);
+#else
+        sent = (sendmsg(dcsocket, burst_msg + i, 0) == -1) ? -1 : 1;
+#endif
+        if (sent == -1) {
+            /* a full socket buffer just loses the rest of the burst, which
+             * the DONEBIN repair pass will resend */
+            if (errno == EAGAIN)
+                break;
+            fprintf(stderr, "error: %s\n", strerror(errno));
+            burst_count = 0;
+            return -1;
+        }
+
+        for (j = i; j < i + sent; j++)
+            dc_syscall_count(0, COMMAND_LEN + burst_len[j]);
+    }
+#endif
+
+    burst_count = 0;
+    return 0;
+}
+
+/* queue a command of len bytes at data for dcaddr, flushing a full queue */
+static int partbin_queue(const char *command, unsigned int dcaddr, unsigned int size, unsigned char *data, unsigned int len)
+{
+    unsigned int tmp;
+
+    memcpy(burst_header[burst_count], command, 4);
+    tmp = htonl(dcaddr);
+    memcpy(burst_header[burst_count] + 4, &tmp, 4);
+    tmp = htonl(size);
+    memcpy(burst_header[burst_count] + 8, &tmp, 4);
+    burst_data[burst_count] = data;
+    burst_len[burst_count] = len;
+
+    if (++burst_count == BURST_MAX)
+        return partbin_flush();
+
+    return 0;
+}
+
+/* A transfer is a list of segments, streamed one after another. Each one
+ * starts on a fresh chunk, as that is how dcload-ip maps them.
+ */
+typedef struct {
+    unsigned char *data;
+    unsigned int dcaddr;
+    unsigned int size;
+    unsigned int stream; /* offset of the segment in the stream */
+} segment_t;
+
+static segment_t *segments = NULL;
+static unsigned int nsegments = 0;
+static segment_t *compress_seg = NULL; /* the segment being compressed */
+
+static void segments_set(unsigned int count)
+{
+    segments = realloc(segments, (count ? count : 1) * sizeof(segment_t));
+    nsegments = 0;
+}
+
+static void segment_add(unsigned char *data, unsigned int dcaddr, unsigned int size)
+{
+    segment_t *seg = &segments[nsegments];
+
+    seg->data = data;
+    seg->dcaddr = dcaddr;
+    seg->size = size;
+    seg->stream = 0;
+    if (nsegments)
+        seg->stream = (seg[-1].stream + seg[-1].size + chunk_size - 1) / chunk_size * chunk_size;
+    nsegments++;
+}
+
+static segment_t *segment_find(unsigned int dcaddr)
+{
+    unsigned int i;
+
+    for (i = 0; i < nsegments; i++)
+        if (dcaddr - segments[i].dcaddr < segments[i].size)
+            return &segments[i];
+
+    return NULL;
+}
+
+/* queue the len byte chunk at offset in seg, compressed if that pays, and
+ * return the number of bytes it puts on the wire */
+static int partbin_chunk(segment_t *seg, unsigned int offset, unsigned int len)
+{
+    unsigned char *packed;
+    unsigned int packed_len = 0;
+
+    if (seg == compress_seg && !(offset % chunk_size))
+        packed_len = ip_compress_chunk(offset / chunk_size, &packed);
+
+    if (packed_len) {
+        if (partbin_queue(CMD_PARTBINZ, seg->dcaddr + offset, len, packed, packed_len) == -1)
+            return -1;
+        return packed_len;
+    }
+
+    if (partbin_queue(CMD_PARTBIN, seg->dcaddr + offset, len, seg->data + offset, len) == -1)
+        return -1;
+    return len;
+}
+
+static void partbin_init(void)
+{
+#ifndef __MINGW32__
+    int i;
+
+    for (i = 0; i < BURST_MAX; i++) {
+#ifdef __linux__
+        burst_msg[i].msg_hdr.msg_iov = burst_iov[i];
+        burst_msg[i].msg_hdr.msg_iovlen = 2;
+#else
+        burst_msg[i].msg_iov = burst_iov[i];
+        burst_msg[i].msg_iovlen = 2;
+#endif
+    }
+#endif
+}
+
+/* resend every chunk the target is missing before stream offset end. The
+ * number of resent chunks is returned in lost, and the round trip time of the
+ * first DONEBIN in rtt.
+ *
+ * Newer dcload-ip lists all the missing ranges after the DONEBIN header, so
+ * they can all be resent in a single burst. Older versions only report the
+ * first missing chunk in the header itself.
+ */
+static int repair_data(unsigned int end, unsigned int *lost, unsigned int *rtt)
+{
+    unsigned char buffer[2048];
+    command_t *reply = (command_t *)buffer;
+    donebin_range_t *ranges;
+    segment_t *seg;
+    unsigned int nranges, r, found;
+    unsigned int start, count;
+    unsigned int hole, hole_end, len, sent;
+    int reply_len, wire;
+
+    *lost = 0;
+
+    start = time_in_usec();
+    if ((reply_len = send_donebin(buffer)) == -1)
+        return -1;
+    *rtt = time_in_usec() - start;
+
+    for (;;) {
+        if (reply_len > COMMAND_LEN) {
+            ranges = (donebin_range_t *)reply->data;
+            nranges = (reply_len - COMMAND_LEN) / sizeof(donebin_range_t);
+        } else {
+            ranges = (donebin_range_t *)&reply->address;
+            nranges = ntohl(reply->size) ? 1 : 0;
+        }
+
+        start = time_in_usec();
+        sent = 0;
+        count = 0;
+        found = 0;
+
+        /* the ranges come in stream order */
+        for (r = 0; r < nranges; r++) {
+            hole = ntohl(ranges[r].address);
+            hole_end = hole + ntohl(ranges[r].size);
+
+            if (!(seg = segment_find(hole)))
+                continue;
+            if (seg->stream + (hole - seg->dcaddr) >= end)
+                break;
+            if (hole_end > seg->dcaddr + seg->size)
+                hole_end = seg->dcaddr + seg->size;
+            if (seg->stream + (hole_end - seg->dcaddr) > end)
+                hole_end = seg->dcaddr + (end - seg->stream);
+            found++;
+
+            /* printf("%d bytes at 0x%x were missing, resending\n", hole_end - hole, hole); */
+            for (; hole < hole_end; hole += len) {
+                len = (hole_end - hole >= chunk_size) ? chunk_size : hole_end - hole;
+                if ((wire = partbin_chunk(seg, hole - seg->dcaddr, len)) == -1)
+                    return -1;
+                sent += wire;
+                (*lost)++;
+
+                if (++count == PACING_BURST) {
+                    rate_pace(start, sent);
+                    count = 0;
+                }
+            }
+        }
+
+        if (partbin_flush() == -1)
+            return -1;
+
+        if (!found)
+            break;
+
+        if ((reply_len = send_donebin(buffer)) == -1)
+            return -1;
+    }
+
+    return 0;
+}
+
+/* bytes sent in streams that lzo had a go at, and how many of them went on
+ * the wire for the first attempt */
+static unsigned int packed_total = 0;
+static unsigned int packed_sent = 0;
+
+/* send every segment in paced windows, repairing each one */
+static int send_stream(void)
+{
+    segment_t *seg;
+    unsigned int s, offset, len, pos, total;
+    unsigned int window = 0, sent = 0, packed = 0;
+    unsigned int start, lost, rtt;
+    int count = 0, wire, compressed = 0;
+
+    if (!nsegments)
+        return repair_data(0, &lost, &rtt);
+
+    total = segments[nsegments - 1].stream + segments[nsegments - 1].size;
+
+    /* pace in bursts to give the DC a chance to empty its rx fifo */
+    start = time_in_usec();
+
+    for (s = 0; s < nsegments; s++) {
+        seg = &segments[s];
+
+        /* compressed at most the window being sent and the next one ahead.
+         * Anything under a window, like most syscall replies, isn't worth
+         * starting the compression threads for. */
+        if ((target_caps & DCLOAD_CAP_LZO) && seg->size >= WINDOW_BYTES
+            && ip_compress_start(seg->data, seg->size, chunk_size, 2 * WINDOW_BYTES / chunk_size) == 0) {
+            compress_seg = seg;
+            compressed = 1;
+        }
+
+        for (offset = 0; offset < seg->size; offset += len) {
+            len = (seg->size - offset >= chunk_size) ? chunk_size : seg->size - offset;
+            if ((wire = partbin_chunk(seg, offset, len)) == -1)
+                goto fail;
+            sent += wire;
+
+            if (++count == PACING_BURST) {
+                rate_pace(start, sent);
+                count = 0;
+            }
+
+            pos = seg->stream + offset + len;
+            if (pos - window < WINDOW_BYTES && pos != total)
+                continue;
+
+            if (partbin_flush() == -1)
+                goto fail;
+            packed += sent;
+
+            if (pos == total) {
+                /* delay a bit to try to make sure all data goes out before CMD_DONEBIN */
+                sleep_until(time_in_usec(), PACKET_TIMEOUT/10);
+            }
+
+            if (repair_data(pos, &lost, &rtt) == -1)
+                goto fail;
+
+            rate_update((pos - window + chunk_size - 1) / chunk_size, lost, rtt);
+
+            window = (pos + chunk_size - 1) / chunk_size * chunk_size;
+            if (compress_seg && window > seg->stream)
+                ip_compress_release((window - seg->stream) / chunk_size);
+            start = time_in_usec();
+            sent = 0;
+            count = 0;
+        }
+
+        /* queued PARTBINZs point into the compressed chunks */
+        if (compress_seg) {
+            if (partbin_flush() == -1)
+                goto fail;
+            ip_compress_stop();
+            compress_seg = NULL;
+        }
+    }
+
+    if (compressed) {
+        packed_total += total;
+        packed_sent += packed;
+    }
+
+    return 0;
+
+fail:
+    burst_count = 0;
+    if (compress_seg) {
+        ip_compress_stop();
+        compress_seg = NULL;
+    }
+
+    return -1;
+}
+
 /* send size bytes to dc from addr to dcaddr*/
 static int send_data(unsigned char * addr, unsigned int dcaddr, unsigned int size)
 {
     unsigned char buffer[2048] = {0};
-    unsigned char * i = 0;
-    unsigned int a = dcaddr;
-    unsigned int start = 0;
-    int count = 0;
 
     if (!size)
 	    return -1;
 
+    if (!negotiated)
+        negotiate();
+
     do {
-	    send_cmd(CMD_LOADBIN, dcaddr, size, NULL, 0);
-    } while(recv_response(buffer, PACKET_TIMEOUT) == -1);
+        if (send_bin_command(CMD_LOADBIN, dcaddr, size) == -1)
+            return -1;
+    } while(recv_reply(buffer, PACKET_TIMEOUT) == -1);
 
     while(memcmp(((command_t *)buffer)->id, CMD_LOADBIN, 4)) {
         printf("send_data: error in response to CMD_LOADBIN, retrying... %c%c%c%c\n",buffer[0],buffer[1],buffer[2],buffer[3]);
         do {
-            send_cmd(CMD_LOADBIN, dcaddr, size, NULL, 0);
-        } while (recv_response(buffer, PACKET_TIMEOUT) == -1);
+            if (send_bin_command(CMD_LOADBIN, dcaddr, size) == -1)
+                return -1;
+        } while (recv_reply(buffer, PACKET_TIMEOUT) == -1);
     }
 
-    for(i = addr; i < addr + size; i += 1024) {
-        if ((addr + size - i) >= 1024) {
-            send_cmd(CMD_PARTBIN, dcaddr, 1024, i, 1024);
-        }
-        else {
-            send_cmd(CMD_PARTBIN, dcaddr, (addr + size) - i, i, (addr + size) - i);
-        }
-        dcaddr += 1024;
+    segments_set(1);
+    segment_add(addr, dcaddr, size);
 
-        /* give the DC a chance to empty its rx fifo
-        * this increases transfer rate on 100mbit by about 3.4x
-        */
-        count++;
-        if (count == 15) {
-            start = time_in_usec();
-            while ((time_in_usec() - start) < PACKET_TIMEOUT/51);
-            count = 0;
-	    }
-    }
+    return send_stream();
+}
 
-    start = time_in_usec();
-    /* delay a bit to try to make sure all data goes out before CMD_DONEBIN */
-    while ((time_in_usec() - start) < PACKET_TIMEOUT/10);
+int ip_xprt_send_data(void *data, size_t len, unsigned dcaddr)
+{
+    return send_data(data, dcaddr, len);
+}
 
-    do {
-	    send_cmd(CMD_DONEBIN, 0, 0, NULL, 0);
-    } while (recv_response(buffer, PACKET_TIMEOUT) == -1);
+/* Answer a syscall with retval, after putting len bytes of data at dcaddr.
+ * If the target takes CMD_RETVALD and the data fits a chunk, both go in one
+ * packet; otherwise the data goes the long way first, and if it can't be sent
+ * no RETV follows and -1 is returned.
+ */
+int ip_xprt_send_retval(unsigned int retval, void *data, size_t len, unsigned dcaddr)
+{
+    if (!negotiated)
+        negotiate();
 
-    while(memcmp(((command_t *)buffer)->id, CMD_DONEBIN, 4)) {
-        printf("send_data: error in response to CMD_DONEBIN, retrying...\n");
+    if (len && (target_caps & DCLOAD_CAP_RETD) && len <= chunk_size)
+        return ip_xprt_send_command(CMD_RETVALD, retval, dcaddr, (unsigned char *)data, len);
 
-        do {
-            send_cmd(CMD_LOADBIN, dcaddr, size, NULL, 0);
-        } while (recv_response(buffer, PACKET_TIMEOUT) == -1);
+    if (len && send_data(data, dcaddr, len) == -1)
+        return -1;
+
+    return ip_xprt_send_command(CMD_RETVAL, retval, retval, NULL, 0);
+}
+
+/* the flags of EXECUTE or a launching LOADBINM */
+static unsigned int exec_flags(unsigned console, unsigned cdfsredir)
+{
+    return (console ? DCLOAD_EXEC_CONSOLE : 0) |
+        (cdfsredir ? DCLOAD_EXEC_CDFSREDIR | DCLOAD_EXEC_CDFSTOC : 0);
+}
+
+/* Send every segment in one transfer: a LOADBINM with the whole manifest,
+ * one stream of chunks and a single completion phase. If execute is set,
+ * dcload-ip starts the program itself when the final DONEBIN finds nothing
+ * missing, which saves the EXECUTE round trip.
+ */
+int ip_xprt_send_segments(xprt_segment_t *segs, unsigned count, int execute, unsigned entry, unsigned console, unsigned cdfsredir)
+{
+    unsigned char buffer[2048];
+    unsigned int manifest[2 + 2 * IP_XPRT_MAX_SEGMENTS];
+    unsigned int i, chunks = 0;
+
+    if (!negotiated)
+        negotiate();
+
+    if (!(target_caps & DCLOAD_CAP_MANIFEST) || count > IP_XPRT_MAX_SEGMENTS)
+        return 1;
+
+    if (execute && !entry)
+        return 1;
+
+    manifest[0] = htonl(chunk_size);
+    manifest[1] = htonl(count);
+    for (i = 0; i < count; i++) {
+        manifest[2 + i * 2] = htonl(segs[i].dcaddr);
+        manifest[3 + i * 2] = htonl(segs[i].len);
+        chunks += (segs[i].len + chunk_size - 1) / chunk_size;
     }
 
-    while ( ntohl(((command_t *)buffer)->size) != 0) {
-    /*	printf("%d bytes at 0x%x were missing, resending\n", ntohl(((command_t *)buffer)->size),ntohl(((command_t *)buffer)->address)); */
-        send_cmd(CMD_PARTBIN, ntohl(((command_t *)buffer)->address), ntohl(((command_t *)buffer)->size), addr + (ntohl(((command_t *)buffer)->address) - a), ntohl(((command_t *)buffer)->size));
+    if (chunks > IP_XPRT_MAP_CHUNKS)
+        return 1;
 
+    for (;;) {
         do {
-            send_cmd(CMD_DONEBIN, 0, 0, NULL, 0);
-        } while (recv_response(buffer, PACKET_TIMEOUT) == -1);
+            send_cmd(CMD_LOADBINM, execute ? entry : 0, exec_flags(console, cdfsredir),
+                     (unsigned char *)manifest, (2 + count * 2) * 4);
+        } while (recv_reply(buffer, PACKET_TIMEOUT) == -1);
 
-        while(memcmp(((command_t *)buffer)->id, CMD_DONEBIN, 4)) {
-            printf("send_data: error in response to CMD_DONEBIN, retrying...\n");
+        if (!memcmp(((command_t *)buffer)->id, CMD_LOADBINM, 4))
+            break;
 
-            do {
-                send_cmd(CMD_LOADBIN, dcaddr, size, NULL, 0);
-            } while (recv_response(buffer, PACKET_TIMEOUT) == -1);
-        }
+        printf("send_segments: error in response to CMD_LOADBINM, retrying...\n");
     }
 
-    return 0;
+    segments_set(count);
+    for (i = 0; i < count; i++)
+        segment_add(segs[i].data, segs[i].dcaddr, segs[i].len);
+
+    return send_stream();
 }
 
-int ip_xprt_send_data(void *data, size_t len, unsigned dcaddr)
+void ip_xprt_packed(unsigned int *total, unsigned int *packed)
 {
-    return send_data(data, dcaddr, len);
+    *total = packed_total;
+    *packed = packed_sent;
 }
 
-static int recv_response(unsigned char *buffer, int timeout)
+int ip_xprt_fill_data(unsigned dcaddr, size_t len, unsigned char value)
 {
-    int start = time_in_usec();
-    int rv = -1;
+    unsigned char buffer[2048];
+
+    if (!negotiated)
+        negotiate();
+
+    if (!(target_caps & DCLOAD_CAP_FILL))
+        return 1;
 
-    while(((time_in_usec() - start) < timeout) && (rv == -1))
-	    rv = recv(dcsocket, (void *)buffer, 2048, 0);
+    /* FILL is answered with an echo, and is safe to repeat */
+    for (;;) {
+        do {
+            send_cmd(CMD_FILL, dcaddr, len, &value, 1);
+        } while (recv_reply(buffer, PACKET_TIMEOUT) == -1);
+
+        if (!memcmp(((command_t *)buffer)->id, CMD_FILL, 4))
+            return 0;
+
+        printf("fill_data: error in response to CMD_FILL, retrying...\n");
+    }
+}
 
-    return rv;
+static int recv_response(unsigned char *buffer, int timeout)
+{
+    return recv_until(buffer, time_in_usec(), timeout);
 }
 
+/* when the last packet ip_xprt_recv_packet returned arrived, which for a
+ * held request is when it was held */
+static unsigned long long packet_arrived = 0;
+
 int ip_xprt_recv_packet(unsigned char *buffer, int timeout)
 {
-    return recv_response(buffer, timeout);
+    int len;
+
+    if (held_count) {
+        len = held_len[held_first];
+        memcpy(buffer, held[held_first], len);
+        packet_arrived = held_at[held_first];
+        held_first = (held_first + 1) % HELD_MAX;
+        held_count--;
+        return len;
+    }
+
+    if ((len = recv_response(buffer, timeout)) != -1)
+        packet_arrived = dc_syscall_now();
+
+    return len;
 }
 
 int ip_xprt_send_command(const char *command, unsigned int addr, unsigned int size, unsigned char *data, unsigned int dsize)
@@ -276,6 +1097,8 @@ int ip_xprt_send_command(const char *command, unsigned int addr, unsigned int si
 	memcpy(c_buff + 12, data, dsize);
 
     error = send(dcsocket, (void *)c_buff, 12+dsize, 0);
+    if (error > 0)
+        dc_syscall_count(0, error);
 
     if(error == -1) {
 #ifndef __MINGW32__
@@ -324,6 +1147,7 @@ static int open_socket(const char *hostname)
     }
 
     memcpy((char *)&sin.sin_addr, host->h_addr, host->h_length);
+    strncpy(target_addr, inet_ntoa(sin.sin_addr), sizeof(target_addr) - 1);
 
     if (connect(dcsocket, (struct sockaddr *)&sin, sizeof(sin)) < 0) {
         log_error("connect");
@@ -347,11 +1171,21 @@ static int open_socket(const char *hostname)
 
 int ip_xprt_initialize(const char *hostname)
 {
-    return open_socket(hostname);
+    if (open_socket(hostname) < 0)
+        return -1;
+
+    rate_cache_load();
+    partbin_init();
+    return 0;
 }
 
 void ip_xprt_cleanup(void)
 {
+    if (rate_changed) {
+        printf("Send rate settled at %u KB/s\n", send_rate / 1024);
+        rate_cache_save();
+    }
+
 #ifndef __MINGW32__
     close(dcsocket);
 #else
@@ -360,63 +1194,38 @@ void ip_xprt_cleanup(void)
 }
 
 
-#define CatchError(x) if(x) return -1;
+/* how long the dispatcher sleeps in poll at a time; it wakes as soon as a
+ * packet arrives either way */
+#define DISPATCH_WAIT 1000000
+
+/* length of the request being dispatched */
+static int request_len = 0;
+
+int ip_xprt_request_len(void)
+{
+    return request_len;
+}
 
-int ip_xprt_dispatch_commands(int isofd)
+int ip_xprt_dispatch_commands(disc_image_t *disc)
 {
     unsigned char buffer[2048];
-    struct timespec time = {.tv_sec = 0, .tv_nsec = 500000000};
+    unsigned int opcode;
+    int len;
 
-    while (ip_xprt_recv_packet(buffer, IP_XPRT_PACKET_TIMEOUT) == -1) {
-        nanosleep(&time, NULL);
-    }
+    while ((len = ip_xprt_recv_packet(buffer, DISPATCH_WAIT)) == -1)
+        dc_syscall_poll();
 
-    if (!(memcmp(buffer, CMD_EXIT, 4)))
-        return 1;
-    if (!(memcmp(buffer, CMD_FSTAT, 4)))
-        CatchError(ip_xprt_system_calls.fstat(buffer));
-    if (!(memcmp(buffer, CMD_WRITE, 4)))
-        CatchError(ip_xprt_system_calls.write(buffer));
-    if (!(memcmp(buffer, CMD_READ, 4)))
-        CatchError(ip_xprt_system_calls.read(buffer));
-    if (!(memcmp(buffer, CMD_OPEN, 4)))
-        CatchError(ip_xprt_system_calls.open(buffer));
-    if (!(memcmp(buffer, CMD_CLOSE, 4)))
-        CatchError(ip_xprt_system_calls.close(buffer));
-    if (!(memcmp(buffer, CMD_CREAT, 4)))
-        CatchError(ip_xprt_system_calls.create(buffer));
-    if (!(memcmp(buffer, CMD_LINK, 4)))
-        CatchError(ip_xprt_system_calls.link(buffer));
-    if (!(memcmp(buffer, CMD_UNLINK, 4)))
-        CatchError(ip_xprt_system_calls.unlink(buffer));
-    if (!(memcmp(buffer, CMD_CHDIR, 4)))
-        CatchError(ip_xprt_system_calls.chdir(buffer));
-    if (!(memcmp(buffer, CMD_CHMOD, 4)))
-        CatchError(ip_xprt_system_calls.chmod(buffer));
-    if (!(memcmp(buffer, CMD_LSEEK, 4)))
-        CatchError(ip_xprt_system_calls.lseek(buffer));
-    if (!(memcmp(buffer, CMD_TIME, 4)))
-        CatchError(ip_xprt_system_calls.time(buffer));
-    if (!(memcmp(buffer, CMD_STAT, 4)))
-        CatchError(ip_xprt_system_calls.stat(buffer));
-    if (!(memcmp(buffer, CMD_UTIME, 4)))
-        CatchError(ip_xprt_system_calls.utime(buffer));
-    if (!(memcmp(buffer, CMD_BAD, 4)))
-        fprintf(stderr, "command 15 should not happen... (but it did)\n");
-    if (!(memcmp(buffer, CMD_OPENDIR, 4)))
-        CatchError(ip_xprt_system_calls.opendir(buffer));
-    if (!(memcmp(buffer, CMD_CLOSEDIR, 4)))
-        CatchError(ip_xprt_system_calls.closedir(buffer));
-    if (!(memcmp(buffer, CMD_READDIR, 4)))
-        CatchError(ip_xprt_system_calls.readdir(buffer));
-    if (!(memcmp(buffer, CMD_CDFSREAD, 4)))
-        CatchError(ip_xprt_system_calls.cdfs_redir_read_sectors(isofd, buffer));
-    if (!(memcmp(buffer, CMD_GDBPACKET, 4)))
-        CatchError(ip_xprt_system_calls.gdbpacket(buffer));
-    if(!(memcmp(buffer, CMD_REWINDDIR, 4)))
-        CatchError(ip_xprt_system_calls.rewinddir(buffer));
+    request_len = len;
 
-    return 0;
+    /* syscalls are "DCnn" (or "DDnn" for write), where nn is the syscall
+     * number */
+    if (buffer[0] != 'D' || (buffer[1] != 'C' && buffer[1] != 'D') ||
+        buffer[2] < '0' || buffer[2] > '9' || buffer[3] < '0' || buffer[3] > '9')
+        return 0;
+
+    opcode = (buffer[2] - '0') * 10 + (buffer[3] - '0');
+
+    return dc_syscall_dispatch(&ip_xprt_system_calls, opcode, disc, buffer, len, packet_arrived);
 }
 
 int ip_xprt_execute(unsigned dcaddr, unsigned console, unsigned cdfsredir)
@@ -426,7 +1235,7 @@ int ip_xprt_execute(unsigned dcaddr, unsigned console, unsigned cdfsredir)
     printf("Sending execute command (0x%x, console=%d, cdfsredir=%d)...",dcaddr,console,cdfsredir);
 
     do {
-            if (ip_xprt_send_command(CMD_EXECUTE, dcaddr, (cdfsredir << 1) | console, NULL, 0) == -1) {
+            if (ip_xprt_send_command(CMD_EXECUTE, dcaddr, exec_flags(console, cdfsredir), NULL, 0) == -1) {
                 return -1;
             }
     } while (ip_xprt_recv_packet(buffer, IP_XPRT_PACKET_TIMEOUT) == -1);
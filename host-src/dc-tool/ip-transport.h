@@ -24,6 +24,8 @@
 
 #include <sys/types.h>
 
+#include "commands.h"
+
 struct _command_t {
 	unsigned char id[4];
 	unsigned int address;
@@ -33,20 +35,68 @@ struct _command_t {
 
 typedef struct _command_t command_t;
 
+/* A DONEBIN reply from dcload-ip carries the first missing chunk in its
+ * address and size, followed by a list of all the missing ranges.
+ */
+struct _donebin_range_t {
+	unsigned int address;
+	unsigned int size;
+} __attribute__ ((packed));
+
+typedef struct _donebin_range_t donebin_range_t;
+
 #define CMD_EXECUTE  "EXEC" /* execute */
 #define CMD_LOADBIN  "LBIN" /* begin receiving binary */
+#define CMD_LOADBINM "LBIM" /* begin receiving several segments */
 #define CMD_PARTBIN  "PBIN" /* part of a binary */
+#define CMD_PARTBINZ "PBIZ" /* part of a binary, lzo compressed */
 #define CMD_DONEBIN  "DBIN" /* end receiving binary */
 #define CMD_SENDBIN  "SBIN" /* send a binary */
 #define CMD_SENDBINQ "SBIQ" /* send a binary, quiet */
 #define CMD_VERSION  "VERS" /* send version info */
+#define CMD_FILL     "FILL" /* memset, value in the first data byte */
+#define CMD_HASH     "HASH" /* CRC-32 per chunk, chunk size in the data */
 
 #define CMD_RETVAL   "RETV" /* return value */
+#define CMD_RETVALD  "RETD" /* return value with data */
 
 #define CMD_REBOOT   "RBOT"  /* reboot */
 
 #define COMMAND_LEN  12
 
+/* PARTBIN and SENDBIN payloads are negotiated up to IP_XPRT_MAX_CHUNK, the
+ * most that fits in a 1500 byte Ethernet frame after the IP, UDP and command
+ * headers. Old dcload-ip versions always use IP_XPRT_LEGACY_CHUNK.
+ */
+#define IP_XPRT_MAX_CHUNK    1460
+#define IP_XPRT_LEGACY_CHUNK 1024
+
+/* Set in the address of a VERS reply by a dcload-ip that negotiates. The
+ * remaining bits advertise optional target features.
+ */
+#define DCLOAD_CAP_PRESENT   (1u << 31)
+#define DCLOAD_CAP_LZO       (1u << 0) /* accepts CMD_PARTBINZ */
+#define DCLOAD_CAP_FILL      (1u << 1) /* accepts CMD_FILL */
+#define DCLOAD_CAP_HASH      (1u << 2) /* accepts CMD_HASH */
+
+#define DCLOAD_CAP_MANIFEST  (1u << 3) /* accepts CMD_LOADBINM */
+#define DCLOAD_CAP_RETD      (1u << 4) /* accepts CMD_RETVALD */
+
+/* Flags in the size of CMD_EXECUTE, and of a CMD_LOADBINM that launches.
+ * Older dcload-ips redirect CDFS on any bit above console, so the TOC bit
+ * is only ever sent along with the redirection.
+ */
+#define DCLOAD_EXEC_CONSOLE   (1u << 0)
+#define DCLOAD_EXEC_CDFSREDIR (1u << 1)
+#define DCLOAD_EXEC_CDFSTOC   (1u << 2) /* we answer CMD_CDFSTOC */
+
+/* most hashes dc-tool asks for in one CMD_HASH */
+#define IP_XPRT_HASH_MAX     256
+
+/* limits of a CMD_LOADBINM transfer, set by dcload-ip's tables */
+#define IP_XPRT_MAX_SEGMENTS 64
+#define IP_XPRT_MAP_CHUNKS   16384
+
 #define CMD_EXIT     "DC00"
 #define CMD_FSTAT    "DC01"
 #define CMD_WRITE    "DD02"
@@ -69,6 +119,11 @@ typedef struct _command_t command_t;
 #define CMD_CDFSREAD "DC19"
 #define CMD_GDBPACKET "DC20"
 #define CMD_REWINDDIR "DC21"
+#define CMD_PREAD    "DC22"
+#define CMD_PREADV   "DC23"
+#define CMD_READDIRPLUS "DC24"
+#define CMD_STAGEMEM "DC25"
+#define CMD_CDFSTOC  "DC26"
 
 struct _command_3int_t {
 	unsigned char id[4];
@@ -77,6 +132,14 @@ struct _command_3int_t {
 	unsigned int value2;
 } __attribute__ ((__packed__));
 
+struct _command_4int_t {
+	unsigned char id[4];
+	unsigned int value0;
+	unsigned int value1;
+	unsigned int value2;
+	unsigned int value3;
+} __attribute__ ((__packed__));
+
 struct _command_2int_string_t {
 	unsigned char id[4];
 	unsigned int value0;
@@ -109,6 +172,7 @@ struct _command_3int_string_t {
 } __attribute__ ((__packed__));
 
 typedef struct _command_3int_t command_3int_t;
+typedef struct _command_4int_t command_4int_t;
 typedef struct _command_2int_string_t command_2int_string_t;
 typedef struct _command_int_t command_int_t;
 typedef struct _command_int_string_t command_int_string_t;
@@ -134,13 +198,24 @@ typedef struct _command_3int_string_t command_3int_string_t;
  * readdir  dir, addr, size
  * cdfsread sector, addr, size
  * gdb_packet count, size, string
+ * pread    fd, addr, size, offset
+ * preadv   fd, count, -, then count of offset, addr, size
+ * readdirplus dir, addr, size
+ * stagemem addr, size
+ * cdfstoc  area, addr, size
  */
 
 int ip_xprt_send_data(void *data, size_t len, unsigned dcaddr);
+int ip_xprt_fill_data(unsigned dcaddr, size_t len, unsigned char value);
+int ip_xprt_send_segments(xprt_segment_t *segs, unsigned count, int execute, unsigned entry, unsigned console, unsigned cdfsredir);
+int ip_xprt_hash_data(unsigned dcaddr, size_t len, unsigned chunk, unsigned int *hashes);
+void ip_xprt_packed(unsigned int *total, unsigned int *packed);
 int ip_xprt_send_command(const char *command, unsigned int addr, unsigned int size, unsigned char *data, unsigned int dsize);
+int ip_xprt_send_retval(unsigned int retval, void *data, size_t len, unsigned dcaddr);
 int ip_xprt_recv_data(unsigned dcaddr, size_t len, void * dst);
 int ip_xprt_recv_data_quiet(unsigned dcaddr, size_t len, void * dst);
-int ip_xprt_dispatch_commands(int isofd);
+int ip_xprt_dispatch_commands(disc_image_t *disc);
+int ip_xprt_request_len(void);
 int ip_xprt_execute(unsigned dcaddr, unsigned console, unsigned cdfsredir);
 
 /* 250000 = 0.25 seconds */
@@ -0,0 +1,647 @@
+/*
+ * dc-tool, a tool for use with the dcload loader
+ *
+ * Copyright (C) 2023 Andrew Kieschnick <andrewk@austin.rr.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+/* An ISO9660 image of a host directory, for CDFS redirection.
+ *
+ * When the image is opened the directory tree is walked with stat, and the
+ * image laid out: the system area, the primary volume descriptor, the path
+ * tables and every directory, which are kept in memory, followed by an
+ * extent for each file in the order the tree was walked. The files are
+ * only opened and read when the target reads their sectors, so opening the
+ * image costs a directory walk however much is in it, and each run of
+ * dc-tool sees the files as they are then.
+ *
+ * Names become level 2 identifiers: upper case, anything that isn't a
+ * letter, digit or underscore turned into an underscore, and cut to fit.
+ * KOS compares names without regard to case, so lower case names still
+ * open. Two names that come out the same keep the first.
+ *
+ * The files are opened relative to the directory, which stays open, so -c
+ * can chroot elsewhere.
+ */
+
+#include "iso-dir.h"
+#include "utils.h"
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+#define ISO_SECTOR      2048
+#define ISO_PVD         16              /* the primary volume descriptor */
+#define ISO_NAME        30              /* a file's name, dot and extension */
+#define ISO_DIR_NAME    31
+
+#define ISO_SECTORS(n)  (((n) + ISO_SECTOR - 1) / ISO_SECTOR)
+
+typedef struct iso_node {
+    char name[ISO_DIR_NAME + 3];    /* as on the disc, with ;1 for files */
+    char *path;                     /* relative to the top directory */
+    int dir;
+    unsigned int size;              /* of the file, or the directory's records */
+    unsigned int lba;
+    time_t mtime;
+    struct iso_node *parent;
+    struct iso_node **children;
+    unsigned int nchildren;
+    unsigned int number;            /* a directory's, in the path tables */
+} iso_node_t;
+
+struct iso_dir {
+    char *top;
+    int top_fd;
+    iso_node_t *root;
+    iso_node_t **dirs;              /* in path table order */
+    unsigned int ndirs;
+    iso_node_t **files;             /* by extent */
+    unsigned int nfiles;
+    unsigned char *meta;            /* everything before the first file */
+    unsigned int meta_sectors;
+    unsigned int sectors;
+    iso_node_t *open;               /* the file fd is open on */
+    int fd;
+};
+
+static void put_le16(unsigned char *p, unsigned int v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static void put_be16(unsigned char *p, unsigned int v)
+{
+    p[0] = v >> 8;
+    p[1] = v;
+}
+
+static void put_le32(unsigned char *p, unsigned int v)
+{
+    put_le16(p, v);
+    put_le16(p + 2, v >> 16);
+}
+
+static void put_be32(unsigned char *p, unsigned int v)
+{
+    put_be16(p, v >> 16);
+    put_be16(p + 2, v);
+}
+
+/* the "both byte orders" fields */
+static void put_both16(unsigned char *p, unsigned int v)
+{
+    put_le16(p, v);
+    put_be16(p + 2, v);
+}
+
+static void put_both32(unsigned char *p, unsigned int v)
+{
+    put_le32(p, v);
+    put_be32(p + 4, v);
+}
+
+/* name as a level 2 identifier */
+static void iso_name(const char *name, int dir, char *out)
+{
+    const char *dot = dir ? NULL : strrchr(name, '.');
+    size_t base, ext = 0, i, n = 0;
+
+    base = dot ? (size_t)(dot - name) : strlen(name);
+    if (dot)
+        ext = strlen(dot + 1);
+
+    /* the extension keeps up to 8 characters, the rest goes to the name */
+    if (dir) {
+        if (base > ISO_DIR_NAME)
+            base = ISO_DIR_NAME;
+    } else {
+        if (ext > 8 && base + 1 + ext > ISO_NAME)
+            ext = (base + 9 > ISO_NAME) ? 8 : ISO_NAME - 1 - base;
+        if (base + 1 + ext > ISO_NAME)
+            base = ISO_NAME - 1 - ext;
+    }
+
+    for (i = 0; i < base; i++)
+        out[n++] = isalnum((unsigned char)name[i]) ? toupper((unsigned char)name[i]) : '_';
+
+    if (!dir) {
+        out[n++] = '.';
+        for (i = 0; i < ext; i++)
+            out[n++] = isalnum((unsigned char)dot[1 + i]) ? toupper((unsigned char)dot[1 + i]) : '_';
+        out[n++] = ';';
+        out[n++] = '1';
+    }
+
+    out[n] = 0;
+}
+
+static int node_compare(const void *a, const void *b)
+{
+    return strcmp((*(iso_node_t **)a)->name, (*(iso_node_t **)b)->name);
+}
+
+static void node_free(iso_node_t *node)
+{
+    unsigned int i;
+
+    for (i = 0; i < node->nchildren; i++)
+        node_free(node->children[i]);
+    free(node->children);
+    free(node->path);
+    free(node);
+}
+
+/* read the directory node is, and everything under it */
+static int iso_scan(iso_dir_t *iso, iso_node_t *node)
+{
+    iso_node_t *child, **grown;
+    struct dirent *entry;
+    struct stat st;
+    char *full;
+    unsigned int i, size = 0;
+    DIR *dir;
+
+    if (!(full = malloc(strlen(iso->top) + strlen(node->path) + 2)))
+        return -1;
+    sprintf(full, "%s/%s", iso->top, node->path);
+    dir = opendir(full);
+    free(full);
+    if (!dir)
+        return -1;
+
+    while ((entry = readdir(dir))) {
+        if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
+            continue;
+
+        if (!(child = calloc(1, sizeof(iso_node_t))) ||
+            !(child->path = malloc(strlen(node->path) + strlen(entry->d_name) + 2)) ||
+            !(full = malloc(strlen(iso->top) + strlen(node->path) + strlen(entry->d_name) + 3))) {
+            if (child)
+                free(child->path);
+            free(child);
+            closedir(dir);
+            return -1;
+        }
+        if (*node->path)
+            sprintf(child->path, "%s/%s", node->path, entry->d_name);
+        else
+            strcpy(child->path, entry->d_name);
+        sprintf(full, "%s/%s", iso->top, child->path);
+
+        if (stat(full, &st) || (!S_ISDIR(st.st_mode) && !S_ISREG(st.st_mode)) ||
+            (S_ISREG(st.st_mode) && (unsigned long long)st.st_size > 0xffffffffULL - ISO_SECTOR)) {
+            if (S_ISREG(st.st_mode))
+                fprintf(stderr, "%s: too big for an ISO, left out\n", full);
+            free(full);
+            node_free(child);
+            continue;
+        }
+        free(full);
+
+        child->dir = S_ISDIR(st.st_mode);
+        child->size = child->dir ? 0 : st.st_size;
+        child->mtime = st.st_mtime;
+        child->parent = node;
+        iso_name(entry->d_name, child->dir, child->name);
+
+        for (i = 0; i < node->nchildren; i++)
+            if (!strcmp(node->children[i]->name, child->name))
+                break;
+        if (i < node->nchildren) {
+            fprintf(stderr, "%s/%s: same name on the disc as %s, left out\n",
+                    iso->top, child->path, node->children[i]->path);
+            node_free(child);
+            continue;
+        }
+
+        if (node->nchildren == size) {
+            size = size ? size * 2 : 16;
+            if (!(grown = realloc(node->children, size * sizeof(iso_node_t *)))) {
+                node_free(child);
+                closedir(dir);
+                return -1;
+            }
+            node->children = grown;
+        }
+        node->children[node->nchildren++] = child;
+    }
+    closedir(dir);
+
+    qsort(node->children, node->nchildren, sizeof(iso_node_t *), node_compare);
+
+    for (i = 0; i < node->nchildren; i++)
+        if (node->children[i]->dir && iso_scan(iso, node->children[i]))
+            return -1;
+
+    return 0;
+}
+
+/* how long a directory record with an identifier of len bytes is */
+static unsigned int record_len(unsigned int len)
+{
+    return 33 + len + !(len & 1);
+}
+
+/* add a record of len bytes at *pos in a directory. Records don't cross
+ * sectors. */
+static unsigned int record_place(unsigned int *pos, unsigned int len)
+{
+    if (*pos % ISO_SECTOR + len > ISO_SECTOR)
+        *pos += ISO_SECTOR - *pos % ISO_SECTOR;
+    *pos += len;
+
+    return *pos - len;
+}
+
+static void put_record(unsigned char *p, iso_node_t *node, const char *id, unsigned int len)
+{
+    struct tm *tm = gmtime(&node->mtime);
+
+    memset(p, 0, record_len(len));
+    p[0] = record_len(len);
+    put_both32(p + 2, node->lba);
+    put_both32(p + 10, node->dir ? ISO_SECTORS(node->size) * ISO_SECTOR : node->size);
+    if (tm) {
+        p[18] = tm->tm_year;
+        p[19] = tm->tm_mon + 1;
+        p[20] = tm->tm_mday;
+        p[21] = tm->tm_hour;
+        p[22] = tm->tm_min;
+        p[23] = tm->tm_sec;
+    }
+    p[25] = node->dir ? 2 : 0;
+    put_both16(p + 28, 1);
+    p[32] = len;
+    memcpy(p + 33, id, len);
+}
+
+static void put_directory(iso_dir_t *iso, iso_node_t *node)
+{
+    unsigned char *p = iso->meta + (size_t)node->lba * ISO_SECTOR;
+    unsigned int pos = 0, i, len;
+    iso_node_t *child;
+
+    put_record(p + record_place(&pos, record_len(1)), node, "\0", 1);
+    put_record(p + record_place(&pos, record_len(1)), node->parent ? node->parent : node, "\1", 1);
+
+    for (i = 0; i < node->nchildren; i++) {
+        child = node->children[i];
+        len = strlen(child->name);
+        put_record(p + record_place(&pos, record_len(len)), child, child->name, len);
+    }
+}
+
+/* a path table: every directory in order, least significant byte first
+ * or not */
+static void put_path_table(iso_dir_t *iso, unsigned char *p, int big)
+{
+    unsigned int i, len;
+    iso_node_t *dir;
+
+    for (i = 0; i < iso->ndirs; i++) {
+        dir = iso->dirs[i];
+        len = dir->parent ? strlen(dir->name) : 1;
+
+        p[0] = len;
+        (big ? put_be32 : put_le32)(p + 2, dir->lba);
+        (big ? put_be16 : put_le16)(p + 6, dir->parent ? dir->parent->number : 1);
+        if (dir->parent)
+            memcpy(p + 8, dir->name, len);
+        p += 8 + len + (len & 1);
+    }
+}
+
+static void put_date(unsigned char *p, time_t t)
+{
+    struct tm *tm = gmtime(&t);
+    char date[17];
+
+    if (!tm) {
+        memset(p, '0', 16);
+        p[16] = 0;
+        return;
+    }
+
+    strftime(date, sizeof(date), "%Y%m%d%H%M%S00", tm);
+    memcpy(p, date, 16);
+    p[16] = 0;
+}
+
+static void put_pvd(iso_dir_t *iso, unsigned int table_size, unsigned int l_table, unsigned int m_table)
+{
+    unsigned char *p = iso->meta + ISO_PVD * ISO_SECTOR;
+    const char *name = strrchr(iso->top, '/');
+    time_t now = time(NULL);
+    unsigned int i;
+
+    name = (name && name[1]) ? name + 1 : iso->top;
+
+    p[0] = 1;
+    memcpy(p + 1, "CD001", 5);
+    p[6] = 1;
+    memset(p + 8, ' ', 64);
+    for (i = 0; i < 32 && name[i]; i++)
+        p[40 + i] = isalnum((unsigned char)name[i]) ? toupper((unsigned char)name[i]) : '_';
+    put_both32(p + 80, iso->sectors);
+    put_both16(p + 120, 1);
+    put_both16(p + 124, 1);
+    put_both16(p + 128, ISO_SECTOR);
+    put_both32(p + 132, table_size);
+    put_le32(p + 140, l_table);
+    put_be32(p + 148, m_table);
+    put_record(p + 156, iso->root, "\0", 1);
+    memset(p + 190, ' ', 623);
+    put_date(p + 813, now);
+    put_date(p + 830, now);
+    memset(p + 847, '0', 16);
+    memset(p + 864, '0', 16);
+    p[881] = 1;
+
+    /* and the set terminator after it */
+    p += ISO_SECTOR;
+    p[0] = 255;
+    memcpy(p + 1, "CD001", 5);
+    p[6] = 1;
+}
+
+/* work out where everything goes, and fill in all but the files */
+static int iso_layout(iso_dir_t *iso)
+{
+    unsigned int i, j, lba, pos, table_size = 0, table_sectors;
+    iso_node_t *node, *child, **grown;
+    unsigned int dirs_size = 16, files_size = 0;
+
+    /* directories breadth first, which is path table order */
+    if (!(iso->dirs = malloc(dirs_size * sizeof(iso_node_t *))))
+        return -1;
+    iso->root->dir = 1;
+    iso->dirs[iso->ndirs++] = iso->root;
+
+    for (i = 0; i < iso->ndirs; i++) {
+        node = iso->dirs[i];
+        node->number = i + 1;
+        table_size += 8 + (node->parent ? strlen(node->name) : 1);
+        table_size += table_size & 1;
+
+        pos = 0;
+        record_place(&pos, record_len(1));
+        record_place(&pos, record_len(1));
+        for (j = 0; j < node->nchildren; j++) {
+            child = node->children[j];
+            record_place(&pos, record_len(strlen(child->name)));
+            if (!child->dir)
+                continue;
+            if (iso->ndirs == dirs_size) {
+                if (!(grown = realloc(iso->dirs, 2 * dirs_size * sizeof(iso_node_t *))))
+                    return -1;
+                iso->dirs = grown;
+                dirs_size *= 2;
+            }
+            iso->dirs[iso->ndirs++] = child;
+        }
+        node->size = pos;
+    }
+
+    table_sectors = ISO_SECTORS(table_size);
+    lba = ISO_PVD + 2 + 2 * table_sectors;
+    for (i = 0; i < iso->ndirs; i++) {
+        iso->dirs[i]->lba = lba;
+        lba += ISO_SECTORS(iso->dirs[i]->size);
+    }
+    iso->meta_sectors = lba;
+
+    /* then the files, a directory at a time */
+    for (i = 0; i < iso->ndirs; i++) {
+        node = iso->dirs[i];
+        for (j = 0; j < node->nchildren; j++) {
+            child = node->children[j];
+            if (child->dir)
+                continue;
+            child->lba = lba;
+            if (lba + ISO_SECTORS(child->size) < lba) {
+                errno = EFBIG;
+                return -1;
+            }
+            lba += ISO_SECTORS(child->size);
+
+            if (iso->nfiles == files_size) {
+                files_size = files_size ? files_size * 2 : 64;
+                if (!(grown = realloc(iso->files, files_size * sizeof(iso_node_t *))))
+                    return -1;
+                iso->files = grown;
+            }
+            iso->files[iso->nfiles++] = child;
+        }
+    }
+    iso->sectors = lba;
+
+    if (!(iso->meta = calloc(iso->meta_sectors, ISO_SECTOR)))
+        return -1;
+
+    put_pvd(iso, table_size, ISO_PVD + 2, ISO_PVD + 2 + table_sectors);
+    put_path_table(iso, iso->meta + (ISO_PVD + 2) * ISO_SECTOR, 0);
+    put_path_table(iso, iso->meta + (ISO_PVD + 2 + table_sectors) * ISO_SECTOR, 1);
+    for (i = 0; i < iso->ndirs; i++)
+        put_directory(iso, iso->dirs[i]);
+
+    return 0;
+}
+
+iso_dir_t *iso_dir_open(const char *path)
+{
+    iso_dir_t *iso;
+    struct stat st;
+    size_t len;
+    int error;
+
+    if (stat(path, &st))
+        return NULL;
+    if (!S_ISDIR(st.st_mode)) {
+        errno = ENOTDIR;
+        return NULL;
+    }
+
+    if (!(iso = calloc(1, sizeof(iso_dir_t))))
+        return NULL;
+    iso->fd = -1;
+    iso->top_fd = -1;
+
+    if (!(iso->top = strdup(path)) || !(iso->root = calloc(1, sizeof(iso_node_t))) ||
+        !(iso->root->path = strdup("")))
+        goto fail;
+
+    len = strlen(iso->top);
+    while (len > 1 && iso->top[len - 1] == '/')
+        iso->top[--len] = 0;
+    iso->root->mtime = st.st_mtime;
+
+    if (iso_scan(iso, iso->root) || iso_layout(iso))
+        goto fail;
+
+#ifdef AT_FDCWD
+    iso->top_fd = open(iso->top, O_RDONLY);
+#endif
+
+    printf("%s: %u files in %u directories, %u sectors\n", iso->top, iso->nfiles, iso->ndirs, iso->sectors);
+
+    return iso;
+
+fail:
+    error = errno ? errno : ENOMEM;
+    iso_dir_close(iso);
+    errno = error;
+    return NULL;
+}
+
+void iso_dir_close(iso_dir_t *iso)
+{
+    if (!iso)
+        return;
+
+    if (iso->fd >= 0)
+        close(iso->fd);
+    if (iso->top_fd >= 0)
+        close(iso->top_fd);
+    if (iso->root)
+        node_free(iso->root);
+    free(iso->dirs);
+    free(iso->files);
+    free(iso->meta);
+    free(iso->top);
+    free(iso);
+}
+
+off_t iso_dir_size(iso_dir_t *iso)
+{
+    return (off_t)iso->sectors * ISO_SECTOR;
+}
+
+/* the file with data at sector, if there is one */
+static iso_node_t *iso_file(iso_dir_t *iso, unsigned int sector)
+{
+    unsigned int lo = 0, hi = iso->nfiles, mid;
+    iso_node_t *file;
+
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        file = iso->files[mid];
+        if (sector < file->lba)
+            hi = mid;
+        else if (sector >= file->lba + ISO_SECTORS(file->size))
+            lo = mid + 1;
+        else
+            return file;
+    }
+
+    return NULL;
+}
+
+/* read n bytes at offset in file, opening it first if it isn't the one
+ * that's open */
+static int iso_file_read(iso_dir_t *iso, iso_node_t *file, unsigned char *buf, unsigned int n, unsigned int offset)
+{
+    char *full;
+
+    if (iso->open != file) {
+        if (iso->fd >= 0)
+            close(iso->fd);
+        iso->open = file;
+
+#ifdef AT_FDCWD
+        if (iso->top_fd >= 0) {
+            iso->fd = openat(iso->top_fd, file->path, O_RDONLY | O_BINARY);
+        } else
+#endif
+        if ((full = malloc(strlen(iso->top) + strlen(file->path) + 2))) {
+            sprintf(full, "%s/%s", iso->top, file->path);
+            iso->fd = open(full, O_RDONLY | O_BINARY);
+            free(full);
+        } else {
+            iso->fd = -1;
+        }
+
+        if (iso->fd < 0)
+            log_error(file->path);
+    }
+
+    if (iso->fd < 0)
+        return -1;
+
+    return read_at(iso->fd, buf, n, offset);
+}
+
+int iso_dir_read(iso_dir_t *iso, void *buf, unsigned int count, off_t offset)
+{
+    unsigned char *out = buf;
+    unsigned long long pos, end, size = (unsigned long long)iso->sectors * ISO_SECTOR;
+    unsigned int done = 0, n, m;
+    iso_node_t *file;
+    int retval;
+
+    if (offset < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    while (done < count && (pos = offset + done) < size) {
+        n = count - done;
+
+        if (pos < (unsigned long long)iso->meta_sectors * ISO_SECTOR) {
+            if (n > iso->meta_sectors * ISO_SECTOR - pos)
+                n = iso->meta_sectors * ISO_SECTOR - pos;
+            memcpy(out + done, iso->meta + pos, n);
+            done += n;
+            continue;
+        }
+
+        /* the rest of the file's sectors, zeros past its data */
+        file = iso_file(iso, pos / ISO_SECTOR);
+        end = file ? ((unsigned long long)file->lba + ISO_SECTORS(file->size)) * ISO_SECTOR : size;
+        if (n > end - pos)
+            n = end - pos;
+        memset(out + done, 0, n);
+
+        if (file && pos - (unsigned long long)file->lba * ISO_SECTOR < file->size) {
+            m = file->size - (pos - (unsigned long long)file->lba * ISO_SECTOR);
+            if (m > n)
+                m = n;
+            retval = iso_file_read(iso, file, out + done, m, pos - (unsigned long long)file->lba * ISO_SECTOR);
+            if (retval < 0 && !done)
+                return retval;
+            /* whatever's past a short read stays zeros */
+        }
+
+        done += n;
+    }
+
+    return done;
+}
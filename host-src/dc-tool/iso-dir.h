@@ -0,0 +1,48 @@
+/*
+ * dc-tool, a tool for use with the dcload loader
+ *
+ * Copyright (C) 2023 Andrew Kieschnick <andrewk@austin.rr.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#ifndef __ISO_DIR_H__
+#define __ISO_DIR_H__
+
+#include <sys/types.h>
+
+typedef struct iso_dir iso_dir_t;
+
+/* iso_dir_open lays out an ISO9660 image of the directory at path: the
+ * volume descriptors, path tables and directories, and an extent for every
+ * file. Nothing is read from the files yet. Returns NULL with errno set if
+ * path can't be read.
+ */
+iso_dir_t *iso_dir_open(const char *path);
+
+void iso_dir_close(iso_dir_t *iso);
+
+/* iso_dir_size returns how many bytes the image is */
+off_t iso_dir_size(iso_dir_t *iso);
+
+/* iso_dir_read reads count bytes at offset in the image into buf, from the
+ * files they belong to, and returns what read_at would. A file that has
+ * shrunk since the image was laid out reads as zeros past its end. Only for
+ * the dispatch thread.
+ */
+int iso_dir_read(iso_dir_t *iso, void *buf, unsigned int count, off_t offset);
+
+#endif /* __ISO_DIR_H__ */
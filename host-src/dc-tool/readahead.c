@@ -0,0 +1,384 @@
+/*
+ * dc-tool, a tool for use with the dcload loader
+ *
+ * Copyright (C) 2023 Andrew Kieschnick <andrewk@austin.rr.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+/* Read-ahead for target file reads.
+ *
+ * Each fd the target reads gets a few block aligned buffers. After two reads
+ * in a row that continue where the last one ended, the blocks following the
+ * new position are started with file-io, which reads them while the answer
+ * to the target is on the wire. The fd position is kept where
+ * read would have left it, so lseek from the target still works.
+ *
+ * Regular files can also be read through a mapping of the whole file with
+ * readahead_view, which hands out pointers into the page cache so nothing is
+ * copied on the way to the transport. The kernel does the read-ahead there,
+ * asked for with madvise once the reads are sequential.
+ *
+ * On MinGW there's no position independent read, so readahead_read is just
+ * read there, and nothing is mapped.
+ *
+ * Everything here is for the dispatch thread only.
+ */
+
+#include "readahead.h"
+#include "file-io.h"
+#include "syscalls.h"
+#include "utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifndef __MINGW32__
+#include <sys/mman.h>
+#endif
+
+#define RA_BLOCK    (64 * 1024)
+#define RA_SLOTS    4           /* the block being read plus three ahead */
+
+#define RA_ALIGN(x) ((x) - (x) % RA_BLOCK)
+
+typedef enum {
+    RA_EMPTY,
+    RA_LOADING,
+    RA_READY
+} ra_state_t;
+
+typedef struct {
+    ra_state_t state;
+    off_t offset;
+    unsigned int len;           /* less than RA_BLOCK at the end of the file */
+    unsigned char *data;
+    file_io_t *io;              /* while loading */
+} ra_block_t;
+
+typedef struct {
+    int fd;
+    off_t next;                 /* where the last read ended */
+    int sequential;             /* reads in a row that started at next */
+    ra_block_t blocks[RA_SLOTS];
+    unsigned char *map;         /* all of the file, for readahead_view */
+    size_t map_size;
+    int unmappable;
+    off_t advised;              /* where the last madvise ended */
+} ra_file_t;
+
+static ra_file_t **files;
+static int files_size;
+
+static unsigned int hits, misses, mapped;
+static unsigned long long bytes_hit, bytes_prefetched;
+
+/* wait for b's read, if it hasn't been waited for yet */
+static void ra_finish(ra_block_t *b)
+{
+    int retval;
+
+    if (b->state != RA_LOADING)
+        return;
+
+    retval = file_io_wait(b->io);
+    b->io = NULL;
+    b->len = (retval > 0) ? retval : 0;
+    b->state = RA_READY;
+    bytes_prefetched += b->len;
+}
+
+static ra_file_t *ra_file(int fd)
+{
+    ra_file_t **grown;
+    int size;
+
+    if (fd >= files_size) {
+        size = files_size ? files_size : 16;
+        while (size <= fd)
+            size *= 2;
+        if (!(grown = realloc(files, size * sizeof(ra_file_t *))))
+            return NULL;
+        memset(grown + files_size, 0, (size - files_size) * sizeof(ra_file_t *));
+        files = grown;
+        files_size = size;
+    }
+
+    if (!files[fd]) {
+        if (!(files[fd] = calloc(1, sizeof(ra_file_t))))
+            return NULL;
+        files[fd]->fd = fd;
+        files[fd]->next = -1;
+    }
+
+    return files[fd];
+}
+
+static ra_block_t *ra_find(ra_file_t *f, off_t offset)
+{
+    int i;
+
+    for (i = 0; i < RA_SLOTS; i++)
+        if (f->blocks[i].state != RA_EMPTY && f->blocks[i].offset == RA_ALIGN(offset))
+            return &f->blocks[i];
+
+    return NULL;
+}
+
+/* start reading the blocks from offset on, reusing the ones outside that
+ * window. Blocks still loading are left to finish. */
+static void ra_queue(ra_file_t *f, off_t offset)
+{
+    ra_block_t *b;
+    off_t want;
+    int i, k;
+
+    for (i = 0; i < RA_SLOTS; i++) {
+        b = &f->blocks[i];
+        if (b->state == RA_READY &&
+            (b->offset < RA_ALIGN(offset) || b->offset >= RA_ALIGN(offset) + (off_t)RA_SLOTS * RA_BLOCK))
+            b->state = RA_EMPTY;
+    }
+
+    for (k = 0; k < RA_SLOTS; k++) {
+        want = RA_ALIGN(offset) + (off_t)k * RA_BLOCK;
+        if (ra_find(f, want))
+            continue;
+
+        for (i = 0; i < RA_SLOTS; i++)
+            if (f->blocks[i].state == RA_EMPTY)
+                break;
+        if (i == RA_SLOTS)
+            break;
+
+        b = &f->blocks[i];
+        if (!b->data && !(b->data = malloc(RA_BLOCK)))
+            break;
+        if (!(b->io = file_io_read(f->fd, b->data, RA_BLOCK, want)))
+            break;
+        b->offset = want;
+        b->len = 0;
+        b->state = RA_LOADING;
+    }
+}
+
+int readahead_read(int fd, void *buf, unsigned int count)
+{
+    unsigned char *out = buf;
+    unsigned int done = 0, n;
+    ra_block_t *b;
+    ra_file_t *f;
+    off_t pos;
+    int retval;
+
+#ifdef __MINGW32__
+    pos = -1;
+#else
+    pos = lseek(fd, 0, SEEK_CUR);
+#endif
+    if (pos == -1) {
+        retval = read(fd, buf, count);
+        dc_syscall_copied(retval > 0 ? retval : 0);
+        return retval;
+    }
+
+    if (!(f = ra_file(fd))) {
+        retval = read(fd, buf, count);
+        dc_syscall_copied(retval > 0 ? retval : 0);
+        return retval;
+    }
+
+    while (done < count && (b = ra_find(f, pos + done))) {
+        ra_finish(b);
+
+        if (pos + done >= b->offset + b->len)
+            break;
+
+        n = b->offset + b->len - (pos + done);
+        if (n > count - done)
+            n = count - done;
+        memcpy(out + done, b->data + (pos + done - b->offset), n);
+        done += n;
+
+        if (b->len < RA_BLOCK)
+            break;
+    }
+
+    /* whatever wasn't prefetched comes straight from the file */
+    retval = 0;
+    if (done < count) {
+        retval = read_at(fd, out + done, count - done, pos + done);
+        if (retval < 0 && !done)
+            return retval;
+        if (retval < 0)
+            retval = 0;
+    }
+    lseek(fd, pos + done + retval, SEEK_SET);
+    dc_syscall_copied(done + retval);
+
+    if (done == count || (done && !retval))
+        hits++;
+    else if (retval)
+        misses++;
+    bytes_hit += done;
+
+    f->sequential = (pos == f->next) ? f->sequential + 1 : 0;
+    f->next = pos + done + retval;
+
+    if (f->sequential && done + retval == count)
+        ra_queue(f, f->next);
+
+    return done + retval;
+}
+
+/* map all of f's file, again if it has changed size. Returns -1 if it can't
+ * be mapped. */
+static int ra_map(ra_file_t *f)
+{
+#ifdef __MINGW32__
+    return -1;
+#else
+    struct stat st;
+    void *map;
+
+    if (f->unmappable)
+        return -1;
+
+    if (fstat(f->fd, &st) || !S_ISREG(st.st_mode) || (off_t)(size_t)st.st_size != st.st_size) {
+        f->unmappable = 1;
+        return -1;
+    }
+
+    if (f->map && f->map_size == (size_t)st.st_size)
+        return 0;
+
+    if (f->map) {
+        munmap(f->map, f->map_size);
+        f->map = NULL;
+        f->map_size = 0;
+    }
+
+    /* nothing to map, but read will say so */
+    if (!st.st_size)
+        return -1;
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, f->fd, 0);
+    if (map == MAP_FAILED) {
+        f->unmappable = 1;
+        return -1;
+    }
+
+    f->map = map;
+    f->map_size = st.st_size;
+    f->advised = 0;
+
+    return 0;
+#endif
+}
+
+static int ra_view(int fd, off_t offset, unsigned int count, unsigned char **data, int move)
+{
+    ra_file_t *f;
+    off_t pos = offset;
+    unsigned int n;
+
+    if (!(f = ra_file(fd)) || ra_map(f))
+        return -1;
+
+    if (move && (pos = lseek(fd, 0, SEEK_CUR)) == -1)
+        return -1;
+
+    n = 0;
+    if (pos >= 0 && (size_t)pos < f->map_size)
+        n = (f->map_size - pos > count) ? count : f->map_size - pos;
+    *data = f->map + pos;
+
+    if (move)
+        lseek(fd, pos + n, SEEK_SET);
+
+    if (n)
+        mapped++;
+
+    f->sequential = (pos == f->next) ? f->sequential + 1 : 0;
+    f->next = pos + n;
+
+#ifndef __MINGW32__
+    /* keep the kernel reading a window ahead, asking again halfway */
+    if (f->sequential && f->next + RA_SLOTS * RA_BLOCK / 2 > f->advised &&
+        (size_t)f->next < f->map_size) {
+        off_t start = f->next - f->next % getpagesize();
+        size_t len = RA_SLOTS * RA_BLOCK;
+
+        if (start + len > f->map_size)
+            len = f->map_size - start;
+        madvise(f->map + start, len, MADV_WILLNEED);
+        f->advised = start + len;
+    }
+#endif
+
+    return n;
+}
+
+int readahead_view(int fd, unsigned int count, unsigned char **data)
+{
+    return ra_view(fd, 0, count, data, 1);
+}
+
+int readahead_view_at(int fd, unsigned int offset, unsigned int count, unsigned char **data)
+{
+    return ra_view(fd, offset, count, data, 0);
+}
+
+int readahead_sequential(int fd)
+{
+    if (fd >= 0 && fd < files_size && files[fd])
+        return files[fd]->sequential;
+
+    return 0;
+}
+
+void readahead_forget(int fd)
+{
+    ra_file_t *f;
+    int i;
+
+    if (fd < 0 || fd >= files_size || !(f = files[fd]))
+        return;
+
+    /* blocks may still be being read into */
+    for (i = 0; i < RA_SLOTS; i++) {
+        ra_finish(&f->blocks[i]);
+        free(f->blocks[i].data);
+    }
+#ifndef __MINGW32__
+    if (f->map)
+        munmap(f->map, f->map_size);
+#endif
+    free(f);
+    files[fd] = NULL;
+}
+
+void readahead_report(void)
+{
+    if (!hits && !misses && !mapped)
+        return;
+
+    printf("read-ahead: %u hits, %u misses, %llu of %llu prefetched bytes used, %u reads mapped\n",
+           hits, misses, bytes_hit, bytes_prefetched, mapped);
+}
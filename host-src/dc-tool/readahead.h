@@ -0,0 +1,56 @@
+/*
+ * dc-tool, a tool for use with the dcload loader
+ *
+ * Copyright (C) 2023 Andrew Kieschnick <andrewk@austin.rr.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#ifndef __READAHEAD_H__
+#define __READAHEAD_H__
+
+/* readahead_read reads count bytes from fd into buf like read does, taking
+ * what it can from blocks that were prefetched. Once fd has been read
+ * sequentially, the blocks after the new position are prefetched on a
+ * worker thread.
+ */
+int readahead_read(int fd, void *buf, unsigned int count);
+
+/* readahead_view is readahead_read without the copy. It points *data at
+ * the next count bytes of fd in a mapping of the file, moves the position
+ * past them, and returns how many there are. If fd isn't a regular file
+ * that can be mapped it returns -1 and nothing changes; use readahead_read.
+ * *data stays good until fd is forgotten or changes size.
+ */
+int readahead_view(int fd, unsigned int count, unsigned char **data);
+
+/* readahead_view_at is readahead_view at offset, leaving the position be */
+int readahead_view_at(int fd, unsigned int offset, unsigned int count, unsigned char **data);
+
+/* readahead_sequential returns nonzero if the last reads of fd each started
+ * where the one before ended.
+ */
+int readahead_sequential(int fd);
+
+/* readahead_forget drops everything prefetched for fd. It has to be called
+ * before fd is written or closed.
+ */
+void readahead_forget(int fd);
+
+/* readahead_report prints the hit and miss counters, if fd was ever read */
+void readahead_report(void);
+
+#endif /* __READAHEAD_H__ */
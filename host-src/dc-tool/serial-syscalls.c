@@ -22,12 +22,18 @@
 #include "syscalls.h"
 #include "serial-transport.h"
 #include "gdb.h"
+#include "dir-handles.h"
+#include "readahead.h"
+#include "file-io.h"
+#include "buffer-pool.h"
+#include "utils.h"
 
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <sys/time.h>
 #include <unistd.h>
@@ -48,6 +54,21 @@
 #define send_data(data, len, v) serial_xprt_write_chunk(data, len)
 #define recv_data(data, len, v) serial_xprt_read_chunk(data, len)
 
+/* answer a data block the target is waiting for with len zero bytes, when
+ * there's nothing to send it. Pieces of 16 KB go out just as one large
+ * send_data would send them. */
+static void send_zeros(unsigned int len)
+{
+    static unsigned char zeros[16384];
+    unsigned int n;
+
+    while (len) {
+        n = (len < sizeof(zeros)) ? len : sizeof(zeros);
+        send_data(zeros, n, 0);
+        len -= n;
+    }
+}
+
 static int dc_fstat(unsigned char *buffer __attribute__((unused)))
 {
     int filedes;
@@ -91,14 +112,21 @@ static int dc_write(unsigned char *buffer __attribute__((unused)))
     filedes = recv_uint();
     count = recv_uint();
 
-    data = malloc(count);
+    /* the data is on its way, so it has to be read either way */
+    if (!(data = pool_alloc(count))) {
+        serial_xprt_skip_chunk(count);
+        send_uint(-1);
+        return 0;
+    }
     recv_data(data, count, 0);
+    dc_syscall_copied(count);
 
+    readahead_forget(filedes);
     retval = write(filedes, data, count);
 
     send_uint(retval);
 
-    free(data);
+    pool_free(data);
     return 0;
 }
 
@@ -107,19 +135,33 @@ static int dc_read(unsigned char *buffer __attribute__((unused)))
     int filedes;
     int retval;
     int count;
-    unsigned char *data;
+    unsigned char *data = NULL, *view;
 
     filedes = recv_uint();
     count = recv_uint();
 
-    data = malloc(count);
-    retval = read(filedes, data, count);
+    /* all count bytes go back, so only a full view will do */
+    retval = readahead_view(filedes, count, &view);
+    if (retval < count) {
+        if (!(data = pool_alloc(count))) {
+            send_zeros(count);
+            send_uint(-1);
+            return 0;
+        }
+        if (retval == -1) {
+            retval = readahead_read(filedes, data, count);
+        } else {
+            memcpy(data, view, retval);
+            dc_syscall_copied(retval);
+        }
+        view = data;
+    }
 
-    send_data(data, count, 0);
+    send_data(view, count, 0);
 
     send_uint(retval);
 
-    free(data);
+    pool_free(data);
     return 0;
 }
 
@@ -171,6 +213,7 @@ static int dc_close(unsigned char *buffer __attribute__((unused)))
 
     filedes = recv_uint();
 
+    readahead_forget(filedes);
     retval = close(filedes);
 
     send_uint(retval);
@@ -393,7 +436,6 @@ static int dc_utime(unsigned char *buffer __attribute__((unused)))
 
 static int dc_opendir(unsigned char *buffer __attribute__((unused)))
 {
-    DIR *somedir;
     char *dirname;
     int namelen;
 
@@ -403,10 +445,7 @@ static int dc_opendir(unsigned char *buffer __attribute__((unused)))
 
     recv_data(dirname, namelen, 0);
 
-    somedir = opendir(dirname);
-
-    // XXX(jpeach) pointer truncated to 32 bits!
-    send_uint((unsigned int)somedir);
+    send_uint(dir_handle_open(dirname));
 
     free(dirname);
     return 0;
@@ -414,12 +453,9 @@ static int dc_opendir(unsigned char *buffer __attribute__((unused)))
 
 static int dc_closedir(unsigned char *buffer __attribute__((unused)))
 {
-    DIR *somedir;
     int retval;
 
-    somedir = (DIR *) recv_uint();
-
-    retval = closedir(somedir);
+    retval = dir_handle_close(recv_uint());
 
     send_uint(retval);
     return 0;
@@ -427,12 +463,9 @@ static int dc_closedir(unsigned char *buffer __attribute__((unused)))
 
 static int dc_readdir(unsigned char *buffer __attribute__((unused)))
 {
-    DIR *somedir;
     struct dirent *somedirent;
 
-    somedir = (DIR *) recv_uint();
-
-    somedirent = readdir(somedir);
+    somedirent = dir_handle_read(recv_uint());
 
     if (somedirent) {
         send_uint(1);
@@ -465,35 +498,194 @@ static int dc_readdir(unsigned char *buffer __attribute__((unused)))
 
 static int dc_rewinddir(unsigned char *buffer __attribute__((unused)))
 {
-    DIR *somedir;
+    send_uint(dir_handle_rewind(recv_uint()));
+    return 0;
+}
 
-    somedir = (DIR *) recv_uint();
+/* most of the target's buffer filled by one readdirplus */
+#define READDIRPLUS_MAX 65536
 
-    rewinddir(somedir);
+static int dc_readdirplus(unsigned char *buffer __attribute__((unused)))
+{
+    unsigned int handle, size, used;
+    unsigned char *data;
+    int retval;
 
-    send_uint(0);
+    handle = recv_uint();
+    size = recv_uint();
+    if (size > READDIRPLUS_MAX)
+        size = READDIRPLUS_MAX;
+
+    if (!(data = pool_alloc(size))) {
+        send_uint(0);
+        send_uint(-1);
+        return 0;
+    }
+    retval = dir_handle_readplus(handle, data, size, &used);
+
+    send_uint(used);
+    if (used)
+        send_data(data, used, 0);
+    send_uint(retval);
+
+    pool_free(data);
     return 0;
 }
 
-static int dc_cdfs_redir_read_sectors(int isofd, unsigned char *buffer __attribute__((unused)))
+static int dc_cdfs_redir_read_sectors(disc_image_t *disc, unsigned char *buffer __attribute__((unused)))
 {
-    int start;
-    int num;
-    unsigned char * buf;
+    unsigned int start;
+    unsigned int num;
+    unsigned char *data;
 
     start = recv_uint();
     num = recv_uint();
 
-    start -= 150;
+    if (disc_read(disc, start, num * DISC_SECTOR, &data) == -1)
+        return -1;
+
+    send_data(data, num * DISC_SECTOR, 0);
+    return 0;
+}
+
+static int dc_cdfs_toc(disc_image_t *disc, unsigned char *buffer __attribute__((unused)))
+{
+    unsigned char toc[DISC_TOC_SIZE];
+    unsigned int area;
+    int retval;
+
+    area = recv_uint();
+
+    retval = disc_toc(disc, area, toc);
+
+    send_data(toc, sizeof(toc), 0);
+    send_uint(retval);
+    return 0;
+}
+
+static int dc_pread(unsigned char *buffer __attribute__((unused)))
+{
+    int filedes;
+    int retval;
+    int count;
+    unsigned int offset;
+    unsigned char *data = NULL, *view;
+
+    filedes = recv_uint();
+    count = recv_uint();
+    offset = recv_uint();
+
+    /* all count bytes go back, so only a full view will do */
+    retval = readahead_view_at(filedes, offset, count, &view);
+    if (retval < count) {
+        if (!(data = pool_alloc(count))) {
+            send_zeros(count);
+            send_uint(-1);
+            return 0;
+        }
+        retval = read_at(filedes, data, count, offset);
+        dc_syscall_copied(retval > 0 ? retval : 0);
+        view = data;
+    }
+
+    send_data(view, count, 0);
+
+    send_uint(retval);
+
+    pool_free(data);
+    return 0;
+}
+
+/* most ranges in one preadv, as over IP */
+#define PREADV_MAX 64
 
-    lseek(isofd, start * 2048, SEEK_SET);
+/* most bytes in one preadv, all of the target's RAM */
+#define PREADV_SIZE_MAX (16 * 1024 * 1024)
 
-    buf = malloc(num * 2048);
+/* the target sends fd, count and then an offset and size for each range,
+ * and expects the data for each range (whether it could be read or not)
+ * followed by the total read, stopping at the first short read */
+static int dc_preadv(unsigned char *buffer __attribute__((unused)))
+{
+    int filedes;
+    int retval;
+    int total = 0;
+    unsigned int count, i, size = 0, pos = 0;
+    unsigned int *ranges;
+    unsigned char *data = NULL;
+    file_io_t **io = NULL;
+    int done = 0;
+
+    filedes = recv_uint();
+    count = recv_uint();
+
+    /* The target sends every range and then waits for a block of each
+     * one's size, so they're kept even when the request is refused. Only
+     * without them is the link lost. */
+    if (count > SIZE_MAX / (2 * sizeof(unsigned int)) ||
+        !(ranges = pool_alloc(count * 2 * sizeof(unsigned int)))) {
+        for (i = 0; i < count; i++) {
+            recv_uint();
+            recv_uint();
+        }
+        printf("preadv: no memory for %u ranges\n", count);
+        return -1;
+    }
+
+    for (i = 0; i < count; i++) {
+        ranges[i * 2] = recv_uint();
+        ranges[i * 2 + 1] = recv_uint();
+        if (ranges[i * 2 + 1] > PREADV_SIZE_MAX - size)
+            total = -1;
+        else
+            size += ranges[i * 2 + 1];
+    }
+
+    if (count > PREADV_MAX || total == -1 ||
+        !(data = pool_alloc(size)) || !(io = pool_alloc(count * sizeof(file_io_t *)))) {
+        total = -1;
+        done = 1;
+    }
+
+    /* every range is started before any is waited for */
+    for (i = 0; !done && i < count; pos += ranges[i * 2 + 1], i++)
+        io[i] = file_io_read(filedes, data + pos, ranges[i * 2 + 1], ranges[i * 2]);
+
+    for (i = 0, pos = 0; io && i < count; pos += ranges[i * 2 + 1], i++) {
+        if (io[i])
+            retval = file_io_wait(io[i]);
+        else if (!done)
+            retval = read_at(filedes, data + pos, ranges[i * 2 + 1], ranges[i * 2]);
+        if (done)
+            continue;
+
+        dc_syscall_copied(retval > 0 ? retval : 0);
+        if (retval < 0) {
+            if (!total)
+                total = -1;
+            done = 1;
+            continue;
+        }
+
+        total += retval;
+        if (retval < ranges[i * 2 + 1])
+            done = 1;
+    }
+
+    for (i = 0, pos = 0; i < count; pos += ranges[i * 2 + 1], i++) {
+        if (!ranges[i * 2 + 1])
+            continue;
+        if (io)
+            send_data(data + pos, ranges[i * 2 + 1], 0);
+        else
+            send_zeros(ranges[i * 2 + 1]);
+    }
 
-    read(isofd, buf, num * 2048);
+    send_uint(total);
 
-    send_data(buf, num * 2048, 0);
-    free(buf);
+    pool_free(io);
+    pool_free(data);
+    pool_free(ranges);
     return 0;
 }
 
@@ -568,6 +760,10 @@ const dc_system_calls_t serial_xprt_system_calls = {
     .readdir = dc_readdir,
     .closedir = dc_closedir,
     .rewinddir = dc_rewinddir,
+    .readdirplus = dc_readdirplus,
     .cdfs_redir_read_sectors = dc_cdfs_redir_read_sectors,
+    .cdfs_toc = dc_cdfs_toc,
     .gdbpacket = dc_gdbpacket,
+    .pread = dc_pread,
+    .preadv = dc_preadv,
 };
@@ -88,6 +88,7 @@ static int serial_read(void *buffer, int count)
     if( !fSuccess )
         return -1;
 
+    dc_syscall_count(count, 0);
     return count;
 }
 
@@ -99,6 +100,7 @@ static int serial_write(void *buffer, int count)
     if( !fSuccess )
         return -1;
 
+    dc_syscall_count(0, count);
     return count;
 }
 
@@ -110,22 +112,31 @@ static int serial_putc(char ch)
     fSuccess = WriteFile(hCommPort, &ch, count, (DWORD *)&count, NULL);
     if( !fSuccess )
         return -1;
+    dc_syscall_count(0, count);
     return count;
 }
 #else
 static int serial_read(void *buffer, int count)
 {
-    return read(dcfd,buffer,count);
+    int retval = read(dcfd,buffer,count);
+
+    if (retval > 0)
+        dc_syscall_count(retval, 0);
+    return retval;
 }
 
 static int serial_write(void *buffer, int count)
 {
-    return write(dcfd,buffer,count);
+    int retval = write(dcfd,buffer,count);
+
+    if (retval > 0)
+        dc_syscall_count(0, retval);
+    return retval;
 }
 
 static int serial_putc(char ch)
 {
-    return write(dcfd,&ch,1);
+    return serial_write(&ch, 1);
 }
 #endif
 
@@ -220,9 +231,25 @@ int serial_xprt_read_uint(void)
     return recv_uint();
 }
 
-/* receive total bytes from dc and store in data */
+/* read size bytes and throw them away */
+static void blskip(unsigned int size)
+{
+    unsigned char scratch[1024];
+    unsigned int n;
+
+    while (size) {
+        n = (size < sizeof(scratch)) ? size : sizeof(scratch);
+        blread(scratch, n);
+        size -= n;
+    }
+}
+
+/* receive total bytes from dc and store in data, or throw them away if data
+ * is NULL */
 static void recv_data(void *data, unsigned int total, unsigned int verbose)
 {
+    /* the target compresses at most 8192 bytes at a time */
+    static unsigned char discard[8192];
     unsigned char type, sum, ok;
     unsigned int size, newsize;
     unsigned char *tmp;
@@ -243,12 +270,16 @@ static void recv_data(void *data, unsigned int total, unsigned int verbose)
                 printf("U");
                 fflush(stdout);
             }
-            blread(data, size);
+            if (data) {
+                blread(data, size);
+                data += size;
+            } else {
+                blskip(size);
+            }
             blread(&sum, 1);
             ok = 'G';
             serial_write(&ok, 1);
             total -= size;
-            data += size;
             break;
         case 'C':		// compressed
             if (verbose) {
@@ -258,11 +289,14 @@ static void recv_data(void *data, unsigned int total, unsigned int verbose)
             tmp = malloc(size);
             blread(tmp, size);
             blread(&sum, 1);
-            if (lzo1x_decompress(tmp, size, data, &newsize, 0) == LZO_E_OK) {
+            newsize = sizeof(discard);
+            if ((data ? lzo1x_decompress(tmp, size, data, &newsize, 0) :
+                 lzo1x_decompress_safe(tmp, size, discard, &newsize, 0)) == LZO_E_OK) {
                 ok = 'G';
                 serial_write(&ok, 1);
                 total -= newsize;
-                data += newsize;
+                if (data)
+                    data += newsize;
             } else {
                 ok = 'B';
                 serial_write(&ok, 1);
@@ -287,6 +321,12 @@ int serial_xprt_read_chunk(void *data, size_t len)
     return 0;
 }
 
+int serial_xprt_skip_chunk(size_t len)
+{
+    recv_data(NULL, len, debug);
+    return 0;
+}
+
 /* send size bytes to dc from addr */
 static void send_data(unsigned char * addr, unsigned int size, unsigned int verbose)
 {
@@ -596,6 +636,72 @@ int serial_xprt_send_data(void *data, size_t len, unsigned dcaddr)
     return 0;
 }
 
+/* Newer dcload-serial versions end their version line with a '+' and the
+ * letters of the optional commands they support. Older ones don't, and must
+ * never be sent a command they don't know, as that resets their serial port.
+ */
+static char serial_caps[32];
+static int serial_caps_probed = 0;
+
+static int serial_has_cap(char cap)
+{
+    char line[80];
+    char c, *plus;
+    unsigned int i = 0;
+
+    if (!serial_caps_probed) {
+        serial_caps_probed = 1;
+
+        serial_write("V", 1);
+        blread(&c, 1);
+
+        while (i < sizeof(line) - 1 && blread(&c, 1) == 0 && c != '\n')
+            line[i++] = c;
+        line[i] = 0;
+
+        if ((plus = strchr(line, '+')))
+            strncpy(serial_caps, plus + 1, sizeof(serial_caps) - 1);
+    }
+
+    return strchr(serial_caps, cap) != NULL;
+}
+
+int serial_xprt_fill_data(unsigned dcaddr, size_t len, unsigned char value)
+{
+    char c = 'M';
+
+    if (!serial_has_cap(c))
+        return 1;
+
+    serial_write(&c, 1);
+    blread(&c, 1);
+
+    if (send_uint(dcaddr) == 0 || send_uint(len) == 0 || send_uint(value) == 0)
+        return -1;
+
+    return 0;
+}
+
+int serial_xprt_hash_data(unsigned dcaddr, size_t len, unsigned chunk, unsigned int *hashes)
+{
+    char c = 'K';
+    unsigned int i, n = (len + chunk - 1) / chunk;
+
+    if (!serial_has_cap(c))
+        return 1;
+
+    serial_write(&c, 1);
+    blread(&c, 1);
+
+    if (send_uint(dcaddr) == 0 || send_uint(len) == 0 || send_uint(chunk) == 0)
+        return -1;
+
+    for (i = 0; i < n; i++)
+        hashes[i] = recv_uint();
+
+    return 0;
+}
+
 int serial_xprt_recv_data(unsigned dcaddr, size_t len, void *dst)
 {
     unsigned char c;
@@ -666,84 +772,22 @@ void serial_xprt_cleanup(void)
     close_serial();
 }
 
-int serial_xprt_dispatch_commands(int isofd)
+int serial_xprt_dispatch_commands(disc_image_t *disc)
 {
     unsigned char command;
 
     serial_xprt_read_bytes(&command, 1);
 
-    switch (command) {
-        case 0:
-            return 1;
-        case 1:
-            serial_xprt_system_calls.fstat(NULL);
-            break;
-        case 2:
-            serial_xprt_system_calls.write(NULL);
-            break;
-        case 3:
-            serial_xprt_system_calls.read(NULL);
-            break;
-        case 4:
-            serial_xprt_system_calls.open(NULL);
-            break;
-        case 5:
-            serial_xprt_system_calls.close(NULL);
-            break;
-        case 6:
-            serial_xprt_system_calls.create(NULL);
-            break;
-        case 7:
-            serial_xprt_system_calls.link(NULL);
-            break;
-        case 8:
-            serial_xprt_system_calls.unlink(NULL);
-            break;
-        case 9:
-            serial_xprt_system_calls.chdir(NULL);
-            break;
-        case 10:
-            serial_xprt_system_calls.chmod(NULL);
-            break;
-        case 11:
-            serial_xprt_system_calls.lseek(NULL);
-            break;
-        case 12:
-            serial_xprt_system_calls.time(NULL);
-            break;
-        case 13:
-            serial_xprt_system_calls.stat(NULL);
-            break;
-        case 14:
-            serial_xprt_system_calls.utime(NULL);
-            break;
-        case 15:
-            printf("command 15 should not happen... (but it did)\n");
-            break;
-        case 16:
-            serial_xprt_system_calls.opendir(NULL);
-            break;
-        case 17:
-            serial_xprt_system_calls.closedir(NULL);
-            break;
-        case 18:
-            serial_xprt_system_calls.readdir(NULL);
-            break;
-        case 19:
-            serial_xprt_system_calls.cdfs_redir_read_sectors(isofd, NULL);
-            break;
-        case 20:
-            serial_xprt_system_calls.gdbpacket(NULL);
-            break;
-        case 21:
-            serial_xprt_system_calls.rewinddir(NULL);
-            break;
-        default:
-            printf("Unimplemented command (%d) \n", command);
-            printf("Assuming program has exited, or something...\n");
-            return -1;
+    if (command >= DC_SYSCALL_MAX) {
+        printf("Unimplemented command (%d) \n", command);
+        printf("Assuming program has exited, or something...\n");
+        return -1;
     }
 
+    /* the serial handlers report errors to the target, not to us */
+    if (dc_syscall_dispatch(&serial_xprt_system_calls, command, disc, NULL, 1, dc_syscall_now()) == 1)
+        return 1;
+
     return 0;
 }
 
@@ -755,6 +799,14 @@ int serial_xprt_execute(unsigned dcaddr, unsigned console, unsigned cdfsredir)
         c = 'H';
         serial_xprt_write_bytes(&c, 1);
         serial_xprt_read_bytes(&c, 1);
+
+        /* without it dcload-serial makes up a single track TOC instead of
+         * asking for the image's */
+        c = 'T';
+        if (serial_has_cap(c)) {
+            serial_xprt_write_bytes(&c, 1);
+            serial_xprt_read_bytes(&c, 1);
+        }
     }
 
     printf("Sending execute command (0x%x, console=%d)...", dcaddr, console);
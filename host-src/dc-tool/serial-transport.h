@@ -24,10 +24,14 @@
 
 #include <sys/types.h>
 
+#include "disc-image.h"
+
 int serial_xprt_send_data(void *data, size_t len, unsigned dcaddr);
+int serial_xprt_fill_data(unsigned dcaddr, size_t len, unsigned char value);
+int serial_xprt_hash_data(unsigned dcaddr, size_t len, unsigned chunk, unsigned int *hashes);
 int serial_xprt_recv_data(unsigned dcaddr, size_t len, void *dst);
 int serial_xprt_recv_data_quiet(unsigned dcaddr, size_t len, void *dst);
-int serial_xprt_dispatch_commands(int isofd);
+int serial_xprt_dispatch_commands(disc_image_t *disc);
 int serial_xprt_execute(unsigned dcaddr, unsigned console, unsigned cdfsredir);
 
 int serial_xprt_read_bytes(void *data, size_t len);
@@ -36,9 +40,11 @@ int serial_xprt_write_uint(unsigned value);
 int serial_xprt_read_uint();
 
 /* The _chunk() functions read and write len bytes of data over the serial
- * transport, but they do so chunks that may be compressed.
+ * transport, but they do so chunks that may be compressed. skip reads them
+ * and throws them away.
  */
 int serial_xprt_read_chunk(void *data, size_t len);
+int serial_xprt_skip_chunk(size_t len);
 int serial_xprt_write_chunk(void *data, size_t len);
 
 #define SERIAL_XPRT_FLAG_SPEEDHACK  (1u << 0)
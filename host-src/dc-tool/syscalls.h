@@ -22,6 +22,8 @@
 #ifndef __SYSCALLS_H__
 #define __SYSCALLS_H__
 
+#include "disc-image.h"
+
 struct dc_system_calls {
     int (*fstat)(unsigned char * buffer);
     int (*write)(unsigned char * buffer);
@@ -43,9 +45,15 @@ struct dc_system_calls {
     int (*closedir)(unsigned char * buffer);
     int (*rewinddir)(unsigned char * buffer);
 
-    int (*cdfs_redir_read_sectors)(int isofd, unsigned char * buffer);
+    int (*cdfs_redir_read_sectors)(disc_image_t *disc, unsigned char * buffer);
+    int (*cdfs_toc)(disc_image_t *disc, unsigned char * buffer);
 
     int (*gdbpacket)(unsigned char * buffer);
+
+    int (*pread)(unsigned char * buffer);
+    int (*preadv)(unsigned char * buffer);
+    int (*readdirplus)(unsigned char * buffer);
+    int (*stagemem)(unsigned char * buffer);
 };
 
 typedef struct dc_system_calls dc_system_calls_t;
@@ -53,4 +61,64 @@ typedef struct dc_system_calls dc_system_calls_t;
 extern const dc_system_calls_t ip_xprt_system_calls;
 extern const dc_system_calls_t serial_xprt_system_calls;
 
+/* syscall numbers, as in the serial command byte and the digits of the IP
+ * "DCnn" command id */
+enum {
+    DC_SYSCALL_EXIT,
+    DC_SYSCALL_FSTAT,
+    DC_SYSCALL_WRITE,
+    DC_SYSCALL_READ,
+    DC_SYSCALL_OPEN,
+    DC_SYSCALL_CLOSE,
+    DC_SYSCALL_CREAT,
+    DC_SYSCALL_LINK,
+    DC_SYSCALL_UNLINK,
+    DC_SYSCALL_CHDIR,
+    DC_SYSCALL_CHMOD,
+    DC_SYSCALL_LSEEK,
+    DC_SYSCALL_TIME,
+    DC_SYSCALL_STAT,
+    DC_SYSCALL_UTIME,
+    DC_SYSCALL_BAD,
+    DC_SYSCALL_OPENDIR,
+    DC_SYSCALL_CLOSEDIR,
+    DC_SYSCALL_READDIR,
+    DC_SYSCALL_CDFSREAD,
+    DC_SYSCALL_GDBPACKET,
+    DC_SYSCALL_REWINDDIR,
+    DC_SYSCALL_PREAD,
+    DC_SYSCALL_PREADV,
+    DC_SYSCALL_READDIRPLUS,
+    DC_SYSCALL_STAGEMEM,
+    DC_SYSCALL_CDFSTOC,
+    DC_SYSCALL_MAX
+};
+
+/* dc_syscall_now is the time in usec on the clock the statistics use.
+ * Transports stamp each request with it as it arrives. */
+unsigned long long dc_syscall_now(void);
+
+/* dc_syscall_dispatch runs syscall number opcode through calls. len is the
+ * number of bytes the request took to arrive, and arrived the dc_syscall_now
+ * it came in at, for the statistics. A request that waited to be dispatched
+ * has the wait counted in its latency.
+ *
+ * Returns the same as xprt_dispatch_t: -1 on error, 0 to continue
+ * dispatching or 1 once the program has exited.
+ */
+int dc_syscall_dispatch(const dc_system_calls_t *calls, unsigned int opcode, disc_image_t *disc,
+                        unsigned char *buffer, unsigned int len, unsigned long long arrived);
+
+/* dc_syscall_count adds to the bytes in and out of the syscall being
+ * dispatched, if any. Transports call it for everything they move. */
+void dc_syscall_count(unsigned int in, unsigned int out);
+
+/* dc_syscall_alloc and dc_syscall_copied count the buffers allocated and
+ * the bytes of data copied on the host for the syscall being dispatched */
+void dc_syscall_alloc(void);
+void dc_syscall_copied(unsigned int bytes);
+
+/* dc_syscall_poll dumps the statistics if SIGUSR1 asked for them */
+void dc_syscall_poll(void);
+
 #endif /* __SYSCALLS_H__ */
@@ -0,0 +1,308 @@
+/*
+ * dc-tool, a tool for use with the dcload loader
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+/* Only the target's headers are seen here, the host ones define their own
+ * command_t. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "bin_map.h"
+#include "bswap.h"
+#include "fake-dcload.h"
+
+/* the Dreamcast is little endian too */
+unsigned short bswap16(unsigned short x)
+{
+    return __builtin_bswap16(x);
+}
+
+unsigned int bswap32(unsigned int x)
+{
+    return __builtin_bswap32(x);
+}
+
+static int sock = -1;
+static pthread_t thread;
+static volatile int stopping;
+
+static unsigned int offer;
+static unsigned char *memory;
+static unsigned char attempts[BIN_MAP_CHUNKS];
+static fake_drop_t dropper;
+static fake_stats_t stats;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void reply(struct sockaddr_in *to, void *data, int len)
+{
+    sendto(sock, data, len, 0, (struct sockaddr *)to, sizeof(*to));
+}
+
+static void loadbin(command_t *command, int len)
+{
+    unsigned int size = BIN_CHUNK_LEGACY;
+
+    if (len >= COMMAND_LEN + 4) {
+        memcpy(&size, command->data, 4);
+        size = bswap32(size);
+        if (size < BIN_CHUNK_LEGACY || size > BIN_CHUNK_MAX)
+            size = BIN_CHUNK_LEGACY;
+    }
+
+    bin_info.chunk_size = size;
+    bin_info.nsegments = 0;
+    bin_add_segment(bswap32(command->address), bswap32(command->size));
+    memset(bin_info.map, 0, sizeof(bin_info.map));
+    memset(attempts, 0, sizeof(attempts));
+}
+
+static void partbin(command_t *command, int len)
+{
+    bin_segment_t *seg = bin_info.segments;
+    unsigned int address = bswap32(command->address);
+    unsigned int size = bswap32(command->size);
+    unsigned int chunk;
+
+    if (size != len - COMMAND_LEN || address < FAKE_DCLOAD_BASE
+        || address - FAKE_DCLOAD_BASE + size > FAKE_DCLOAD_MEMORY)
+        return;
+
+    if (bin_info.nsegments && address - seg->address < seg->size) {
+        chunk = (address - seg->address) / bin_chunk();
+        pthread_mutex_lock(&lock);
+        if (dropper && dropper(chunk, seg->chunks, attempts[chunk])) {
+            if (attempts[chunk] < 255)
+                attempts[chunk]++;
+            stats.dropped++;
+            pthread_mutex_unlock(&lock);
+            return;
+        }
+        if (attempts[chunk] < 255)
+            attempts[chunk]++;
+        pthread_mutex_unlock(&lock);
+    }
+
+    memcpy(memory + (address - FAKE_DCLOAD_BASE), command->data, size);
+    bin_map_mark(address);
+}
+
+static int donebin(command_t *response)
+{
+    int n;
+
+    memcpy(response->id, CMD_DONEBIN, 4);
+    n = bin_map_missing(response);
+
+    pthread_mutex_lock(&lock);
+    stats.donebins++;
+    if (n > stats.max_ranges)
+        stats.max_ranges = n;
+    pthread_mutex_unlock(&lock);
+
+    return COMMAND_LEN + n * sizeof(bin_range_t);
+}
+
+static void *serve(void *arg)
+{
+    static unsigned char buffer[2048], out[COMMAND_LEN + 1024];
+    command_t *command = (command_t *)buffer;
+    command_t *response = (command_t *)out;
+    struct sockaddr_in from;
+    socklen_t fromlen;
+    struct timeval tv;
+    fd_set fds;
+    int len;
+
+    while (!stopping) {
+        FD_ZERO(&fds);
+        FD_SET(sock, &fds);
+        tv.tv_sec = 0;
+        tv.tv_usec = 50000;
+        if (select(sock + 1, &fds, NULL, NULL, &tv) <= 0)
+            continue;
+
+        fromlen = sizeof(from);
+        len = recvfrom(sock, buffer, sizeof(buffer), 0, (struct sockaddr *)&from, &fromlen);
+        if (len < COMMAND_LEN)
+            continue;
+
+        if (!memcmp(command->id, CMD_VERSION, 4)) {
+            memcpy(response->id, CMD_VERSION, 4);
+            response->address = bswap32(DCLOAD_CAP_PRESENT);
+            response->size = bswap32(offer);
+            reply(&from, response, COMMAND_LEN);
+        } else if (!memcmp(command->id, CMD_LOADBIN, 4)) {
+            loadbin(command, len);
+            reply(&from, command, COMMAND_LEN);
+        } else if (!memcmp(command->id, CMD_PARTBIN, 4)) {
+            partbin(command, len);
+        } else if (!memcmp(command->id, CMD_DONEBIN, 4)) {
+            reply(&from, response, donebin(response));
+        }
+    }
+
+    return NULL;
+}
+
+int fake_dcload_start(unsigned int chunk_size)
+{
+    struct sockaddr_in sin;
+
+    if (!(memory = calloc(FAKE_DCLOAD_MEMORY, 1)))
+        return -1;
+
+    if ((sock = socket(PF_INET, SOCK_DGRAM, 0)) < 0) {
+        perror("socket");
+        return -1;
+    }
+
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(31313);
+    sin.sin_addr.s_addr = inet_addr("127.0.0.1");
+    if (bind(sock, (struct sockaddr *)&sin, sizeof(sin)) < 0) {
+        perror("bind");
+        close(sock);
+        return -1;
+    }
+
+    offer = chunk_size;
+    stopping = 0;
+    if (pthread_create(&thread, NULL, serve, NULL)) {
+        close(sock);
+        return -1;
+    }
+
+    return 0;
+}
+
+void fake_dcload_stop(void)
+{
+    stopping = 1;
+    pthread_join(thread, NULL);
+    close(sock);
+    free(memory);
+}
+
+void fake_dcload_drop(fake_drop_t drop)
+{
+    pthread_mutex_lock(&lock);
+    dropper = drop;
+    memset(&stats, 0, sizeof(stats));
+    pthread_mutex_unlock(&lock);
+}
+
+unsigned char *fake_dcload_memory(unsigned int address)
+{
+    return memory + (address - FAKE_DCLOAD_BASE);
+}
+
+void fake_dcload_stats(fake_stats_t *out)
+{
+    pthread_mutex_lock(&lock);
+    *out = stats;
+    pthread_mutex_unlock(&lock);
+}
+
+/* the range list checks below use a segment of 600 chunks whose last one is
+ * short, with only the odd chunks missing */
+#define CHECK_ADDRESS 0x8c010000
+#define CHECK_CHUNKS  600
+#define CHECK_SIZE    (CHECK_CHUNKS * BIN_CHUNK_LEGACY - 100)
+
+static int check_range(command_t *response, int n, int want, unsigned int first, unsigned int last, unsigned int last_size)
+{
+    bin_range_t *range = (bin_range_t *)response->data;
+
+    if (n != want) {
+        printf("  expected %d ranges, got %d\n", want, n);
+        return 1;
+    }
+    if (!n)
+        return bswap32(response->size) ? 1 : 0;
+
+    if (bswap32(response->address) != bswap32(range[0].address)
+        || bswap32(response->size) != BIN_CHUNK_LEGACY) {
+        printf("  header doesn't name the first missing chunk\n");
+        return 1;
+    }
+    if (bswap32(range[0].address) != first
+        || bswap32(range[n - 1].address) != last
+        || bswap32(range[n - 1].size) != last_size) {
+        printf("  ranges 0x%x..0x%x+%u, expected 0x%x..0x%x+%u\n",
+               bswap32(range[0].address), bswap32(range[n - 1].address), bswap32(range[n - 1].size),
+               first, last, last_size);
+        return 1;
+    }
+
+    return 0;
+}
+
+int fake_dcload_check_ranges(void)
+{
+    static unsigned char out[COMMAND_LEN + 1024];
+    command_t *response = (command_t *)out;
+    unsigned int i, chunk = BIN_CHUNK_LEGACY;
+    int failed = 0;
+
+    bin_info.chunk_size = chunk;
+    bin_info.nsegments = 0;
+    bin_add_segment(CHECK_ADDRESS, CHECK_SIZE);
+    memset(bin_info.map, 0, sizeof(bin_info.map));
+
+    printf("range list: everything missing\n");
+    failed += check_range(response, bin_map_missing(response), 1, CHECK_ADDRESS, CHECK_ADDRESS, CHECK_SIZE);
+
+    /* more holes than fit in a reply come DONEBIN_MAX_RANGES at a time */
+    for (i = 0; i < CHECK_CHUNKS; i += 2)
+        bin_map_mark(CHECK_ADDRESS + i * chunk);
+
+    printf("range list: 300 ranges\n");
+    failed += check_range(response, bin_map_missing(response), DONEBIN_MAX_RANGES,
+                          CHECK_ADDRESS + chunk, CHECK_ADDRESS + 255 * chunk, chunk);
+    for (i = 1; i < 256; i += 2)
+        bin_map_mark(CHECK_ADDRESS + i * chunk);
+    failed += check_range(response, bin_map_missing(response), DONEBIN_MAX_RANGES,
+                          CHECK_ADDRESS + 257 * chunk, CHECK_ADDRESS + 511 * chunk, chunk);
+    for (i = 257; i < 512; i += 2)
+        bin_map_mark(CHECK_ADDRESS + i * chunk);
+    failed += check_range(response, bin_map_missing(response), 44,
+                          CHECK_ADDRESS + 513 * chunk, CHECK_ADDRESS + 599 * chunk, chunk - 100);
+    for (i = 513; i < CHECK_CHUNKS; i += 2)
+        bin_map_mark(CHECK_ADDRESS + i * chunk);
+    failed += check_range(response, bin_map_missing(response), 0, 0, 0, 0);
+
+    /* a hole across map words, after a second segment is added */
+    bin_add_segment(CHECK_ADDRESS + CHECK_SIZE, 100 * chunk);
+    for (i = 0; i < 100; i++)
+        if (i < 30 || i > 70)
+            bin_map_mark(CHECK_ADDRESS + CHECK_SIZE + i * chunk);
+
+    printf("range list: hole in a second segment\n");
+    failed += check_range(response, bin_map_missing(response), 1,
+                          CHECK_ADDRESS + CHECK_SIZE + 30 * chunk, CHECK_ADDRESS + CHECK_SIZE + 30 * chunk, 41 * chunk);
+
+    return failed;
+}
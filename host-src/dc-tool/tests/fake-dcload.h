@@ -0,0 +1,32 @@
+#ifndef __FAKE_DCLOAD_H__
+#define __FAKE_DCLOAD_H__
+
+/* A dcload-ip stand-in for the transfer tests. It answers on 127.0.0.1 like
+ * the real one and keeps track of chunks with the target's own bin_map.c, so
+ * the host repair loop talks to the code the Dreamcast runs.
+ */
+
+#define FAKE_DCLOAD_BASE   0x8c000000
+#define FAKE_DCLOAD_MEMORY (16 * 1024 * 1024)
+
+/* return non-zero to lose the attempt'th copy (from 0) of chunk */
+typedef int (*fake_drop_t)(unsigned int chunk, unsigned int chunks, unsigned int attempt);
+
+typedef struct {
+    unsigned int donebins;   /* DONEBIN requests answered */
+    unsigned int max_ranges; /* longest range list in a reply */
+    unsigned int dropped;    /* PARTBINs thrown away */
+} fake_stats_t;
+
+/* chunk_size is what VERS offers */
+int fake_dcload_start(unsigned int chunk_size);
+void fake_dcload_stop(void);
+
+void fake_dcload_drop(fake_drop_t drop);
+unsigned char *fake_dcload_memory(unsigned int address);
+void fake_dcload_stats(fake_stats_t *stats);
+
+/* checks of the range list encoding on its own, returns the failures */
+int fake_dcload_check_ranges(void);
+
+#endif
@@ -0,0 +1,437 @@
+/*
+ * dc-tool, a tool for use with the dcload loader
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+/* Runs dcload-ip's GD-ROM DMA emulation (cdfs_syscalls.c) and its queue of
+ * non-blocking requests (aio.c) natively. The network adapter is faked: what
+ * build_send_packet puts on the wire is queued here, and the adapter's loop
+ * and poll answer it the way dc-tool does, in order, handing each RETV on
+ * like cmd_retval. The target passes buffers as 32 bit addresses, so this is
+ * linked without PIE and every buffer is static.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "syscalls.h"
+#include "packet.h"
+#include "net.h"
+#include "adapter.h"
+#include "commands.h"
+#include "cdfs.h"
+#include "bswap.h"
+
+/* the GD-ROM syscalls, as the syscall table calls them */
+int gdGdcReqCmd(int cmd, int *param);
+int gdGdcGetCmdStat(int f, int *status);
+void gdGdcG1DmaEnd(void (*func)(void *), void *param);
+int gdGdcReqDmaTrans(int f, int *params);
+int gdGdcCheckDmaTrans(int f, unsigned int *size);
+int gdGdcReadAbort(int f);
+
+#define SECTOR 2048
+#define TIME_RETVAL 0x12345678
+
+unsigned char pkt_buf[1514];
+unsigned int escape_loop;
+unsigned int syscall_retval;
+
+static int failed;
+
+#define CHECK(x) do { \
+        if (!(x)) { \
+            printf("  %s:%d: %s\n", __FILE__, __LINE__, #x); \
+            failed++; \
+        } \
+    } while (0)
+
+unsigned short bswap16(unsigned short x)
+{
+    return __builtin_bswap16(x);
+}
+
+unsigned int bswap32(unsigned int x)
+{
+    return __builtin_bswap32(x);
+}
+
+/* the requests on the wire, oldest first */
+#define WIRE_MAX 8
+
+static command_4int_t wire[WIRE_MAX];
+static int wire_count;
+
+static int unstaged;        /* calls to unstage */
+static int latency;         /* polls before dc-tool answers */
+static int fail_reads;      /* answer CDFSREAD with -1 */
+static int hung;            /* loop ran out of requests to answer */
+
+void build_send_packet(int command_len)
+{
+    unsigned char *command = pkt_buf + ETHER_H_LEN + IP_H_LEN + UDP_H_LEN;
+
+    if (wire_count == WIRE_MAX) {
+        printf("  too many requests on the wire\n");
+        failed++;
+        return;
+    }
+
+    memcpy(&wire[wire_count++], command, command_len < sizeof(command_4int_t) ? command_len : sizeof(command_4int_t));
+}
+
+/* only AIO_CDFSREAD is queued here */
+void send_read(int fd, void *buf, size_t count)
+{
+    failed++;
+}
+
+void send_write(int fd, const void *buf, size_t count)
+{
+    failed++;
+}
+
+void send_pread(int fd, void *buf, size_t count, off_t offset)
+{
+    failed++;
+}
+
+void unstage(void)
+{
+    unstaged++;
+}
+
+void staged(int fd, unsigned int len)
+{
+}
+
+static unsigned char pattern(unsigned int sector, unsigned int i)
+{
+    return sector * 7 + i;
+}
+
+/* answer the oldest request, as dc-tool and then cmd_retval would */
+static void answer(void)
+{
+    command_4int_t request = wire[0];
+    unsigned int sector, size, i;
+    unsigned char *buf;
+    unsigned int retval = -1;
+
+    memmove(wire, wire + 1, --wire_count * sizeof(wire[0]));
+
+    if (!memcmp(request.id, CMD_CDFSREAD, 4)) {
+        sector = ntohl(request.value0);
+        buf = (unsigned char *)(unsigned long)ntohl(request.value1);
+        size = ntohl(request.value2);
+
+        if (!fail_reads) {
+            for (i = 0; i < size; i++)
+                buf[i] = pattern(sector + i / SECTOR, i % SECTOR);
+            retval = size;
+        }
+    } else if (!memcmp(request.id, CMD_CDFSTOC, 4)) {
+        buf = (unsigned char *)(unsigned long)ntohl(request.value1);
+        memset(buf, 0x5a, ntohl(request.value2));
+        retval = 0;
+    } else if (!memcmp(request.id, CMD_TIME, 4)) {
+        retval = TIME_RETVAL;
+    }
+
+    if (aio_retval(retval, 0))
+        return;
+
+    syscall_retval = retval;
+    escape_loop = 1;
+}
+
+static void fake_start(void)
+{
+}
+
+static void fake_stop(void)
+{
+}
+
+static void fake_loop(void)
+{
+    escape_loop = 0;
+    while (!escape_loop) {
+        if (!wire_count) {
+            hung = 1;
+            return;
+        }
+        answer();
+    }
+}
+
+static void fake_poll(void)
+{
+    if (latency) {
+        latency--;
+        return;
+    }
+
+    if (wire_count)
+        answer();
+}
+
+static int fake_tx(unsigned char *pkt, int len)
+{
+    return 0;
+}
+
+static adapter_t fake = {
+    .name = "fake",
+    .start = fake_start,
+    .stop = fake_stop,
+    .loop = fake_loop,
+    .poll = fake_poll,
+    .tx = fake_tx,
+};
+
+adapter_t *bb = &fake;
+
+static int dma_ends;
+static void *dma_end_param;
+
+static void dma_end(void *param)
+{
+    dma_ends++;
+    dma_end_param = param;
+}
+
+static unsigned char buffer[16 * SECTOR];
+static unsigned char other[4 * SECTOR];
+
+static int check_sectors(unsigned char *buf, unsigned int sector, unsigned int count)
+{
+    unsigned int i;
+
+    for (i = 0; i < count * SECTOR; i++)
+        if (buf[i] != pattern(sector + i / SECTOR, i % SECTOR))
+            return 0;
+
+    return 1;
+}
+
+static void reset(void)
+{
+    cdfs_dma_reset();
+    aio_reset();
+    gdGdcG1DmaEnd(dma_end, buffer);
+    memset(buffer, 0, sizeof(buffer));
+    memset(other, 0, sizeof(other));
+    wire_count = 0;
+    unstaged = 0;
+    latency = 0;
+    fail_reads = 0;
+    hung = 0;
+    dma_ends = 0;
+    dma_end_param = 0;
+}
+
+/* what syscalls.c does for time() */
+static unsigned int blocking_time(void)
+{
+    command_3int_t *command = (command_3int_t *)(pkt_buf + ETHER_H_LEN + IP_H_LEN + UDP_H_LEN);
+
+    memcpy(command->id, CMD_TIME, 4);
+    command->value0 = htonl(0);
+    command->value1 = htonl(0);
+    command->value2 = htonl(0);
+    build_send_packet(sizeof(command_3int_t));
+    bb->loop();
+
+    return syscall_retval;
+}
+
+static void test_read_dma(void)
+{
+    int param[4] = { 100, 4, (int)(unsigned long)buffer, 0 };
+    int status[4];
+
+    printf("gdrom: cmd 17\n");
+    reset();
+    latency = 2;
+
+    CHECK(gdGdcReqCmd(17, param) == 0);
+    CHECK(gdGdcGetCmdStat(0, status) == 1);
+    CHECK(gdGdcGetCmdStat(0, status) == 1);
+    CHECK(dma_ends == 0);
+    CHECK(gdGdcGetCmdStat(0, status) == 2);
+    CHECK(dma_ends == 1 && dma_end_param == buffer);
+    CHECK(check_sectors(buffer, 100, 4));
+    CHECK(unstaged == 1);
+
+    /* no second callback for the same read */
+    CHECK(gdGdcGetCmdStat(0, status) == 2);
+    CHECK(dma_ends == 1);
+}
+
+static void test_read_dma_fails(void)
+{
+    int param[4] = { 100, 4, (int)(unsigned long)buffer, 0 };
+    int status[4] = { -1 };
+
+    printf("gdrom: cmd 17 that dc-tool can't read\n");
+    reset();
+    fail_reads = 1;
+
+    CHECK(gdGdcReqCmd(17, param) == 0);
+    CHECK(gdGdcGetCmdStat(0, status) == -1);
+    CHECK(status[0] == 0);
+    CHECK(dma_ends == 1);
+}
+
+static void test_stream(int cmd)
+{
+    int param[4] = { 200, 8, 0, 0 };
+    int trans[2] = { (int)(unsigned long)buffer, 4 * SECTOR };
+    int odd[2] = { (int)(unsigned long)buffer, SECTOR + 1 };
+    int big[2] = { (int)(unsigned long)buffer, 5 * SECTOR };
+    int status[4];
+    unsigned int size;
+
+    printf("gdrom: cmd %d\n", cmd);
+    reset();
+
+    CHECK(gdGdcReqCmd(cmd, param) == 0);
+    CHECK(gdGdcGetCmdStat(0, status) == 3);
+    CHECK(wire_count == 0);
+
+    /* only whole sectors of what's left */
+    CHECK(gdGdcReqDmaTrans(0, odd) == -1);
+    CHECK(gdGdcReqDmaTrans(0, (int[2]){ trans[0], 0 }) == -1);
+
+    latency = 1;
+    CHECK(gdGdcReqDmaTrans(0, trans) == 0);
+    CHECK(wire_count == 1);
+    CHECK(gdGdcCheckDmaTrans(0, &size) == 0 && size == 4 * SECTOR);
+
+    /* one piece at a time */
+    CHECK(gdGdcReqDmaTrans(0, trans) == -1);
+
+    CHECK(gdGdcCheckDmaTrans(0, &size) == 0 && size == 0);
+    CHECK(dma_ends == 1);
+    CHECK(gdGdcGetCmdStat(0, status) == 3);
+    CHECK(check_sectors(buffer, 200, 4));
+
+    CHECK(gdGdcReqDmaTrans(0, big) == -1);
+    trans[0] = (int)(unsigned long)(buffer + 4 * SECTOR);
+    CHECK(gdGdcReqDmaTrans(0, trans) == 0);
+    CHECK(gdGdcCheckDmaTrans(0, &size) == 0 && size == 0);
+    CHECK(dma_ends == 2);
+    CHECK(gdGdcGetCmdStat(0, status) == 2);
+    CHECK(check_sectors(buffer, 200, 8));
+    CHECK(unstaged == 2);
+
+    /* the stream is used up */
+    CHECK(gdGdcReqDmaTrans(0, trans) == -1);
+}
+
+static void test_abort(void)
+{
+    int param[4] = { 300, 8, 0, 0 };
+    int trans[2] = { (int)(unsigned long)buffer, 2 * SECTOR };
+    int status[4];
+
+    printf("gdrom: ReadAbort in a stream\n");
+    reset();
+
+    CHECK(gdGdcReqCmd(38, param) == 0);
+    latency = 100;
+    CHECK(gdGdcReqDmaTrans(0, trans) == 0);
+    latency = 0;
+
+    /* the read on the wire still lands */
+    CHECK(gdGdcReadAbort(0) == 0);
+    CHECK(check_sectors(buffer, 300, 2));
+    CHECK(dma_ends == 1);
+    CHECK(gdGdcGetCmdStat(0, status) == 0);
+    CHECK(gdGdcReqDmaTrans(0, trans) == -1);
+    CHECK(wire_count == 0);
+}
+
+static void test_blocking(void)
+{
+    int dma[4] = { 400, 2, (int)(unsigned long)buffer, 0 };
+    int pio[4] = { 500, 2, (int)(unsigned long)other, 0 };
+    int status[4];
+
+    printf("gdrom: blocking calls during a dma read\n");
+    reset();
+
+    /* dc-tool answers the read first, and the loop carries on to the
+     * answer for time */
+    latency = 100;
+    CHECK(gdGdcReqCmd(17, dma) == 0);
+    CHECK(blocking_time() == TIME_RETVAL);
+    CHECK(!hung);
+    CHECK(check_sectors(buffer, 400, 2));
+    CHECK(dma_ends == 0);
+    CHECK(gdGdcGetCmdStat(0, status) == 2);
+    CHECK(dma_ends == 1);
+
+    /* a PIO read settles the DMA read first */
+    reset();
+    latency = 100;
+    CHECK(gdGdcReqCmd(17, dma) == 0);
+    CHECK(gdGdcReqCmd(16, pio) == 0);
+    CHECK(!hung);
+    CHECK(dma_ends == 1);
+    CHECK(check_sectors(buffer, 400, 2));
+    CHECK(check_sectors(other, 500, 2));
+    CHECK(gdGdcGetCmdStat(0, status) == 2);
+}
+
+static void test_toc(void)
+{
+    static unsigned int toc[102];
+    int param[2] = { 0, (int)(unsigned long)toc };
+    int status[4];
+
+    printf("gdrom: cmd 19\n");
+    reset();
+
+    /* a dc-tool that didn't say it sends the TOC never sees CDFSTOC */
+    cdfs_host_toc = 0;
+    CHECK(gdGdcReqCmd(19, param) == 0);
+    CHECK(wire_count == 0);
+    CHECK(toc[0] == 0x41000096 && toc[1] == 0xffffffff && toc[99] == 0x41010000);
+    CHECK(gdGdcGetCmdStat(0, status) == 2);
+
+    cdfs_host_toc = 1;
+    CHECK(gdGdcReqCmd(19, param) == 0);
+    CHECK(!hung);
+    CHECK(toc[0] == 0x5a5a5a5a && toc[101] == 0x5a5a5a5a);
+    CHECK(gdGdcGetCmdStat(0, status) == 2);
+    cdfs_host_toc = 0;
+}
+
+int main(int argc, char *argv[])
+{
+    test_read_dma();
+    test_read_dma_fails();
+    test_stream(28);
+    test_stream(38);
+    test_abort();
+    test_blocking();
+    test_toc();
+
+    printf("%s\n", failed ? "FAILED" : "passed");
+    return failed ? 1 : 0;
+}
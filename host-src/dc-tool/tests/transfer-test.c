@@ -0,0 +1,152 @@
+/*
+ * dc-tool, a tool for use with the dcload loader
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+/* Uploads through ip_xprt_send_data to the fake dcload-ip in fake-dcload.c,
+ * losing chunks in the patterns below, and checks that the repair loop
+ * puts every byte in place. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "ip-transport.h"
+#include "fake-dcload.h"
+
+/* 1024 byte chunks put 256 in a window, so losing every other one fills
+ * a DONEBIN range list */
+#define CHUNK   IP_XPRT_LEGACY_CHUNK
+#define ADDRESS 0x8c010000
+
+static int drop_none(unsigned int chunk, unsigned int chunks, unsigned int attempt)
+{
+    return 0;
+}
+
+static int drop_first(unsigned int chunk, unsigned int chunks, unsigned int attempt)
+{
+    return chunk == 0 && attempt == 0;
+}
+
+static int drop_last(unsigned int chunk, unsigned int chunks, unsigned int attempt)
+{
+    return chunk == chunks - 1 && attempt == 0;
+}
+
+static int drop_first_twice(unsigned int chunk, unsigned int chunks, unsigned int attempt)
+{
+    return chunk == 0 && attempt < 2;
+}
+
+static int drop_all(unsigned int chunk, unsigned int chunks, unsigned int attempt)
+{
+    return attempt == 0;
+}
+
+static int drop_odd(unsigned int chunk, unsigned int chunks, unsigned int attempt)
+{
+    return (chunk & 1) && attempt == 0;
+}
+
+typedef struct {
+    const char *name;
+    fake_drop_t drop;
+    unsigned int size;
+    unsigned int min_donebins; /* at least this many DONEBIN round trips */
+    unsigned int min_ranges;   /* and a reply listing this many ranges */
+} transfer_case_t;
+
+static const transfer_case_t cases[] = {
+    { "nothing lost",                drop_none,        100 * CHUNK,        1, 0 },
+    { "first chunk lost",            drop_first,       100 * CHUNK,        2, 1 },
+    { "last chunk lost",             drop_last,        100 * CHUNK + 123,  2, 1 },
+    { "first chunk lost twice",      drop_first_twice, 100 * CHUNK,        3, 1 },
+    { "everything lost",             drop_all,         100 * CHUNK + 1,    2, 1 },
+    { "every other chunk lost",      drop_odd,         600 * CHUNK - 100,  3, 128 },
+};
+
+static int run_case(const transfer_case_t *test, unsigned char *image)
+{
+    fake_stats_t stats;
+    unsigned int i;
+
+    printf("transfer: %s\n", test->name);
+
+    for (i = 0; i < test->size; i++)
+        image[i] = rand();
+    memset(fake_dcload_memory(ADDRESS), 0, test->size);
+
+    fake_dcload_drop(test->drop);
+    if (ip_xprt_send_data(image, test->size, ADDRESS) == -1) {
+        printf("  ip_xprt_send_data failed\n");
+        return 1;
+    }
+    fake_dcload_stats(&stats);
+    fake_dcload_drop(NULL);
+
+    if (memcmp(fake_dcload_memory(ADDRESS), image, test->size)) {
+        printf("  target memory doesn't match the image\n");
+        return 1;
+    }
+    if (stats.donebins < test->min_donebins || stats.max_ranges < test->min_ranges) {
+        printf("  %u DONEBINs listing up to %u ranges, expected %u and %u\n",
+               stats.donebins, stats.max_ranges, test->min_donebins, test->min_ranges);
+        return 1;
+    }
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    char home[] = "/tmp/transfer-test.XXXXXX";
+    char rates[sizeof(home) + 32];
+    unsigned char *image;
+    unsigned int i;
+    int failed;
+
+    failed = fake_dcload_check_ranges();
+
+    /* keep the measured rates away from the user's own */
+    if (!mkdtemp(home))
+        return 1;
+    setenv("HOME", home, 1);
+
+    if (fake_dcload_start(CHUNK) == -1)
+        return 1;
+    if (ip_xprt_initialize("127.0.0.1") == -1)
+        return 1;
+
+    if (!(image = malloc(1024 * 1024)))
+        return 1;
+    srand(1);
+
+    for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+        failed += run_case(&cases[i], image);
+
+    ip_xprt_cleanup();
+    fake_dcload_stop();
+    free(image);
+
+    snprintf(rates, sizeof(rates), "%s/.dc-tool-rates", home);
+    unlink(rates);
+    rmdir(home);
+
+    printf("%s\n", failed ? "FAILED" : "passed");
+    return failed ? 1 : 0;
+}
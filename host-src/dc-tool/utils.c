@@ -2,6 +2,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 #ifdef __MINGW32__
 #include <windows.h>
@@ -40,3 +41,15 @@ void wsa_initialize(void)
     atexit(WSACleanup);
 #endif
 }
+
+int read_at(int fd, void *buf, unsigned int count, unsigned int offset)
+{
+#ifndef __MINGW32__
+    return pread(fd, buf, count, offset);
+#else
+    if (lseek(fd, offset, SEEK_SET) == -1)
+        return -1;
+
+    return read(fd, buf, count);
+#endif
+}
@@ -8,4 +8,10 @@ void log_error( const char * prefix );
  */
 void wsa_initialize(void);
 
+/* read_at reads count bytes at offset in fd into buf without moving the file
+ * position where the host has pread, or with lseek and read where it doesn't.
+ * Returns what read would.
+ */
+int read_at(int fd, void *buf, unsigned int count, unsigned int offset);
+
 #endif /* __UTILS_H__ */
@@ -23,6 +23,13 @@ int dcloadsyscall(unsigned int syscall, ...);
 #define pcclosedir 17
 #define pcreaddir 18
 #define pcgethostinfo 19
+#define pcpreadnr 22
+#define pcpreadvnr 23
+#define pcreaddirplusnr 24
+#define pcstagememnr 25
+#define pcaiosubmitnr 26
+#define pcaiopollnr 27
+#define pcaiocompletenr 28
 
 #define DCLOADMAGICVALUE 0xdeadbeef
 #define DCLOADMAGICADDR  (unsigned int *)0x8c004004
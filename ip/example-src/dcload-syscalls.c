@@ -1,4 +1,5 @@
 #include "dcload-syscall.h"
+#include "dcload-syscalls.h"
 
 int link (const char *oldpath, const char *newpath)
 {
@@ -24,6 +25,62 @@ int lseek (int file, int ptr, int dir)
 	return -1;
 }
 
+int pread (int file, char *ptr, int len, int offset)
+{
+    if (*DCLOADMAGICADDR == DCLOADMAGICVALUE)
+	return dcloadsyscall(pcpreadnr, file, ptr, len, offset);
+    else
+	return -1;
+}
+
+int preadv (int file, const dcload_range_t *ranges, int count)
+{
+    if (*DCLOADMAGICADDR == DCLOADMAGICVALUE)
+	return dcloadsyscall(pcpreadvnr, file, ranges, count);
+    else
+	return -1;
+}
+
+int readdirplus (int dir, void *buf, int size)
+{
+    if (*DCLOADMAGICADDR == DCLOADMAGICVALUE)
+	return dcloadsyscall(pcreaddirplusnr, dir, buf, size);
+    else
+	return -1;
+}
+
+int assign_stagemem (void *buf, int size)
+{
+    if (*DCLOADMAGICADDR == DCLOADMAGICVALUE)
+	return dcloadsyscall(pcstagememnr, buf, size);
+    else
+	return -1;
+}
+
+int aio_submit (dcload_aio_t *aio)
+{
+    if (*DCLOADMAGICADDR == DCLOADMAGICVALUE)
+	return dcloadsyscall(pcaiosubmitnr, aio);
+    else
+	return -1;
+}
+
+int aio_poll (dcload_aio_t *aio)
+{
+    if (*DCLOADMAGICADDR == DCLOADMAGICVALUE)
+	return dcloadsyscall(pcaiopollnr, aio);
+    else
+	return -1;
+}
+
+int aio_complete (dcload_aio_t *aio)
+{
+    if (*DCLOADMAGICADDR == DCLOADMAGICVALUE)
+	return dcloadsyscall(pcaiocompletenr, aio);
+    else
+	return -1;
+}
+
 int write ( int file, char *ptr, int len)
 {
     if (*DCLOADMAGICADDR == DCLOADMAGICVALUE)
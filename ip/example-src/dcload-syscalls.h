@@ -5,9 +5,67 @@
 #define O_WRONLY        1
 #define O_RDWR          2
 
+struct stat;
+
+/* one range of a preadv: len bytes at offset in the file go to buf */
+typedef struct {
+    unsigned int offset;
+    void *buf;
+    unsigned int len;
+} dcload_range_t;
+
+/* the stat in a readdirplus record, laid out like the target's struct stat */
+typedef struct {
+    unsigned short st_dev;
+    unsigned short st_ino;
+    int st_mode;
+    unsigned short st_nlink;
+    unsigned short st_uid;
+    unsigned short st_gid;
+    unsigned short st_rdev;
+    int st_size;
+    int st_atime;
+    int st_spare1;
+    int st_mtime;
+    int st_spare2;
+    int st_ctime;
+    int st_spare3;
+    int st_blksize;
+    int st_blocks;
+    int st_spare4[2];
+} dcload_stat_t;
+
+/* one record of a readdirplus, the next one starts d_reclen bytes on */
+typedef struct {
+    unsigned short d_reclen;
+    unsigned char d_type;
+    unsigned char d_namlen;
+    unsigned int d_ino;
+    dcload_stat_t st;
+    char d_name[];
+} dcload_direntplus_t;
+
+/* a non-blocking read, write or pread. It belongs to dcload from
+ * aio_submit until aio_complete, and so does its buffer */
+typedef struct dcload_aio {
+    int call;                   /* pcreadnr, pcwritenr or pcpreadnr */
+    unsigned int arg[4];        /* fd, buf, count, and the offset for pread */
+    int tag;                    /* yours, dcload leaves it alone */
+    int retval;
+    int state;
+    struct dcload_aio *next;
+} dcload_aio_t;
+
 int link (const char *oldpath, const char *newpath);
 int read (int file, char *ptr, int len);
 int lseek (int file, int ptr, int dir);
+int pread (int file, char *ptr, int len, int offset);
+int preadv (int file, const dcload_range_t *ranges, int count);
+int readdirplus (int dir, void *buf, int size);
+int assign_stagemem (void *buf, int size);
+int aio_submit (dcload_aio_t *aio);
+int aio_poll (dcload_aio_t *aio);
+int aio_complete (dcload_aio_t *aio);
 int write ( int file, char *ptr, int len);
 int close (int file);
 int fstat (int file, struct stat *st);
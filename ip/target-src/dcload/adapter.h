@@ -25,6 +25,9 @@ typedef struct {
 	// Poll for I/O
 	void	(*loop)();
 
+	// Handle any I/O that's waiting, without waiting for more
+	void	(*poll)();
+
 	// Transmit a packet on the adapter
 	int	(*tx)(unsigned char * pkt, int len);
 } adapter_t;
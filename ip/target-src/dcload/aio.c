@@ -0,0 +1,150 @@
+/*
+ * This file is part of the dcload Dreamcast ethernet loader
+ *
+ * Copyright (C) 2001 Andrew Kieschnick <andrewk@austin.rr.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include "syscalls.h"
+#include "adapter.h"
+
+/* The non-blocking syscalls. A program fills in a dcload_aio_t and submits
+ * it, and keeps running while dc-tool works on it, calling aio_poll now and
+ * then so the network gets seen to. dc-tool answers requests in the order
+ * they arrive, so only one is on the wire at a time and the rest wait in a
+ * queue here. A blocking syscall made meanwhile is answered after the one on
+ * the wire, whose RETV cmd_retval hands to aio_retval. */
+
+#define SYSCALL_READ	0
+#define SYSCALL_WRITE	1
+#define SYSCALL_PREAD	22
+
+static dcload_aio_t *aio_head, *aio_tail;
+static dcload_aio_t *aio_sent;
+
+void aio_reset(void)
+{
+	aio_head = aio_tail = 0;
+	aio_sent = 0;
+}
+
+/* put the next queued request on the wire, if the wire is free */
+static void aio_next(void)
+{
+	dcload_aio_t *aio = aio_head;
+
+	if (aio_sent || !aio)
+		return;
+
+	aio_head = aio->next;
+	if (!aio_head)
+		aio_tail = 0;
+
+	/* dc-tool refills the staging buffer from whatever is read next, so
+	 * what's left in it goes back to its file first, as in read */
+	unstage();
+
+	switch (aio->call) {
+	case SYSCALL_READ:
+		send_read(aio->arg[0], (void *)aio->arg[1], aio->arg[2]);
+		break;
+	case SYSCALL_WRITE:
+		send_write(aio->arg[0], (void *)aio->arg[1], aio->arg[2]);
+		break;
+	case SYSCALL_PREAD:
+		send_pread(aio->arg[0], (void *)aio->arg[1], aio->arg[2], aio->arg[3]);
+		break;
+	case AIO_CDFSREAD:
+		send_cdfsread(aio->arg[0], (void *)aio->arg[1], aio->arg[2]);
+		break;
+	}
+
+	aio->state = AIO_SENT;
+	aio_sent = aio;
+}
+
+int aio_retval(unsigned int retval, unsigned int staged_len)
+{
+	dcload_aio_t *aio = aio_sent;
+
+	if (!aio)
+		return 0;
+
+	aio_sent = 0;
+	aio->retval = retval;
+	if (aio->call == SYSCALL_READ && (int)retval >= 0)
+		staged(aio->arg[0], staged_len);
+	aio->state = AIO_DONE;
+
+	return 1;
+}
+
+/* queue aio, sending it straight away if nothing else is waiting */
+int aio_queue(dcload_aio_t *aio)
+{
+	aio->state = AIO_QUEUED;
+	aio->next = 0;
+	if (aio_tail)
+		aio_tail->next = aio;
+	else
+		aio_head = aio;
+	aio_tail = aio;
+
+	aio_next();
+
+	return 0;
+}
+
+int aio_submit(dcload_aio_t *aio)
+{
+	if (aio->call != SYSCALL_READ && aio->call != SYSCALL_WRITE && aio->call != SYSCALL_PREAD)
+		return -1;
+
+	return aio_queue(aio);
+}
+
+/* see to the network once without waiting, and return nonzero if aio is
+ * done, or if aio is 0, if everything submitted is */
+int aio_poll(dcload_aio_t *aio)
+{
+	if (aio_sent)
+		bb->poll();
+
+	aio_next();
+	if (!aio_sent)
+		bb->stop();
+
+	if (aio)
+		return aio->state == AIO_DONE;
+
+	return !aio_sent && !aio_head;
+}
+
+/* wait for aio to be done and return what its syscall returned. aio is the
+ * program's again after this. */
+int aio_complete(dcload_aio_t *aio)
+{
+	if (aio->state == AIO_IDLE)
+		return -1;
+
+	while (aio->state != AIO_DONE)
+		aio_poll(aio);
+
+	aio->state = AIO_IDLE;
+
+	return aio->retval;
+}
@@ -0,0 +1,105 @@
+#include "bin_map.h"
+#include "packet.h"
+#include "bswap.h"
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+/* Which chunks of a LOADBIN or LOADBINM transfer have arrived. Kept apart
+ * from the command handlers so dc-tool's tests can build it natively. */
+bin_info_t bin_info;
+
+/* find the first chunk from start that has not been received yet */
+static unsigned int bin_map_find_zero(unsigned int start, unsigned int end)
+{
+	unsigned int i = start;
+
+	while (i < end) {
+		if (!(i & 31) && bin_info.map[i >> 5] == 0xffffffff) {
+			i += 32;
+			continue;
+		}
+		if (!(bin_info.map[i >> 5] & (1 << (i & 31))))
+			return i;
+		i++;
+	}
+
+	return end;
+}
+
+/* find the first chunk from start that has been received */
+static unsigned int bin_map_find_set(unsigned int start, unsigned int end)
+{
+	unsigned int i = start;
+
+	while (i < end) {
+		if (!(i & 31) && bin_info.map[i >> 5] == 0) {
+			i += 32;
+			continue;
+		}
+		if (bin_info.map[i >> 5] & (1 << (i & 31)))
+			return i;
+		i++;
+	}
+
+	return end;
+}
+
+void bin_add_segment(unsigned int address, unsigned int size)
+{
+	bin_segment_t *seg = &bin_info.segments[bin_info.nsegments];
+
+	seg->address = address;
+	seg->size = size;
+	seg->first = bin_info.nsegments ? seg[-1].first + seg[-1].chunks : 0;
+	seg->chunks = (size + bin_info.chunk_size - 1) / bin_info.chunk_size;
+	bin_info.nsegments++;
+}
+
+void bin_map_mark(unsigned int address)
+{
+	bin_segment_t *seg = bin_info.segments;
+	unsigned int i, index;
+
+	for (i = 0; i < bin_info.nsegments; i++, seg++) {
+		if (address - seg->address < seg->size) {
+			index = seg->first + (address - seg->address) / bin_chunk();
+			if (index < BIN_MAP_CHUNKS)
+				bin_info.map[index >> 5] |= 1 << (index & 31);
+			return;
+		}
+	}
+}
+
+/* The first missing chunk goes in address/size, as old dc-tools expect, and
+ * every missing range (up to DONEBIN_MAX_RANGES) follows in the data. */
+int bin_map_missing(command_t *response)
+{
+	bin_range_t *range = (bin_range_t *)response->data;
+	bin_segment_t *seg = bin_info.segments;
+	unsigned int chunk = bin_chunk();
+	unsigned int end, i, j, s;
+	int n = 0;
+
+	response->address = htonl(0);
+	response->size = htonl(0);
+
+	for (s = 0; s < bin_info.nsegments && n < DONEBIN_MAX_RANGES; s++, seg++) {
+		end = min(seg->first + seg->chunks, BIN_MAP_CHUNKS);
+		i = bin_map_find_zero(seg->first, end);
+
+		if (i < end && !n) {
+			response->address = htonl(seg->address + (i - seg->first) * chunk);
+			response->size = htonl(min(seg->size - (i - seg->first) * chunk, chunk));
+		}
+
+		while (i < end && n < DONEBIN_MAX_RANGES) {
+			j = bin_map_find_set(i, end);
+			range[n].address = htonl(seg->address + (i - seg->first) * chunk);
+			range[n].size = htonl(min(seg->size, (j - seg->first) * chunk) - (i - seg->first) * chunk);
+			n++;
+			i = bin_map_find_zero(j, end);
+		}
+	}
+
+	return n;
+}
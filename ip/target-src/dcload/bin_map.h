@@ -0,0 +1,54 @@
+#ifndef __BIN_MAP_H__
+#define __BIN_MAP_H__
+
+#include "commands.h"
+
+/* one bit per chunk, enough for a 16 MB binary */
+#define BIN_MAP_CHUNKS 16384
+#define BIN_MAP_WORDS (BIN_MAP_CHUNKS / 32)
+
+/* most missing ranges a DONEBIN reply can list */
+#define DONEBIN_MAX_RANGES (1024 / sizeof(bin_range_t))
+
+/* most segments a LOADBINM manifest can list */
+#define BIN_MAX_SEGMENTS 64
+
+/* Every segment starts on a chunk of its own, so a chunk never spans two */
+typedef struct {
+	unsigned int address;
+	unsigned int size;
+	unsigned int first;	/* map index of its first chunk */
+	unsigned int chunks;
+} bin_segment_t;
+
+typedef struct {
+	unsigned int chunk_size;
+	unsigned int nsegments;
+	bin_segment_t segments[BIN_MAX_SEGMENTS];
+	int launch;		/* execute once everything has arrived */
+	unsigned int launch_address;
+	unsigned int launch_flags;	/* as in the size of EXECUTE */
+	unsigned int map[BIN_MAP_WORDS];
+} bin_info_t;
+
+typedef struct __attribute__ ((packed)) {
+	unsigned int address;
+	unsigned int size;
+} bin_range_t;
+
+extern bin_info_t bin_info;
+
+/* a PARTBIN or DONEBIN may arrive before any LOADBIN */
+#define bin_chunk() (bin_info.chunk_size ? bin_info.chunk_size : BIN_CHUNK_LEGACY)
+
+/* add a segment to the transfer, starting on a fresh chunk */
+void bin_add_segment(unsigned int address, unsigned int size);
+
+/* note that the chunk at address has arrived */
+void bin_map_mark(unsigned int address);
+
+/* fill in the address, size and range list of a DONEBIN reply from what
+ * hasn't arrived, returning the number of ranges */
+int bin_map_missing(command_t *response);
+
+#endif
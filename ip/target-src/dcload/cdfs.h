@@ -6,4 +6,10 @@ void cdfs_redir_save(void);
 void cdfs_redir_disable(void);
 void cdfs_redir_enable(void);
 
+/* set when dc-tool can send the disc image's TOC, see gdGdcReqCmd */
+extern int cdfs_host_toc;
+
+/* drops any GD-ROM dma read still going */
+void cdfs_dma_reset(void);
+
 #endif
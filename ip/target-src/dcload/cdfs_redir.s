@@ -70,13 +70,13 @@ gdGdcInitSystem:
 gdGdcGetDrvStat:
 	.long _gdGdcGetDrvStat
 gdGdcG1DmaEnd:
-	.long badsyscall
+	.long _gdGdcG1DmaEnd
 gdGdcReqDmaTrans:
-	.long badsyscall
+	.long _gdGdcReqDmaTrans
 gdGdcCheckDmaTrans:
-	.long badsyscall
+	.long _gdGdcCheckDmaTrans
 gdGdcReadAbort:
-	.long badsyscall
+	.long _gdGdcReadAbort
 gdGdcReset:
 	.long badsyscall
 gdGdcChangeDataType:
@@ -25,8 +25,11 @@
 #include "net.h"
 #include "adapter.h"
 #include "commands.h"
+#include "cdfs.h"
+#include "bswap.h"
 
 int gdStatus;
+int cdfs_host_toc;
 
 struct TOC {
 	unsigned int entry[99];
@@ -34,20 +37,91 @@ struct TOC {
 	unsigned int dunno;
 };
 
-int gdGdcReqCmd(int cmd, int *param)
+/* The DMA reads. On the console the drive fills the buffer while the program
+ * runs on, and a G1 interrupt says when it's done. Here the read goes to
+ * dc-tool as a non-blocking request instead, and gdGdcGetCmdStat and
+ * gdGdcCheckDmaTrans see to the network each time they're called, which is
+ * where the read finishes and the callback from gdGdcG1DmaEnd is made. There
+ * is no interrupt, so a program waiting on the callback alone has to poll
+ * one of them. */
+
+static dcload_aio_t gd_aio;
+static unsigned int gd_size;		/* of the read on the wire */
+static unsigned int gd_sector;		/* where the stream goes on */
+static unsigned int gd_left;		/* bytes of the stream not asked for yet */
+static void (*gd_dma_end)(void *);
+static void *gd_dma_param;
+
+void send_cdfsread(unsigned int sector, void *buf, unsigned int size)
 {
 	command_3int_t * command = (command_3int_t *)(pkt_buf + ETHER_H_LEN + IP_H_LEN + UDP_H_LEN);
-	struct TOC *toc;
+
+	memcpy(command->id, CMD_CDFSREAD, 4);
+	command->value0 = htonl(sector);
+	command->value1 = htonl((unsigned int)buf);
+	command->value2 = htonl(size);
+	build_send_packet(sizeof(command_3int_t));
+}
+
+static void gd_start(unsigned int sector, void *buf, unsigned int size)
+{
+	gd_aio.call = AIO_CDFSREAD;
+	gd_aio.arg[0] = sector;
+	gd_aio.arg[1] = (unsigned int)buf;
+	gd_aio.arg[2] = size;
+	gd_size = size;
+	aio_queue(&gd_aio);
+}
+
+/* wait for the read on the wire and settle the command it was for */
+static void gd_finish(void)
+{
+	if (gd_aio.state == AIO_IDLE)
+		return;
+
+	gd_size = 0;
+	if (aio_complete(&gd_aio) < 0) {
+		gd_left = 0;
+		gdStatus = -1;
+	} else if (gdStatus == 1 || (gdStatus == 3 && !gd_left)) {
+		gdStatus = 2;
+	}
+
+	if (gd_dma_end)
+		gd_dma_end(gd_dma_param);
+}
+
+/* see to the network once, finishing the read if dc-tool has answered */
+static void gd_poll(void)
+{
+	if (gd_aio.state != AIO_IDLE && aio_poll(&gd_aio))
+		gd_finish();
+}
+
+/* a single data track at LBA 150, for dc-tools that can't send the real
+ * TOC */
+static void builtin_toc(struct TOC *toc)
+{
 	int i;
 
+	toc->entry[0] = 0x41000096; /* CTRL = 4, ADR = 1, LBA = 150 */
+	for(i=1; i<99; i++)
+		toc->entry[i] = -1;
+	toc->first = 0x41010000; /* first = track 1 */
+	toc->last = 0x41010000; /* last = track 1 */
+}
+
+int gdGdcReqCmd(int cmd, int *param)
+{
+	command_3int_t * command = (command_3int_t *)(pkt_buf + ETHER_H_LEN + IP_H_LEN + UDP_H_LEN);
+
+	/* commands are one at a time on the drive too */
+	gd_finish();
+
 	switch (cmd) {
 	case 16: /* read sectors */
 
-		memcpy(command->id, CMD_CDFSREAD, 4);
-		command->value0 = htonl(param[0]);
-		command->value1 = htonl(param[2]);
-		command->value2 = htonl(param[1]*2048);
-		build_send_packet(sizeof(command_3int_t));
+		send_cdfsread(param[0], (void *)param[2], param[1]*2048);
 		bb->loop();
 
 		param[3] = 0;
@@ -55,13 +129,33 @@ int gdGdcReqCmd(int cmd, int *param)
 
 		return 0;
 		break;
-	case 19: /* read toc */
-		toc = (struct TOC *)param[1];
-		toc->entry[0] = 0x41000096; /* CTRL = 4, ADR = 1, LBA = 150 */
-		for(i=1; i<99; i++)
-			toc->entry[i] = -1;
-		toc->first = 0x41010000; /* first = track 1 */
-		toc->last = 0x41010000; /* last = track 1 */
+	case 17: /* read sectors by dma */
+		gd_left = 0;
+		gdStatus = 1;
+		gd_start(param[0], (void *)param[2], param[1]*2048);
+		return 0;
+		break;
+	case 19: /* read toc, param[0] = area */
+		/* older dc-tools don't know CDFSTOC and would never answer it */
+		if (!cdfs_host_toc) {
+			builtin_toc((struct TOC *)param[1]);
+			gdStatus = 2;
+			return 0;
+		}
+
+		memcpy(command->id, CMD_CDFSTOC, 4);
+		command->value0 = htonl(param[0]);
+		command->value1 = htonl(param[1]);
+		command->value2 = htonl(sizeof(struct TOC));
+		build_send_packet(sizeof(command_3int_t));
+		bb->loop();
+
+		/* the image has no tracks in that area */
+		if ((int)syscall_retval < 0) {
+			gdStatus = 0;
+			return -1;
+		}
+
 		gdStatus = 2;
 		return 0;
 		break;
@@ -69,6 +163,14 @@ int gdGdcReqCmd(int cmd, int *param)
 		gdStatus = 2;
 		return 0;
 		break;
+	case 28: /* stream sectors by dma */
+	case 38:
+		/* gdGdcReqDmaTrans asks for them a piece at a time */
+		gd_sector = param[0];
+		gd_left = param[1]*2048;
+		gdStatus = 3;
+		return 0;
+		break;
 	default:
 		gdStatus = 0;
 		return -1;
@@ -83,7 +185,9 @@ void gdGdcExecServer(void)
 
 int gdGdcGetCmdStat(int f, int *status)
 {
-	if (gdStatus == 0)
+	gd_poll();
+
+	if (gdStatus <= 0)
 		status[0] = 0;
 	return gdStatus;
 
@@ -102,3 +206,60 @@ int gdGdcChangeDataType(int *param)
 void gdGdcInitSystem(void)
 {
 }
+
+/* have func(param) called whenever a dma read has finished */
+void gdGdcG1DmaEnd(void (*func)(void *), void *param)
+{
+	gd_dma_end = func;
+	gd_dma_param = param;
+}
+
+/* params[0] = buffer, params[1] = size; the next size bytes of the stream.
+ * Only whole sectors, since dc-tool reads by sector. */
+int gdGdcReqDmaTrans(int f, int *params)
+{
+	unsigned int size = params[1];
+
+	if (gdStatus != 3 || gd_aio.state != AIO_IDLE)
+		return -1;
+
+	if (!size || size % 2048 || size > gd_left)
+		return -1;
+
+	gd_left -= size;
+	gd_start(gd_sector, (void *)params[0], size);
+	gd_sector += size / 2048;
+
+	return 0;
+}
+
+/* *size = bytes of the last gdGdcReqDmaTrans still to come. dc-tool's answer
+ * comes in one piece, so it's all of them until it's done. */
+int gdGdcCheckDmaTrans(int f, unsigned int *size)
+{
+	gd_poll();
+
+	*size = gd_size;
+	return 0;
+}
+
+/* dc-tool can't be stopped in the middle of a read, so let the one on the
+ * wire finish and drop the rest of the stream */
+int gdGdcReadAbort(int f)
+{
+	gd_finish();
+
+	gd_left = 0;
+	gdStatus = 0;
+	return 0;
+}
+
+/* forget the read on the wire without waiting for it, for a new program */
+void cdfs_dma_reset(void)
+{
+	gd_aio.state = AIO_IDLE;
+	gd_size = 0;
+	gd_left = 0;
+	gd_dma_end = 0;
+	gdStatus = 0;
+}
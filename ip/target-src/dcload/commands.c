@@ -11,6 +11,9 @@
 #include "disable.h"
 #include "scif.h"
 #include "maple.h"
+#include "minilzo.h"
+#include "crc32.h"
+#include "bin_map.h"
 
 unsigned int our_ip;
 unsigned int tool_ip;
@@ -20,16 +23,24 @@ unsigned short tool_port;
 #define NAME "dcload-ip " DCLOAD_VERSION
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
-typedef struct {
-	unsigned int load_address;
-	unsigned int load_size;
-	unsigned char map[16384];
-} bin_info_t;
+unsigned char buffer[COMMAND_LEN + BIN_CHUNK_MAX]; /* buffer for response */
+command_t * response = (command_t *)buffer;
 
-bin_info_t bin_info;
+/* dc-tools that negotiated a chunk size send it as the command payload */
+static unsigned int bin_chunk_size(udp_header_t * udp, command_t * command)
+{
+	unsigned int size;
 
-unsigned char buffer[COMMAND_LEN + 1024]; /* buffer for response */
-command_t * response = (command_t *)buffer;
+	if (ntohs(udp->length) < UDP_H_LEN + COMMAND_LEN + 4)
+		return BIN_CHUNK_LEGACY;
+
+	memcpy(&size, command->data, 4);
+	size = ntohl(size);
+	if (size < BIN_CHUNK_LEGACY || size > BIN_CHUNK_MAX)
+		return BIN_CHUNK_LEGACY;
+
+	return size;
+}
 
 void cmd_reboot(ether_header_t * ether, ip_header_t * ip, udp_header_t * udp, command_t * command)
 {
@@ -40,44 +51,111 @@ void cmd_reboot(ether_header_t * ether, ip_header_t * ip, udp_header_t * udp, co
 	go(0x8c004000);
 }
 
+/* remember who sent the packet and run the program at address. flags are
+ * as in the size of EXECUTE. The caller has already replied. */
+static void execute(ether_header_t * ether, ip_header_t * ip, udp_header_t * udp, unsigned int address, unsigned int flags)
+{
+	tool_ip = ntohl(ip->src);
+	tool_port = ntohs(udp->src);
+	memcpy(tool_mac, ether->src, 6);
+	our_ip = ntohl(ip->dest);
+
+	if (!booted)
+		disp_info();
+	else
+		disp_status("executing...");
+
+	if (flags & EXEC_CONSOLE)
+		*(unsigned int *)0x8c004004 = 0xdeadbeef; /* enable console */
+	else
+		*(unsigned int *)0x8c004004 = 0xfeedface; /* disable console */
+	if (flags & EXEC_CDFSREDIR)
+		cdfs_redir_enable();
+	cdfs_host_toc = (flags & EXEC_CDFSTOC) != 0;
+
+	stage_reset();
+	aio_reset();
+	cdfs_dma_reset();
+
+	bb->stop();
+
+	running = 1;
+
+	disable_cache();
+	go(address);
+}
+
 void cmd_execute(ether_header_t * ether, ip_header_t * ip, udp_header_t * udp, command_t * command)
 {
 	if (!running) {
-		tool_ip = ntohl(ip->src);
-		tool_port = ntohs(udp->src);
-		memcpy(tool_mac, ether->src, 6);
-		our_ip = ntohl(ip->dest);
-
 		make_ip(ntohl(ip->src), ntohl(ip->dest), UDP_H_LEN + COMMAND_LEN, 17, (ip_header_t *)(pkt_buf + ETHER_H_LEN));
 		make_udp(ntohs(udp->src), ntohs(udp->dest),(unsigned char *) command, COMMAND_LEN, (ip_header_t *)(pkt_buf + ETHER_H_LEN), (udp_header_t *)(pkt_buf + ETHER_H_LEN + IP_H_LEN));
 		bb->tx(pkt_buf, ETHER_H_LEN + IP_H_LEN + UDP_H_LEN + COMMAND_LEN);
 
-		if (!booted)
-			disp_info();
-		else
-			disp_status("executing...");
+		execute(ether, ip, udp, ntohl(command->address), ntohl(command->size));
+	}
+}
 
-		if (ntohl(command->size)&1)
-			*(unsigned int *)0x8c004004 = 0xdeadbeef; /* enable console */
-		else
-			*(unsigned int *)0x8c004004 = 0xfeedface; /* disable console */
-		if (ntohl(command->size)>>1)
-			cdfs_redir_enable();
+void cmd_loadbin(ip_header_t * ip, udp_header_t * udp, command_t * command)
+{
+	bin_info.chunk_size = bin_chunk_size(udp, command);
+	bin_info.nsegments = 0;
+	bin_info.launch = 0;
+	bin_add_segment(ntohl(command->address), ntohl(command->size));
+	memset(bin_info.map, 0, sizeof(bin_info.map));
 
-		bb->stop();
+	our_ip = ntohl(ip->dest);
 
-		running = 1;
+	make_ip(ntohl(ip->src), ntohl(ip->dest), UDP_H_LEN + COMMAND_LEN, 17, (ip_header_t *)(pkt_buf + ETHER_H_LEN));
+	make_udp(ntohs(udp->src), ntohs(udp->dest),(unsigned char *) command, COMMAND_LEN, (ip_header_t *)(pkt_buf + ETHER_H_LEN), (udp_header_t *)(pkt_buf + ETHER_H_LEN + IP_H_LEN));
+	bb->tx(pkt_buf, ETHER_H_LEN + IP_H_LEN + UDP_H_LEN + COMMAND_LEN);
 
-		disable_cache();
-		go(ntohl(command->address));
+	if (!running) {
+		if (!booted)
+			disp_info();
+		disp_status("receiving data...");
 	}
 }
 
-void cmd_loadbin(ip_header_t * ip, udp_header_t * udp, command_t * command)
+/* Start a transfer of several segments at once. The data is the chunk size,
+ * the number of segments and then an address and size for each. If the
+ * address is not 0 the program is started there, with the size as the flags
+ * for EXECUTE, as soon as DONEBIN finds that everything has arrived. A bad
+ * manifest isn't answered, so dc-tool never streams data against it.
+ */
+void cmd_loadbinm(ip_header_t * ip, udp_header_t * udp, command_t * command)
 {
-	bin_info.load_address = ntohl(command->address);
-	bin_info.load_size = ntohl(command->size);
-	memset(bin_info.map, 0, 16384);
+	unsigned int len = ntohs(udp->length) - UDP_H_LEN - COMMAND_LEN;
+	unsigned int word[2];
+	unsigned int count, i;
+
+	if (len < sizeof(word))
+		return;
+
+	memcpy(word, command->data, sizeof(word));
+	count = ntohl(word[1]);
+	if (count > BIN_MAX_SEGMENTS || len < (count + 1) * sizeof(word))
+		return;
+
+	bin_info.chunk_size = ntohl(word[0]);
+	if (bin_info.chunk_size < BIN_CHUNK_LEGACY || bin_info.chunk_size > BIN_CHUNK_MAX)
+		bin_info.chunk_size = BIN_CHUNK_LEGACY;
+
+	bin_info.nsegments = 0;
+	for (i = 0; i < count; i++) {
+		memcpy(word, command->data + (i + 1) * sizeof(word), sizeof(word));
+		bin_add_segment(ntohl(word[0]), ntohl(word[1]));
+	}
+
+	if (bin_info.nsegments && bin_info.segments[count - 1].first + bin_info.segments[count - 1].chunks > BIN_MAP_CHUNKS) {
+		bin_info.nsegments = 0;
+		return;
+	}
+
+	bin_info.launch = (ntohl(command->address) != 0);
+	bin_info.launch_address = ntohl(command->address);
+	bin_info.launch_flags = ntohl(command->size);
+	memset(bin_info.map, 0, sizeof(bin_info.map));
 
 	our_ip = ntohl(ip->dest);
 
@@ -94,32 +172,51 @@ void cmd_loadbin(ip_header_t * ip, udp_header_t * udp, command_t * command)
 
 void cmd_partbin(ip_header_t * ip, udp_header_t * udp, command_t * command)
 {
-	int index = 0;
-
 	memcpy((unsigned char *)ntohl(command->address), command->data, ntohl(command->size));
 
-	index = (ntohl(command->address) - bin_info.load_address) >> 10;
-	bin_info.map[index] = 1;
+	bin_map_mark(ntohl(command->address));
 }
 
-void cmd_donebin(ip_header_t * ip, udp_header_t * udp, command_t * command)
+/* Like PARTBIN, but the data is lzo compressed and size is the length once
+ * decompressed. A chunk that doesn't decompress to exactly size bytes is
+ * left unmarked, so DONEBIN asks for it again.
+ */
+void cmd_partbinz(ip_header_t * ip, udp_header_t * udp, command_t * command)
 {
-	int i;
+	lzo_uint size = ntohl(command->size);
 
-	for(i = 0; i < (bin_info.load_size + 1023)/1024; i++)
-		if (!bin_info.map[i])
-			break;
-	if ( i == (bin_info.load_size + 1023)/1024 ) {
-		command->address = htonl(0);
-		command->size = htonl(0);
-	} else {
-		command->address = htonl( bin_info.load_address + i * 1024);
-		command->size = htonl(min(bin_info.load_size - i * 1024, 1024));
-	}
+	if (size > BIN_CHUNK_MAX)
+		return;
 
-	make_ip(ntohl(ip->src), ntohl(ip->dest), UDP_H_LEN + COMMAND_LEN, 17, (ip_header_t *)(pkt_buf + ETHER_H_LEN));
-	make_udp(ntohs(udp->src), ntohs(udp->dest),(unsigned char *) command, COMMAND_LEN, (ip_header_t *)(pkt_buf + ETHER_H_LEN), (udp_header_t *)(pkt_buf + ETHER_H_LEN + IP_H_LEN));
-	bb->tx(pkt_buf, ETHER_H_LEN + IP_H_LEN + UDP_H_LEN + COMMAND_LEN);
+	if (lzo1x_decompress_safe(command->data, ntohs(udp->length) - UDP_H_LEN - COMMAND_LEN,
+				  (unsigned char *)ntohl(command->address), &size, 0) != LZO_E_OK)
+		return;
+
+	if (size == ntohl(command->size))
+		bin_map_mark(ntohl(command->address));
+}
+
+/* Reply with the first missing chunk in address/size, as old dc-tools expect,
+ * followed by a list of every missing range (up to DONEBIN_MAX_RANGES) so the
+ * host can resend them all in one go. If nothing is missing and the transfer
+ * asked for it, the program is started.
+ */
+void cmd_donebin(ether_header_t * ether, ip_header_t * ip, udp_header_t * udp, command_t * command)
+{
+	int n;
+
+	memcpy(response->id, CMD_DONEBIN, 4);
+	n = bin_map_missing(response);
+
+	make_ip(ntohl(ip->src), ntohl(ip->dest), UDP_H_LEN + COMMAND_LEN + n * sizeof(bin_range_t), 17, (ip_header_t *)(pkt_buf + ETHER_H_LEN));
+	make_udp(ntohs(udp->src), ntohs(udp->dest),(unsigned char *) response, COMMAND_LEN + n * sizeof(bin_range_t), (ip_header_t *)(pkt_buf + ETHER_H_LEN), (udp_header_t *)(pkt_buf + ETHER_H_LEN + IP_H_LEN));
+	bb->tx(pkt_buf, ETHER_H_LEN + IP_H_LEN + UDP_H_LEN + COMMAND_LEN + n * sizeof(bin_range_t));
+
+	if (!n && bin_info.launch && !running) {
+		/* only once, in case the reply is lost and dc-tool asks again */
+		bin_info.launch = 0;
+		execute(ether, ip, udp, bin_info.launch_address, bin_info.launch_flags);
+	}
 
 	if (!running) {
 		if (!booted)
@@ -128,21 +225,66 @@ void cmd_donebin(ip_header_t * ip, udp_header_t * udp, command_t * command)
 	}
 }
 
+/* memset size bytes at address, and echo the command back as an ack */
+void cmd_fill(ip_header_t * ip, udp_header_t * udp, command_t * command)
+{
+	memset((unsigned char *)ntohl(command->address), command->data[0], ntohl(command->size));
+
+	make_ip(ntohl(ip->src), ntohl(ip->dest), UDP_H_LEN + COMMAND_LEN, 17, (ip_header_t *)(pkt_buf + ETHER_H_LEN));
+	make_udp(ntohs(udp->src), ntohs(udp->dest),(unsigned char *) command, COMMAND_LEN, (ip_header_t *)(pkt_buf + ETHER_H_LEN), (udp_header_t *)(pkt_buf + ETHER_H_LEN + IP_H_LEN));
+	bb->tx(pkt_buf, ETHER_H_LEN + IP_H_LEN + UDP_H_LEN + COMMAND_LEN);
+}
+
+/* Reply with the CRC-32 of each chunk of the range, for delta uploads. The
+ * chunk size is in the data; as many hashes as fit in one packet are sent.
+ */
+void cmd_hash(ip_header_t * ip, udp_header_t * udp, command_t * command)
+{
+	unsigned char *ptr = (unsigned char *)ntohl(command->address);
+	unsigned int left = ntohl(command->size);
+	unsigned int chunk, len, hash;
+	int n = 0;
+
+	if (ntohs(udp->length) < UDP_H_LEN + COMMAND_LEN + 4)
+		return;
+
+	memcpy(&chunk, command->data, 4);
+	chunk = ntohl(chunk);
+	if (!chunk)
+		chunk = BIN_CHUNK_LEGACY;
+
+	memcpy(response, command, COMMAND_LEN);
+
+	while (left && n < BIN_CHUNK_MAX / 4) {
+		len = min(left, chunk);
+		hash = htonl(crc32_block(ptr, len));
+		memcpy(response->data + n * 4, &hash, 4);
+		ptr += len;
+		left -= len;
+		n++;
+	}
+
+	make_ip(ntohl(ip->src), ntohl(ip->dest), UDP_H_LEN + COMMAND_LEN + n * 4, 17, (ip_header_t *)(pkt_buf + ETHER_H_LEN));
+	make_udp(ntohs(udp->src), ntohs(udp->dest),(unsigned char *) response, COMMAND_LEN + n * 4, (ip_header_t *)(pkt_buf + ETHER_H_LEN), (udp_header_t *)(pkt_buf + ETHER_H_LEN + IP_H_LEN));
+	bb->tx(pkt_buf, ETHER_H_LEN + IP_H_LEN + UDP_H_LEN + COMMAND_LEN + n * 4);
+}
+
 void cmd_sendbinq(ip_header_t * ip, udp_header_t * udp, command_t * command)
 {
 	int numpackets, i;
 	unsigned char *ptr;
 	unsigned int bytes_left;
 	unsigned int bytes_thistime;
+	unsigned int chunk = bin_chunk_size(udp, command);
 
 	bytes_left = ntohl(command->size);
-	numpackets = (ntohl(command->size)+1023) / 1024;
+	numpackets = (ntohl(command->size)+chunk-1) / chunk;
 	ptr = (unsigned char *)ntohl(command->address);
 
 	memcpy(response->id, CMD_SENDBIN, 4);
 	for(i = 0; i < numpackets; i++) {
-		if (bytes_left >= 1024)
-			bytes_thistime = 1024;
+		if (bytes_left >= chunk)
+			bytes_thistime = chunk;
 		else
 			bytes_thistime = bytes_left;
 		bytes_left -= bytes_thistime;
@@ -181,29 +323,57 @@ void cmd_sendbin(ip_header_t * ip, udp_header_t * udp, command_t * command)
 	}
 }
 
+/* Reply with our version string. The address carries DCLOAD_CAP_PRESENT and
+ * the size the largest chunk we accept, capped at what dc-tool asked for.
+ */
 void cmd_version(ip_header_t * ip, udp_header_t * udp, command_t * command)
 {
 	int i;
 
 	i = strlen("DCLOAD-IP " DCLOAD_VERSION) + 1;
 	memcpy(response, command, COMMAND_LEN);
+	response->address = htonl(DCLOAD_CAP_PRESENT | DCLOAD_CAP_LZO | DCLOAD_CAP_FILL | DCLOAD_CAP_HASH | DCLOAD_CAP_MANIFEST | DCLOAD_CAP_RETD);
+	response->size = htonl(min(ntohl(command->size), BIN_CHUNK_MAX));
 	strcpy(response->data, "DCLOAD-IP " DCLOAD_VERSION);
 	make_ip(ntohl(ip->src), ntohl(ip->dest), UDP_H_LEN + COMMAND_LEN + i, 17, (ip_header_t *)(pkt_buf + ETHER_H_LEN));
 	make_udp(ntohs(udp->src), ntohs(udp->dest),(unsigned char *) response, COMMAND_LEN + i, (ip_header_t *)(pkt_buf + ETHER_H_LEN), (udp_header_t *)(pkt_buf + ETHER_H_LEN + IP_H_LEN));
 	bb->tx(pkt_buf, ETHER_H_LEN + IP_H_LEN + UDP_H_LEN + COMMAND_LEN + i);
 }
 
+/* RETVAL carries the return value in address (and size). RETVALD carries it
+ * in address too, with data to copy to the syscall's buffer at size, which
+ * saves a whole LOADBIN transfer for small results.
+ */
 void cmd_retval(ip_header_t * ip, udp_header_t * udp, command_t * command)
 {
+	unsigned int len;
+
+	if (!memcmp(command->id, CMD_RETVALD, 4) && ntohs(udp->length) < UDP_H_LEN + COMMAND_LEN)
+		return;
+
 	if (running) {
+		if (!memcmp(command->id, CMD_RETVALD, 4)) {
+			len = ntohs(udp->length) - UDP_H_LEN - COMMAND_LEN;
+			if (len > BIN_CHUNK_MAX)
+				len = BIN_CHUNK_MAX;
+			memcpy((unsigned char *)ntohl(command->size), command->data, len);
+		}
+
 		make_ip(ntohl(ip->src), ntohl(ip->dest), UDP_H_LEN + COMMAND_LEN, 17, (ip_header_t *)(pkt_buf + ETHER_H_LEN));
 		make_udp(ntohs(udp->src), ntohs(udp->dest),(unsigned char *) command, COMMAND_LEN, (ip_header_t *)(pkt_buf + ETHER_H_LEN), (udp_header_t *)(pkt_buf + ETHER_H_LEN + IP_H_LEN));
 		bb->tx(pkt_buf, ETHER_H_LEN + IP_H_LEN + UDP_H_LEN + COMMAND_LEN);
 
+		/* the first answer is for the non-blocking request on the wire,
+		 * and whatever syscall is waiting keeps waiting */
+		if (aio_retval(ntohl(command->address), memcmp(command->id, CMD_RETVALD, 4) ? ntohl(command->size) : 0))
+			return;
+
 		bb->stop();
 
 		syscall_retval = ntohl(command->address);
 		syscall_data = command->data;
+		/* RETV's size is what went to the staging buffer, if there is one */
+		syscall_staged = memcmp(command->id, CMD_RETVALD, 4) ? ntohl(command->size) : 0;
 		escape_loop = 1;
 	}
 }
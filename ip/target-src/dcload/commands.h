@@ -10,17 +10,40 @@ typedef struct __attribute__ ((packed)) {
 
 #define CMD_EXECUTE  "EXEC" /* execute */
 #define CMD_LOADBIN  "LBIN" /* begin receiving binary */
+#define CMD_LOADBINM "LBIM" /* begin receiving several segments */
 #define CMD_PARTBIN  "PBIN" /* part of a binary */
+#define CMD_PARTBINZ "PBIZ" /* part of a binary, lzo compressed */
 #define CMD_DONEBIN  "DBIN" /* end receiving binary */
 #define CMD_SENDBIN  "SBIN" /* send a binary */
 #define CMD_SENDBINQ "SBIQ" /* send a binary, quiet */
 #define CMD_VERSION  "VERS" /* send version info */
+#define CMD_FILL     "FILL" /* memset, value in the first data byte */
+#define CMD_HASH     "HASH" /* CRC-32 per chunk, chunk size in the data */
 #define CMD_RETVAL   "RETV" /* return value */
+#define CMD_RETVALD  "RETD" /* return value, with data for the syscall buffer */
 #define CMD_REBOOT   "RBOT" /* reboot */
 #define CMD_MAPLE    "MAPL" /* Maple packet */
 
 #define COMMAND_LEN  12
 
+/* largest PARTBIN/SENDBIN payload that fits in an Ethernet frame, and the
+ * size used by dc-tools that don't negotiate one */
+#define BIN_CHUNK_MAX    1460
+#define BIN_CHUNK_LEGACY 1024
+
+/* set in the address of a VERS reply, so dc-tool knows we negotiate */
+#define DCLOAD_CAP_PRESENT (1u << 31)
+#define DCLOAD_CAP_LZO     (1u << 0) /* we accept CMD_PARTBINZ */
+#define DCLOAD_CAP_FILL    (1u << 1) /* we accept CMD_FILL */
+#define DCLOAD_CAP_HASH    (1u << 2) /* we accept CMD_HASH */
+#define DCLOAD_CAP_MANIFEST (1u << 3) /* we accept CMD_LOADBINM */
+#define DCLOAD_CAP_RETD    (1u << 4) /* we accept CMD_RETVALD */
+
+/* flags in the size of EXECUTE, and of a LOADBINM that launches */
+#define EXEC_CONSOLE   (1 << 0) /* send the program's console to dc-tool */
+#define EXEC_CDFSREDIR (1 << 1) /* redirect GD-ROM syscalls to dc-tool */
+#define EXEC_CDFSTOC   (1 << 2) /* dc-tool answers CDFSTOC */
+
 extern unsigned int tool_ip;
 extern unsigned char tool_mac[6];
 extern unsigned short tool_port;
@@ -124,8 +124,9 @@ _dcloadsyscall:
 	mov	r5,r4
 	mov	r6,r5
 	mov	r7,r6
+	mov.l	@r15,r7		! 4th argument, for pread
 
-	mov	#21,r1
+	mov	#28,r1
 	cmp/hs	r0,r1
 	bf	badsyscall
 
@@ -191,3 +192,17 @@ gdbpacket_k:
 	.long _gdbpacket
 rewinddir_k:
 	.long _rewinddir
+pread_k:
+	.long _pread
+preadv_k:
+	.long _preadv
+readdirplus_k:
+	.long _readdirplus
+stagemem_k:
+	.long _assign_stagemem
+aio_submit_k:
+	.long _aio_submit
+aio_poll_k:
+	.long _aio_poll
+aio_complete_k:
+	.long _aio_complete
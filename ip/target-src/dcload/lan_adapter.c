@@ -389,20 +389,23 @@ static int bb_rx() {
 	return count;
 }
 
-/* Loop doing something interesting */
-static void bb_loop() {
+/* Check once for received packets */
+static void bb_poll() {
 	int result;
 
+	result = bb_rx();
+	if (result < 0 && !running) {
+		clear_lines(320, 24, 0x0100);
+		draw_string(30, 320, "receive error!", 0xffff);
+	}
+}
+
+/* Loop doing something interesting */
+static void bb_loop() {
 	DEBUG("bb_loop entered\r\n");
 
-	while (!escape_loop) {
-		/* Check for received packets */
-		result = bb_rx();
-		if (result < 0 && !running) {
-			clear_lines(320, 24, 0x0100);
-			draw_string(30, 320, "receive error!", 0xffff);
-		}
-	}
+	while (!escape_loop)
+		bb_poll();
 
 	DEBUG("bb_loop exited\r\n");
 
@@ -417,5 +420,6 @@ adapter_t adapter_la = {
 	bb_start,
 	bb_stop,
 	bb_loop,
+	bb_poll,
 	bb_tx
 };
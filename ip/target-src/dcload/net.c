@@ -84,14 +84,6 @@ void process_icmp(ether_header_t *ether, ip_header_t *ip, icmp_header_t *icmp)
 	}
 }
 
-typedef struct {
-	unsigned int load_address;
-	unsigned int load_size;
-	unsigned char map[16384];
-} bin_info_t;
-
-bin_info_t bin_info;
-
 void process_udp(ether_header_t *ether, ip_header_t *ip, udp_header_t *udp)
 {
 	ip_udp_pseudo_header_t *pseudo;
@@ -137,12 +129,28 @@ void process_udp(ether_header_t *ether, ip_header_t *ip, udp_header_t *udp)
 		cmd_loadbin(ip, udp, command);
 	}
 
+	if (!memcmp(command->id, CMD_LOADBINM, 4)) {
+		cmd_loadbinm(ip, udp, command);
+	}
+
 	if (!memcmp(command->id, CMD_PARTBIN, 4)) {
 		cmd_partbin(ip, udp, command);
 	}
 
+	if (!memcmp(command->id, CMD_PARTBINZ, 4)) {
+		cmd_partbinz(ip, udp, command);
+	}
+
 	if (!memcmp(command->id, CMD_DONEBIN, 4)) {
-		cmd_donebin(ip, udp, command);
+		cmd_donebin(ether, ip, udp, command);
+	}
+
+	if (!memcmp(command->id, CMD_FILL, 4)) {
+		cmd_fill(ip, udp, command);
+	}
+
+	if (!memcmp(command->id, CMD_HASH, 4)) {
+		cmd_hash(ip, udp, command);
 	}
 
 	if (!memcmp(command->id, CMD_SENDBINQ, 4)) {
@@ -157,7 +165,7 @@ void process_udp(ether_header_t *ether, ip_header_t *ip, udp_header_t *udp)
 		cmd_version(ip, udp, command);
 	}
 
-	if (!memcmp(command->id, CMD_RETVAL, 4)) {
+	if (!memcmp(command->id, CMD_RETVAL, 4) || !memcmp(command->id, CMD_RETVALD, 4)) {
 		cmd_retval(ip, udp, command);
 	}
 
@@ -245,73 +245,76 @@ static int bb_rx()
 
 extern void uint_to_string(unsigned int foo, unsigned char *bar);
 
-static void bb_loop()
+static unsigned int intr;
+
+/* handle whatever the adapter has for us, without waiting for more */
+static void bb_poll()
 {
-	unsigned int intr;
-	int i;
-	char value[256];
+	/* Check interrupt status */
+	if (nic16[RT_INTRSTATUS/2] != intr) {
+		intr = nic16[RT_INTRSTATUS/2];
+		nic16[RT_INTRSTATUS/2] = intr & ~RT_INT_RX_ACK;
+	}
 
-	intr = 0;
+	/* Did we receive some data? */
+	if (intr & RT_INT_RX_ACK) {
+		bb_rx();
+	}
 
-	while(!escape_loop) {
+	/* link change */
+	if (intr & RT_INT_RXFIFO_UNDERRUN) {
 
-		/* Check interrupt status */
-		if (nic16[RT_INTRSTATUS/2] != intr) {
-			intr = nic16[RT_INTRSTATUS/2];
-			nic16[RT_INTRSTATUS/2] = intr & ~RT_INT_RX_ACK;
+		if (booted && !running) {
+			disp_status("link change...");
 		}
 
-		/* Did we receive some data? */
-		if (intr & RT_INT_RX_ACK) {
-			i = bb_rx();
-		}
+		nic16[RT_MII_BMCR/2] = 0x9200;
 
-		/* link change */
-		if (intr & RT_INT_RXFIFO_UNDERRUN) {
+		/* wait for valid link */
+		while (!(nic16[RT_MII_BMSR/2] & 0x20));
 
-			if (booted && !running) {
-				disp_status("link change...");
-			}
+		/* wait for the additional link change interrupt that is coming */
+		while (!(nic16[RT_INTRSTATUS/2] & RT_INT_RXFIFO_UNDERRUN));
+		nic16[RT_INTRSTATUS/2] = RT_INT_RXFIFO_UNDERRUN;
 
-			nic16[RT_MII_BMCR/2] = 0x9200;
+		if (booted && !running) {
+			disp_status("idle...");
+		}
 
-			/* wait for valid link */
-			while (!(nic16[RT_MII_BMSR/2] & 0x20));
+	}
 
-			/* wait for the additional link change interrupt that is coming */
-			while (!(nic16[RT_INTRSTATUS/2] & RT_INT_RXFIFO_UNDERRUN));
-			nic16[RT_INTRSTATUS/2] = RT_INT_RXFIFO_UNDERRUN;
+	/* Rx FIFO overflow */
+	if (intr & RT_INT_RXFIFO_OVERFLOW) {
+		/* must clear Rx Buffer Overflow too for some reason */
+		nic16[RT_INTRSTATUS/2] = RT_INT_RXBUF_OVERFLOW;
+	}
 
-			if (booted && !running) {
-				disp_status("idle...");
-			}
+	/* Rx Buffer overflow */
+	if (intr & RT_INT_RXBUF_OVERFLOW) {
+		rtl.cur_rx = nic16[RT_RXBUFHEAD];
+		nic16[RT_RXBUFTAIL]=  rtl.cur_rx - 16;
 
-		}
+		rtl.cur_rx = 0;
+		nic8[RT_CHIPCMD] = RT_CMD_TX_ENABLE;
 
-		/* Rx FIFO overflow */
-		if (intr & RT_INT_RXFIFO_OVERFLOW) {
-			/* must clear Rx Buffer Overflow too for some reason */
-			nic16[RT_INTRSTATUS/2] = RT_INT_RXBUF_OVERFLOW;
-		}
+		nic32[RT_RXCONFIG/4] = 0x00000e0a;
 
-		/* Rx Buffer overflow */
-		if (intr & RT_INT_RXBUF_OVERFLOW) {
-			rtl.cur_rx = nic16[RT_RXBUFHEAD];
-			nic16[RT_RXBUFTAIL]=  rtl.cur_rx - 16;
+		while ( !(nic8[RT_CHIPCMD] & RT_CMD_RX_ENABLE))
+			nic8[RT_CHIPCMD] = RT_CMD_TX_ENABLE | RT_CMD_RX_ENABLE;
 
-			rtl.cur_rx = 0;
-			nic8[RT_CHIPCMD] = RT_CMD_TX_ENABLE;
+		nic32[RT_RXCONFIG/4] = 0x00000e0a;
 
-			nic32[RT_RXCONFIG/4] = 0x00000e0a;
+		nic16[RT_INTRSTATUS/2] = 0xffff;
+	}
+}
 
-			while ( !(nic8[RT_CHIPCMD] & RT_CMD_RX_ENABLE))
-				nic8[RT_CHIPCMD] = RT_CMD_TX_ENABLE | RT_CMD_RX_ENABLE;
+static void bb_loop()
+{
+	intr = 0;
 
-			nic32[RT_RXCONFIG/4] = 0x00000e0a;
+	while(!escape_loop)
+		bb_poll();
 
-			nic16[RT_INTRSTATUS/2] = 0xffff;
-		}
-	}
 	escape_loop = 0;
 }
 
@@ -324,5 +327,6 @@ adapter_t adapter_bba = {
 	bb_start,
 	bb_stop,
 	bb_loop,
+	bb_poll,
 	bb_tx
 };
@@ -36,6 +36,20 @@
 
 unsigned int syscall_retval;
 unsigned char* syscall_data;
+unsigned int syscall_staged;
+
+/* Once the program hands over a staging buffer with assign_stagemem,
+ * dc-tool pushes what follows a sequential read into it along with the
+ * data, and the next read of that fd is answered from here. dc-tool's file
+ * position is already past the staged bytes, so they are given back with
+ * an lseek if anything else happens to the fd first. */
+static struct {
+	unsigned char *buf;
+	unsigned int size;
+	int fd;
+	unsigned int len;
+	unsigned int pos;
+} stage;
 
 ether_header_t * ether = (ether_header_t *)pkt_buf;
 ip_header_t * ip = (ip_header_t *)(pkt_buf + ETHER_H_LEN);
@@ -82,7 +96,27 @@ void dcexit(void)
 	bb->stop();
 }
 
-int read(int fd, void *buf, size_t count)
+/* give back whatever is left in the staging buffer */
+void unstage(void)
+{
+	unsigned int left = stage.len - stage.pos;
+
+	if (!stage.len)
+		return;
+
+	stage.len = 0;
+	if (left)
+		lseek(stage.fd, -(off_t)left, SEEK_CUR);
+}
+
+void stage_reset(void)
+{
+	stage.buf = 0;
+	stage.size = 0;
+	stage.len = 0;
+}
+
+void send_read(int fd, void *buf, size_t count)
 {
 	command_3int_t * command = (command_3int_t *)(pkt_buf + ETHER_H_LEN + IP_H_LEN + UDP_H_LEN);
 
@@ -91,20 +125,78 @@ int read(int fd, void *buf, size_t count)
 	command->value1 = htonl(buf);
 	command->value2 = htonl(count);
 	build_send_packet(sizeof(command_3int_t));
+}
+
+/* what dc-tool pushed to the staging buffer after a read of fd */
+void staged(int fd, unsigned int len)
+{
+	if (stage.buf && len) {
+		stage.fd = fd;
+		stage.len = len;
+		stage.pos = 0;
+	}
+}
+
+int read(int fd, void *buf, size_t count)
+{
+	unsigned int n = 0;
+
+	if (stage.len && stage.fd == fd) {
+		n = stage.len - stage.pos;
+		if (n > count)
+			n = count;
+		memcpy(buf, stage.buf + stage.pos, n);
+		stage.pos += n;
+		if (stage.pos == stage.len)
+			stage.len = 0;
+		if (n == count)
+			return n;
+		buf = (unsigned char *)buf + n;
+		count -= n;
+	} else {
+		unstage();
+	}
+
+	send_read(fd, buf, count);
 	bb->loop();
 
-	return syscall_retval;
+	if ((int)syscall_retval < 0)
+		return n ? n : syscall_retval;
+
+	staged(fd, syscall_staged);
+
+	return n + syscall_retval;
 }
 
-int write(int fd, const void *buf, size_t count)
+/* most data a write can carry in the request itself */
+#define WRITE_INLINE_MAX (sizeof(pkt_buf) - ETHER_H_LEN - IP_H_LEN - UDP_H_LEN - sizeof(command_3int_t))
+
+void send_write(int fd, const void *buf, size_t count)
 {
 	command_3int_t * command = (command_3int_t *)(pkt_buf + ETHER_H_LEN + IP_H_LEN + UDP_H_LEN);
+	int len = sizeof(command_3int_t);
 
 	memcpy(command->id, CMD_WRITE, 4);
 	command->value0 = htonl(fd);
 	command->value1 = htonl(buf);
 	command->value2 = htonl(count);
-	build_send_packet(sizeof(command_3int_t));
+
+	/* Small writes carry their data along, so dc-tool needn't fetch it.
+	 * Older dc-tools ignore it and fetch the data anyway. */
+	if (count <= WRITE_INLINE_MAX) {
+		memcpy(command + 1, buf, count);
+		len += count;
+	}
+
+	build_send_packet(len);
+}
+
+int write(int fd, const void *buf, size_t count)
+{
+	if (stage.fd == fd)
+		unstage();
+
+	send_write(fd, buf, count);
 	bb->loop();
 
 	return syscall_retval;
@@ -136,6 +228,9 @@ int close(int fd)
 {
 	command_int_t * command = (command_int_t *)(pkt_buf + ETHER_H_LEN + IP_H_LEN + UDP_H_LEN);
 
+	if (stage.fd == fd)
+		stage.len = 0;
+
 	memcpy(command->id, CMD_CLOSE, 4);
 	command->value0 = htonl(fd);
 
@@ -233,6 +328,13 @@ off_t lseek(int fildes, off_t offset, int whence)
 {
 	command_3int_t * command = (command_3int_t *)(pkt_buf + ETHER_H_LEN + IP_H_LEN + UDP_H_LEN);
 
+	/* dc-tool is ahead by whatever hasn't been read from the stage */
+	if (stage.len && stage.fd == fildes) {
+		if (whence == SEEK_CUR)
+			offset -= stage.len - stage.pos;
+		stage.len = 0;
+	}
+
 	memcpy(command->id, CMD_LSEEK, 4);
 	command->value0 = htonl(fildes);
 	command->value1 = htonl(offset);
@@ -369,6 +471,121 @@ int rewinddir(DIR *dir)
 	return syscall_retval;
 }
 
+void send_pread(int fd, void *buf, size_t count, off_t offset)
+{
+	command_4int_t * command = (command_4int_t *)(pkt_buf + ETHER_H_LEN + IP_H_LEN + UDP_H_LEN);
+
+	memcpy(command->id, CMD_PREAD, 4);
+	command->value0 = htonl(fd);
+	command->value1 = htonl(buf);
+	command->value2 = htonl(count);
+	command->value3 = htonl(offset);
+	build_send_packet(sizeof(command_4int_t));
+}
+
+int pread(int fd, void *buf, size_t count, off_t offset)
+{
+	send_pread(fd, buf, count, offset);
+	bb->loop();
+
+	return syscall_retval;
+}
+
+/* one range of a preadv: len bytes at offset in the file go to buf */
+typedef struct {
+	unsigned int offset;
+	void *buf;
+	unsigned int len;
+} dcload_range_t;
+
+/* most ranges in one request, which is what dc-tool can send back in one
+ * transfer */
+#define PREADV_MAX 64
+
+/* read several ranges of fd with as few requests as possible, returning the
+ * total read. Like readv, this stops at the first short read. */
+int preadv(int fd, const dcload_range_t *ranges, int count)
+{
+	command_3int_string_t * command = (command_3int_string_t *)(pkt_buf + ETHER_H_LEN + IP_H_LEN + UDP_H_LEN);
+	unsigned int range[3];
+	unsigned int wanted;
+	int i, n, total = 0;
+
+	while (count > 0) {
+		n = (count > PREADV_MAX) ? PREADV_MAX : count;
+
+		memcpy(command->id, CMD_PREADV, 4);
+		command->value0 = htonl(fd);
+		command->value1 = htonl(n);
+		command->value2 = htonl(0);
+
+		wanted = 0;
+		for (i = 0; i < n; i++) {
+			range[0] = htonl(ranges[i].offset);
+			range[1] = htonl(ranges[i].buf);
+			range[2] = htonl(ranges[i].len);
+			memcpy(command->string + i * sizeof(range), range, sizeof(range));
+			wanted += ranges[i].len;
+		}
+
+		build_send_packet(sizeof(command_3int_string_t) - 1 + n * sizeof(range));
+		bb->loop();
+
+		if ((int)syscall_retval < 0)
+			return total ? total : (int)syscall_retval;
+
+		total += syscall_retval;
+		if (syscall_retval < wanted)
+			break;
+
+		ranges += n;
+		count -= n;
+	}
+
+	return total;
+}
+
+/* fill buf with as many dirent and stat records of dir as fit in size
+ * bytes, returning how many, 0 at the end of dir, or -1 on error */
+int readdirplus(DIR *dir, void *buf, size_t size)
+{
+	command_3int_t * command = (command_3int_t *)(pkt_buf + ETHER_H_LEN + IP_H_LEN + UDP_H_LEN);
+
+	memcpy(command->id, CMD_READDIRPLUS, 4);
+	command->value0 = htonl(dir);
+	command->value1 = htonl(buf);
+	command->value2 = htonl(size);
+
+	build_send_packet(sizeof(command_3int_t));
+	bb->loop();
+
+	return syscall_retval;
+}
+
+/* let dc-tool push up to size bytes of read-ahead into buf, or stop it
+ * with a size of 0 */
+int assign_stagemem(void *buf, size_t size)
+{
+	command_3int_t * command = (command_3int_t *)(pkt_buf + ETHER_H_LEN + IP_H_LEN + UDP_H_LEN);
+
+	unstage();
+	stage.buf = size ? buf : 0;
+	stage.size = size;
+
+	memcpy(command->id, CMD_STAGEMEM, 4);
+	command->value0 = htonl(stage.buf);
+	command->value1 = htonl(stage.size);
+	command->value2 = htonl(0);
+
+	build_send_packet(sizeof(command_3int_t));
+	bb->loop();
+
+	if ((int)syscall_retval < 0)
+		stage_reset();
+
+	return syscall_retval;
+}
+
 int gethostinfo(unsigned int *ip, unsigned int *port)
 {
 	*ip = tool_ip;
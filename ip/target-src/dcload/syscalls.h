@@ -22,6 +22,8 @@
 #ifndef __SYSCALLS_H__
 #define __SYSCALLS_H__
 
+#include <sys/types.h>
+
 #define CMD_EXIT     "DC00"
 #define CMD_FSTAT    "DC01"
 #define CMD_WRITE    "DD02"
@@ -44,9 +46,61 @@
 #define CMD_CDFSREAD "DC19"
 #define CMD_GDBPACKET "DC20"
 #define CMD_REWINDDIR "DC21"
+#define CMD_PREAD    "DC22"
+#define CMD_PREADV   "DC23"
+#define CMD_READDIRPLUS "DC24"
+#define CMD_STAGEMEM "DC25"
+#define CMD_CDFSTOC  "DC26"
 
 extern unsigned int syscall_retval;
 extern unsigned char* syscall_data;
+extern unsigned int syscall_staged;
+
+void stage_reset(void);
+void aio_reset(void);
+
+/* a non-blocking request, see aio_submit in aio.c */
+#define AIO_CDFSREAD	19	/* dcload's own, from the GD-ROM DMA reads */
+
+enum {
+	AIO_IDLE,
+	AIO_QUEUED,
+	AIO_SENT,
+	AIO_DONE
+};
+
+typedef struct dcload_aio {
+	int call;		/* SYSCALL_READ, SYSCALL_WRITE, SYSCALL_PREAD or AIO_CDFSREAD */
+	unsigned int arg[4];	/* fd, buf, count, and the offset for pread */
+	int tag;		/* the program's own */
+	int retval;
+	int state;
+	struct dcload_aio *next;
+} dcload_aio_t;
+
+/* hands a RETV to the non-blocking request on the wire, returning nonzero
+ * if there was one */
+int aio_retval(unsigned int retval, unsigned int staged_len);
+
+/* aio_queue is aio_submit without checking the call is one a program may
+ * make */
+int aio_queue(dcload_aio_t *aio);
+int aio_poll(dcload_aio_t *aio);
+int aio_complete(dcload_aio_t *aio);
+
+/* in cdfs_syscalls.c; the sector, buffer and size of an AIO_CDFSREAD */
+void send_cdfsread(unsigned int sector, void *buf, unsigned int size);
+
+/* in syscalls.c, for the queue in aio.c; put a request on the wire without
+ * waiting for the answer */
+void send_read(int fd, void *buf, size_t count);
+void send_write(int fd, const void *buf, size_t count);
+void send_pread(int fd, void *buf, size_t count, off_t offset);
+
+/* give what's left in the staging buffer back to its file, and take note of
+ * what dc-tool pushed there after a read of fd */
+void unstage(void);
+void staged(int fd, unsigned int len);
 
 typedef struct __attribute__ ((packed)) {
 	unsigned char id[4];
@@ -55,6 +109,14 @@ typedef struct __attribute__ ((packed)) {
 	unsigned int value2;
 } command_3int_t;
 
+typedef struct __attribute__ ((packed)) {
+	unsigned char id[4];
+	unsigned int value0;
+	unsigned int value1;
+	unsigned int value2;
+	unsigned int value3;
+} command_4int_t;
+
 typedef struct __attribute__ ((packed)) {
 	unsigned char id[4];
 	unsigned int value0;
@@ -19,6 +19,9 @@ int dcloadsyscall(unsigned int syscall, ...);
 #define pcutimenr 13
 #define pcassignwrkmem 14
 #define pcexitnr 15
+#define pcpreadnr 22
+#define pcpreadvnr 23
+#define pcreaddirplusnr 24
 
 #define DCLOADMAGICVALUE 0xdeadbeef
 #define DCLOADMAGICADDR  (unsigned int *)0x8c004004
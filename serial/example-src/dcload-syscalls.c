@@ -1,4 +1,5 @@
 #include "dcload-syscall.h"
+#include "dcload-syscalls.h"
 
 int link (const char *oldpath, const char *newpath)
 {
@@ -24,6 +25,30 @@ int lseek (int file, int ptr, int dir)
 	return -1;
 }
 
+int pread (int file, char *ptr, int len, int offset)
+{
+    if (*DCLOADMAGICADDR == DCLOADMAGICVALUE)
+	return dcloadsyscall(pcpreadnr, file, ptr, len, offset);
+    else
+	return -1;
+}
+
+int preadv (int file, const dcload_range_t *ranges, int count)
+{
+    if (*DCLOADMAGICADDR == DCLOADMAGICVALUE)
+	return dcloadsyscall(pcpreadvnr, file, ranges, count);
+    else
+	return -1;
+}
+
+int readdirplus (int dir, void *buf, int size)
+{
+    if (*DCLOADMAGICADDR == DCLOADMAGICVALUE)
+	return dcloadsyscall(pcreaddirplusnr, dir, buf, size);
+    else
+	return -1;
+}
+
 int write ( int file, char *ptr, int len)
 {
     if (*DCLOADMAGICADDR == DCLOADMAGICVALUE)
@@ -30,17 +30,30 @@ extern int put_uint(unsigned int val);
 
 int gdStatus;
 
+/* set by the 'T' command, from dc-tools that answer command 26 */
+int cdfs_host_toc;
+
 struct TOC {
   unsigned int entry[99];
   unsigned int first, last;
   unsigned int dunno;
 };
 
-int gdGdcReqCmd(int cmd, int *param)
+/* a single data track at LBA 150, for dc-tools that can't send the real
+ * TOC */
+static void builtin_toc(struct TOC *toc)
 {
-    struct TOC *toc;
     int i;
 
+    toc->entry[0] = 0x41000096; /* CTRL = 4, ADR = 1, LBA = 150 */
+    for(i=1; i<99; i++)
+	toc->entry[i] = -1;
+    toc->first = 0x41010000; /* first = track 1 */
+    toc->last = 0x41010000; /* last = track 1 */
+}
+
+int gdGdcReqCmd(int cmd, int *param)
+{
     switch (cmd) {
     case 16: /* read sectors */
 	scif_putchar(19);
@@ -51,13 +64,21 @@ int gdGdcReqCmd(int cmd, int *param)
 	gdStatus = 2;
 	return 0;
 	break;
-    case 19: /* read toc */
-	toc = (struct TOC *)param[1];
-	toc->entry[0] = 0x41000096; /* CTRL = 4, ADR = 1, LBA = 150 */
-	for(i=1; i<99; i++)
-	    toc->entry[i] = -1;
-	toc->first = 0x41010000; /* first = track 1 */
-	toc->last = 0x41010000; /* last = track 1 */
+    case 19: /* read toc, param[0] = area */
+	/* older dc-tools would take command 26 for garbage and lose sync */
+	if (!cdfs_host_toc) {
+	    builtin_toc((struct TOC *)param[1]);
+	    gdStatus = 2;
+	    return 0;
+	}
+	scif_putchar(26);
+	put_uint(param[0]);
+	load_data_block_general((unsigned char *)param[1], sizeof(struct TOC), 0);
+	/* the image has no tracks in that area */
+	if ((int)get_uint() < 0) {
+	    gdStatus = 0;
+	    return -1;
+	}
 	gdStatus = 2;
 	return 0;
 	break;
@@ -0,0 +1,7 @@
+#ifndef __CRC32_H__
+#define __CRC32_H__
+
+/* CRC-32 of len bytes at buf, matching dc-tool's, for delta uploads */
+unsigned int crc32_block(const unsigned char *buf, unsigned int len);
+
+#endif
@@ -19,12 +19,18 @@
  *
  */
 
+#include <string.h>
 #include "scif.h"
 #include "minilzo.h"
 #include "video.h"
+#include "crc32.h"
 
 #define NAME "dcload-serial " DCLOAD_VERSION
 
+/* letters of the optional commands we understand, listed after a '+' in our
+ * version line so dc-tool knows it can use them */
+#define CAPS "MKT"
+
 #define INITIAL_SPEED   57600
 
 #define VIDMODEREG (volatile unsigned int *)0xa05f8044
@@ -35,6 +41,7 @@ extern void go(unsigned int addr);
 extern void cdfs_redir_save(void);
 extern void cdfs_redir_disable(void);
 extern void cdfs_redir_enable(void);
+extern int cdfs_host_toc;
 
 /* buffer for storing compressed data (16384 + 16384 / 64 + 16 + 3 bytes) */
 unsigned char *buffer = (unsigned char *) 0x8c009f6c;
@@ -313,6 +320,8 @@ int main(void)
     unsigned int size;
     unsigned int console;
     unsigned int start;
+    unsigned int value;
+    unsigned int len;
 
     scif_init(INITIAL_SPEED);
 
@@ -405,8 +414,31 @@ int main(void)
 	    send_data_block_compressed((unsigned char *)addr, size);
 	    wrkmem = 0;
 	    break;
+	case 'M': /* fill memory */
+	    addr = get_uint();
+	    size = get_uint();
+	    value = get_uint();
+	    memset((unsigned char *)addr, value, size);
+	    break;
+	case 'K': /* crc32 of each chunk of a range, for delta uploads */
+	    addr = get_uint();
+	    size = get_uint();
+	    value = get_uint();
+	    if (!value)
+		value = 1024;
+	    while (size) {
+		len = (size > value) ? value : size;
+		put_uint(crc32_block((unsigned char *)addr, len));
+		addr += len;
+		size -= len;
+	    }
+	    break;
 	case 'H': /* enable cdfs redir */
 	    cdfs_redir_enable();
+	    cdfs_host_toc = 0;
+	    break;
+	case 'T': /* dc-tool answers command 26 with the disc's TOC */
+	    cdfs_host_toc = 1;
 	    break;
 	case 'S': /* change serial speed */
 	    addr = get_uint();
@@ -417,6 +449,7 @@ int main(void)
 	    break;
 	case 'V': /* version */
 	    scif_puts(NAME);
+	    scif_puts(" +" CAPS);
 	    scif_puts("\n");
 	    break;
 	default:
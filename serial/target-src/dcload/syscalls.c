@@ -296,3 +296,56 @@ int rewinddir(DIR *dir)
 	put_uint(dir);
 	return(get_uint());
 }
+
+int pread(int fd, void *buf, size_t count, off_t offset)
+{
+    scif_putchar(22);
+    put_uint(fd);
+    put_uint(count);
+    put_uint(offset);
+    load_data_block_general(buf, count, 0);
+    return (get_uint());
+}
+
+/* one range of a preadv: len bytes at offset in the file go to buf */
+typedef struct {
+    unsigned int offset;
+    void *buf;
+    unsigned int len;
+} dcload_range_t;
+
+/* read several ranges of fd in one request, returning the total read. Like
+ * readv, this stops at the first short read. */
+int preadv(int fd, const dcload_range_t *ranges, int count)
+{
+    int i;
+
+    scif_putchar(23);
+    put_uint(fd);
+    put_uint(count);
+    for (i = 0; i < count; i++) {
+	put_uint(ranges[i].offset);
+	put_uint(ranges[i].len);
+    }
+    for (i = 0; i < count; i++)
+	if (ranges[i].len)
+	    load_data_block_general(ranges[i].buf, ranges[i].len, 0);
+    return (get_uint());
+}
+
+/* fill buf with as many dirent and stat records of dir as fit in size
+ * bytes, returning how many, 0 at the end of dir, or -1 on error */
+int readdirplus(DIR *dir, void *buf, size_t size)
+{
+    unsigned int used;
+
+    scif_putchar(24);
+    put_uint(dir);
+    put_uint(size);
+
+    used = get_uint();
+    if (used)
+	load_data_block_general(buf, used, 0);
+
+    return (get_uint());
+}